@@ -0,0 +1,383 @@
+#pragma once
+
+#include "cache.h"
+
+/**
+ * Coroutine API over the caches, C++20 only: empty unless the compiler implements coroutines, the blocking
+ * API of cache.h stays the C++17 one.
+ *
+ */
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <tbb/concurrent_hash_map.h>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace LRUC {
+
+/**
+ * Task is a lazily started coroutine producing a T: its body starts running when awaited, and the awaiting
+ * coroutine is resumed by symmetric transfer once the body returns, or rethrows what the body threw.
+ *
+ * A Task is awaited at most once, and only from a coroutine. T is MoveConstructible.
+ *
+ */
+template <typename T>
+class Task final {
+ public:
+  struct promise_type final {
+    // resumes the awaiting coroutine, with no stack growth.
+    struct FinalAwaiter final {
+      bool await_ready() const noexcept {
+        return false;
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+        std::coroutine_handle<> continuation = handle.promise().continuation_;
+        return continuation ? continuation : std::noop_coroutine();
+      }
+
+      void await_resume() const noexcept {}
+    };
+
+    Task get_return_object() noexcept {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() const noexcept {
+      return {};
+    }
+
+    FinalAwaiter final_suspend() const noexcept {
+      return {};
+    }
+
+    template <typename U>
+    void return_value(U&& value) {
+      value_.emplace(std::forward<U>(value));
+    }
+
+    void unhandled_exception() noexcept {
+      error_ = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation_;
+    std::optional<T> value_;
+    std::exception_ptr error_;
+  };
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  Task& operator=(Task&&) = delete;
+
+  ~Task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+    handle_.promise().continuation_ = continuation;
+    return handle_;
+  }
+
+  T await_resume() {
+    promise_type& promise = handle_.promise();
+    if (promise.error_) {
+      std::rethrow_exception(promise.error_);
+    }
+
+    return std::move(*promise.value_);
+  }
+
+ private:
+  explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * InlineExecutor resumes a coroutine right away on the calling thread, the thread completing the load.
+ *
+ * An executor is a function object called as executor(handle) with a std::coroutine_handle<>, which must
+ * eventually call handle.resume() exactly once, e.g. from a thread pool or an event loop.
+ *
+ */
+struct InlineExecutor final {
+  void operator()(std::coroutine_handle<> handle) const {
+    handle.resume();
+  }
+};
+
+/**
+ * AsyncCache adds coroutine lookups to a cache it refers to(LRUCache, ShardedLRUCache, FlatLRUCache):
+ *
+ *  co_await find_async(key): the value of key as std::optional, empty on a miss.
+ *  co_await get_or_load_async(key, loader): the value of key, loaded by loader(key) on a miss.
+ *
+ * Hits complete without suspending, through the cache's own find(). Loading is single-flight as with
+ * LRUCache::get_or_load(), but misses of a key being loaded suspend instead of blocking their thread on
+ * its write lock: they are queued on the load, and resumed through TExecutor once it completes. Thus a few
+ * threads can keep many loads in flight, and loader itself may be a coroutine.
+ *
+ * loaded values are stored with insert_or_assign(), the cache itself knows nothing of AsyncCache: keys
+ * loaded through the blocking API or through another AsyncCache of the same cache are not coalesced
+ * with these loads. A loader exception propagates to every caller waiting for the load, nothing is stored.
+ *
+ * The cache and the executor must outlive the AsyncCache, the AsyncCache all of its pending loads.
+ *
+ * Type concepts:
+ * TCache provides ConstAccessor(with release()), find(ConstAccessor&, const TKey&) and
+ *  insert_or_assign(const TKey&, TValue).
+ * TKey type requires TBB::HashCompare concept through THash, and CopyConstructible.
+ * TValue type requires CopyConstructible.
+ * TExecutor, see InlineExecutor.
+ * loader is invocable with const TKey&, returning either a value convertible to TValue or an awaitable
+ *  of one, e.g. a Task.
+ *
+ * AsyncCache is C++20 only
+ *
+ */
+template <typename TKey,
+          typename TValue,
+          typename TCache = LRUCache<TKey, TValue>,
+          typename TExecutor = InlineExecutor,
+          typename THash = tbb::tbb_hash_compare<TKey>>
+class AsyncCache final {
+ private:
+  /**
+   * Flight is a load in progress, shared by its loader and the callers waiting for it.
+   * Guarded by flightsMutex_.
+   *
+   */
+  struct Flight final {
+    bool done_{false};
+    std::optional<TValue> value_;
+    std::exception_ptr error_;
+    std::vector<std::coroutine_handle<>> waiters_;
+  };
+
+  // THash as a std::unordered_map hasher and key equality.
+  struct FlightHash final {
+    size_t operator()(const TKey& key) const {
+      return THash().hash(key);
+    }
+  };
+
+  struct FlightEqual final {
+    bool operator()(const TKey& lhs, const TKey& rhs) const {
+      return THash().equal(lhs, rhs);
+    }
+  };
+
+  using Flights = std::unordered_map<TKey, std::shared_ptr<Flight>, FlightHash, FlightEqual>;
+
+ private:
+  // data members
+  TCache& cache_;
+  TExecutor executor_;
+
+  std::mutex flightsMutex_;
+  Flights flights_;
+
+ private:
+  /**
+   * FlightAwaiter suspends the caller until flight completes, unless it already did.
+   *
+   */
+  struct FlightAwaiter final {
+    AsyncCache& cache_;
+    Flight* flight_;  // kept alive by the awaiting caller
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      std::lock_guard<std::mutex> lock(cache_.flightsMutex_);
+      if (flight_->done_) {
+        return false;
+      }
+
+      flight_->waiters_.push_back(handle);
+      return true;
+    }
+
+    // the loaded value, or the loader's exception, flight is done and no longer written.
+    const Flight& await_resume() const noexcept {
+      return *flight_;
+    }
+  };
+
+  /**
+   * FindAwaiter is find_async(): ready right away on a hit or if key is not being loaded.
+   *
+   */
+  struct FindAwaiter final {
+    AsyncCache& cache_;
+    TKey key_;
+    std::optional<TValue> value_;
+    std::shared_ptr<Flight> flight_;
+
+    bool await_ready() {
+      typename TCache::ConstAccessor ac;
+      if (cache_.cache_.find(ac, key_)) {
+        value_.emplace(*ac);
+        return true;
+      }
+
+      flight_ = cache_.flightOf(key_);
+      return flight_ == nullptr;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      return FlightAwaiter{cache_, flight_.get()}.await_suspend(handle);
+    }
+
+    std::optional<TValue> await_resume() {
+      if (flight_ != nullptr && !flight_->error_) {
+        return flight_->value_;
+      }
+
+      return std::move(value_);
+    }
+  };
+
+  // load in progress of key, nullptr if none.
+  std::shared_ptr<Flight> flightOf(const TKey& key) {
+    std::lock_guard<std::mutex> lock(flightsMutex_);
+    auto it = flights_.find(key);
+    return it != flights_.end() ? it->second : nullptr;
+  }
+
+  /**
+   * Complete flight of key, with value or error, then resume its waiters through the executor.
+   *
+   */
+  void complete(const TKey& key, Flight& flight, std::optional<TValue> value, std::exception_ptr error) {
+    std::vector<std::coroutine_handle<>> waiters;
+    {
+      std::lock_guard<std::mutex> lock(flightsMutex_);
+      flight.done_ = true;
+      flight.value_ = std::move(value);
+      flight.error_ = std::move(error);
+      waiters.swap(flight.waiters_);
+      flights_.erase(key);
+    }
+
+    for (std::coroutine_handle<> waiter : waiters) {
+      executor_(waiter);
+    }
+  }
+
+  template <typename F>
+  static Task<TValue> load(F& loader, const TKey& key) {
+    if constexpr (std::is_convertible_v<std::invoke_result_t<F&, const TKey&>, TValue>) {
+      co_return std::invoke(loader, key);
+    } else {
+      co_return co_await std::invoke(loader, key);
+    }
+  }
+
+ public:
+  explicit AsyncCache(TCache& cache, TExecutor executor = TExecutor())
+    : cache_(cache), executor_(std::move(executor)) {}
+
+  AsyncCache(const AsyncCache&) = delete;
+  AsyncCache& operator=(const AsyncCache&) = delete;
+
+  /**
+   * find_async finds key, waiting for its value if it is being loaded through get_or_load_async().
+   * Return the value found or loaded, empty if key does not exist or its load failed.
+   *
+   * Does not suspend unless key is being loaded. find_async updates key access frequency.
+   *
+   */
+  FindAwaiter find_async(const TKey& key) {
+    return FindAwaiter{*this, key, std::nullopt, nullptr};
+  }
+
+  /**
+   * get_or_load_async finds key, or stores the value returned or co_returned by loader(key) on a miss.
+   * Return the value found or loaded.
+   *
+   * Loading is single-flight: concurrent misses on the same key coalesce, exactly one caller runs loader
+   * while the others suspend until it completes, then resume through the executor.
+   * If loader throws, nothing is stored and every waiting caller rethrows the exception.
+   *
+   * key and loader are copied into the coroutine, loader is called with no cache lock held.
+   *
+   */
+  template <typename F>
+  Task<TValue> get_or_load_async(TKey key, F loader) {
+    typename TCache::ConstAccessor ac;
+    if (cache_.find(ac, key)) {
+      co_return *ac;
+    }
+
+    std::shared_ptr<Flight> flight;
+    bool loading = false;
+    {
+      std::lock_guard<std::mutex> lock(flightsMutex_);
+      std::shared_ptr<Flight>& inFlight = flights_[key];
+      if (inFlight == nullptr) {
+        inFlight = std::make_shared<Flight>();
+        loading = true;
+      }
+      flight = inFlight;
+    }
+
+    if (!loading) {
+      const Flight& loaded = co_await FlightAwaiter{*this, flight.get()};
+      if (loaded.error_) {
+        std::rethrow_exception(loaded.error_);
+      }
+
+      co_return *loaded.value_;
+    }
+
+    std::optional<TValue> value;
+    std::exception_ptr error;
+    try {
+      // loaded by a flight completed between the miss and this one's start.
+      if (cache_.find(ac, key)) {
+        value.emplace(*ac);
+        // ac may hold a lock of TCache(e.g. a tbb::concurrent_hash_map const_accessor): a waiter resumed inline
+        // by complete() and writing key would deadlock.
+        ac.release();
+      } else {
+        value.emplace(co_await load(loader, key));
+        cache_.insert_or_assign(key, *value);
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    if (error) {
+      complete(key, *flight, std::nullopt, error);
+      std::rethrow_exception(error);
+    }
+
+    complete(key, *flight, value, nullptr);
+    co_return std::move(*value);
+  }
+};
+
+}  // namespace LRUC
+
+#endif
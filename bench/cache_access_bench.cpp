@@ -0,0 +1,65 @@
+/**
+ * Cost of reaching the process-wide Cache from outside libsingleton.so, this binary being such a DSO.
+ *
+ * GetCache: getCache(key), a PLT call into libsingleton.so resolving the NUMA node every time.
+ * BoundCache: boundCache(key), a load of this DSO's own binding once the first call resolved it, which
+ *  only happens with a single Cache: getCache(key) again otherwise.
+ * Find*: a find() hit through either, to put the access cost next to that of the operation.
+ *
+ * Run with LRUC_NUMA_NODES=2 for the multi-node paths on any machine, with either LRUC_NUMA_PLACEMENT.
+ * Reported counter: caches, getCacheCount() of the run.
+ *
+ */
+
+#include "../singleton.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+constexpr int Key = 42;
+
+void reportCaches(benchmark::State& state) {
+  state.counters["caches"] = static_cast<double>(getCacheCount());
+}
+
+void BM_GetCache(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&getCache(Key));
+  }
+  reportCaches(state);
+}
+
+void BM_BoundCache(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&boundCache(Key));
+  }
+  reportCaches(state);
+}
+
+void BM_FindGetCache(benchmark::State& state) {
+  getCache(Key).insert(Key, Key);
+  for (auto _ : state) {
+    Cache::ConstAccessor accessor;
+    benchmark::DoNotOptimize(getCache(Key).find(accessor, Key));
+  }
+  reportCaches(state);
+}
+
+void BM_FindBoundCache(benchmark::State& state) {
+  boundCache(Key).insert(Key, Key);
+  for (auto _ : state) {
+    Cache::ConstAccessor accessor;
+    benchmark::DoNotOptimize(boundCache(Key).find(accessor, Key));
+  }
+  reportCaches(state);
+}
+
+}  // namespace
+
+BENCHMARK(BM_GetCache);
+BENCHMARK(BM_BoundCache);
+BENCHMARK(BM_FindGetCache);
+BENCHMARK(BM_FindBoundCache);
+
+BENCHMARK_MAIN();
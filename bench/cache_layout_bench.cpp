@@ -0,0 +1,94 @@
+/**
+ * Microbenchmark of the LRUCache data member layout.
+ *
+ * Build twice to compare the cache-line separated layout with the packed one, see cmd.txt:
+ *  -DLRUC_CACHELINE_SIZE=64(default) keeps the member groups on distinct cache lines,
+ *  -DLRUC_CACHELINE_SIZE=8 packs them as adjacent members.
+ *
+ * False sharing only shows with at least as many cores as benchmark threads.
+ *
+ */
+
+#include "../cache.h"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+using Cache = LRUC::LRUCache<int, int>;
+
+constexpr int Capacity = 1 << 16;
+
+// keys inserted beyond the capacity, wrapped before int overflow.
+constexpr int KeyMask = (1 << 24) - 1;
+
+// one cache shared by all threads of a benchmark, filled with keys [0, Capacity).
+Cache& filledCache() {
+  static Cache cache(Capacity);
+  static const bool filled = [] {
+    for (int i = 0; i < Capacity; ++i) {
+      cache.insert(i, i);
+    }
+    return true;
+  }();
+
+  (void)filled;
+  return cache;
+}
+
+// every thread hits its own keys: the list lock and read buffer are shared, hash-table buckets are not.
+void BM_FindHit(benchmark::State& state) {
+  Cache& cache = filledCache();
+  Cache::ConstAccessor ac;
+  int key = state.thread_index() * (Capacity / 64);
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(cache.find(ac, key));
+    key = (key + 1) & (Capacity - 1);
+  }
+}
+BENCHMARK(BM_FindHit)->ThreadRange(1, 8)->UseRealTime();
+
+// thread 0 polls size() while the others insert over capacity: current_size_ is republished by every
+// insert under the list lock, the poller should only pull that cache line.
+void BM_InsertWithSizePoller(benchmark::State& state) {
+  Cache& cache = filledCache();
+
+  if (state.thread_index() == 0) {
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(cache.size());
+    }
+    return;
+  }
+
+  int key = Capacity + state.thread_index();
+  for (auto _ : state) {
+    cache.insert(key, key);
+    key = (key + state.threads()) & KeyMask;
+  }
+}
+BENCHMARK(BM_InsertWithSizePoller)->ThreadRange(2, 8)->UseRealTime();
+
+// 90% hits and 10% evicting inserts on every thread.
+void BM_Mixed(benchmark::State& state) {
+  Cache& cache = filledCache();
+  Cache::ConstAccessor ac;
+  int hitKey = state.thread_index() * (Capacity / 64);
+  int missKey = Capacity + state.thread_index();
+  int i = 0;
+
+  for (auto _ : state) {
+    if (++i % 10 == 0) {
+      cache.insert(missKey, missKey);
+      missKey = (missKey + state.threads()) & KeyMask;
+    } else {
+      benchmark::DoNotOptimize(cache.find(ac, hitKey));
+      hitKey = (hitKey + 1) & (Capacity - 1);
+    }
+  }
+}
+BENCHMARK(BM_Mixed)->ThreadRange(1, 8)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
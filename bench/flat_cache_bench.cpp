@@ -0,0 +1,247 @@
+/**
+ * FlatLRUCache against LRUCache for small trivially copyable keys and values.
+ *
+ * Every benchmark runs on 1..N threads sharing a single cache, N being the hardware concurrency, for
+ * int->int and uint64_t->16 bytes struct caches:
+ *  CacheAside: find the key, insert it on a miss, Zipf(0.99) keys over 4 times the capacity.
+ *  Find: find() only, of keys prefilled into half of the capacity.
+ *  Insert: insert() of absent keys into a full cache, every insert evicts.
+ *
+ * Reported counters besides time per operation:
+ *  hit_ratio: ratio of find() hits, averaged over threads.
+ *  bytes_per_entry: memory allocated by the cache through its allocator, per cached entry once prefilled.
+ *
+ */
+
+#include "../flat_cache.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int Capacity = 1 << 16;
+
+constexpr int KeySpace = Capacity * 4;
+
+constexpr size_t SequenceLength = KeySpace;
+
+int maxThreads() {
+  return static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+// bytes currently allocated through CountingAllocator, by every cache of the process.
+std::atomic<int64_t> allocatedBytes{0};
+
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    allocatedBytes.fetch_add(static_cast<int64_t>(n * sizeof(T)), std::memory_order_relaxed);
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    allocatedBytes.fetch_sub(static_cast<int64_t>(n * sizeof(T)), std::memory_order_relaxed);
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <typename U>
+  bool operator==(const CountingAllocator<U>&) const {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const CountingAllocator<U>&) const {
+    return false;
+  }
+};
+
+struct Small {
+  uint64_t id;
+  uint32_t flags;
+  float score;
+};
+
+template <typename TKey, typename TValue>
+using Flat = LRUC::FlatLRUCache<TKey, TValue, tbb::tbb_hash_compare<TKey>, CountingAllocator<TValue>>;
+
+template <typename TKey, typename TValue>
+using General = LRUC::LRUCache<TKey,
+                               TValue,
+                               tbb::tbb_hash_compare<TKey>,
+                               LRUC::EvictionPolicy::LRU,
+                               LRUC::UnitWeigher,
+                               false,
+                               CountingAllocator<TValue>>;
+
+// Zipf(0.99) keys in [1, KeySpace] for the given thread, inverse transform sampling.
+std::vector<int> zipfSequence(int threadIndex) {
+  static const std::vector<double> cdf = [] {
+    std::vector<double> c(KeySpace);
+    double sum = 0;
+    for (int rank = 0; rank < KeySpace; ++rank) {
+      sum += 1.0 / std::pow(rank + 1, 0.99);
+      c[rank] = sum;
+    }
+    for (double& p : c) {
+      p /= sum;
+    }
+    return c;
+  }();
+
+  std::vector<int> keys(SequenceLength);
+  std::mt19937_64 rng(0x9E3779B97F4A7C15ull + static_cast<uint64_t>(threadIndex));
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  for (int& key : keys) {
+    const auto rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+    key = static_cast<int>(std::min<std::ptrdiff_t>(rank, KeySpace - 1)) + 1;
+  }
+  return keys;
+}
+
+// one cache per benchmark run, shared by its threads.
+template <typename TCache>
+std::unique_ptr<TCache>& sharedCache() {
+  static std::unique_ptr<TCache> cache;
+  return cache;
+}
+
+// Setup of a run, before its threads start: a new cache holding keys [1, Prefill].
+template <typename TCache, typename TKey, typename TValue, int Prefill>
+void setUp(const benchmark::State&) {
+  auto& cache = sharedCache<TCache>();
+  cache = std::make_unique<TCache>(Capacity);
+  for (int key = 1; key <= Prefill; ++key) {
+    cache->insert(static_cast<TKey>(key), TValue{});
+  }
+}
+
+template <typename TCache>
+void tearDown(const benchmark::State&) {
+  sharedCache<TCache>().reset();
+}
+
+template <typename TCache>
+void reportMemory(benchmark::State& state, const TCache& cache) {
+  if (state.thread_index() == 0) {
+    state.counters["bytes_per_entry"] = static_cast<double>(allocatedBytes.load(std::memory_order_relaxed)) /
+                                        static_cast<double>(std::max(cache.size(), 1));
+  }
+}
+
+template <typename TCache, typename TKey, typename TValue>
+void BM_CacheAside(benchmark::State& state) {
+  auto& cache = *sharedCache<TCache>();
+
+  const std::vector<int> keys = zipfSequence(state.thread_index());
+  typename TCache::ConstAccessor ac;
+  size_t i = 0;
+  int64_t hits = 0;
+
+  for (auto _ : state) {
+    const TKey key = static_cast<TKey>(keys[i++ & (SequenceLength - 1)]);
+    if (cache.find(ac, key)) {
+      ++hits;
+    } else {
+      cache.insert(key, TValue{});
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hit_ratio"] = benchmark::Counter(
+    static_cast<double>(hits) / static_cast<double>(std::max<int64_t>(state.iterations(), 1)),
+    benchmark::Counter::kAvgThreads);
+  reportMemory(state, cache);
+}
+
+template <typename TCache, typename TKey, typename TValue>
+void BM_Find(benchmark::State& state) {
+  auto& cache = *sharedCache<TCache>();
+
+  std::vector<TKey> keys(SequenceLength);
+  std::mt19937_64 rng(static_cast<uint64_t>(state.thread_index()));
+  std::uniform_int_distribution<int> uniform(1, Capacity / 2);
+  std::generate(keys.begin(), keys.end(), [&] { return static_cast<TKey>(uniform(rng)); });
+
+  typename TCache::ConstAccessor ac;
+  size_t i = 0;
+  int64_t hits = 0;
+
+  for (auto _ : state) {
+    hits += cache.find(ac, keys[i++ & (SequenceLength - 1)]);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hit_ratio"] = benchmark::Counter(
+    static_cast<double>(hits) / static_cast<double>(std::max<int64_t>(state.iterations(), 1)),
+    benchmark::Counter::kAvgThreads);
+  reportMemory(state, cache);
+}
+
+template <typename TCache, typename TKey, typename TValue>
+void BM_Insert(benchmark::State& state) {
+  auto& cache = *sharedCache<TCache>();
+
+  // distinct keys per thread, beyond the prefilled ones.
+  constexpr int MaxKey = 1 << 30;
+  int key = Capacity + 1 + state.thread_index();
+
+  for (auto _ : state) {
+    cache.insert(static_cast<TKey>(key), TValue{});
+    key += state.threads();
+    if (key > MaxKey) {
+      key = Capacity + 1 + state.thread_index();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// registers benchmark fn of TCache prefilled with Prefill keys.
+template <typename TCache, typename TKey, typename TValue, int Prefill>
+void registerCache(const char* name, void (*fn)(benchmark::State&)) {
+  benchmark::RegisterBenchmark(name, fn)
+    ->Setup(&setUp<TCache, TKey, TValue, Prefill>)
+    ->Teardown(&tearDown<TCache>)
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime();
+}
+
+template <template <typename, typename> class TCache, typename TKey, typename TValue>
+void registerAll(const char* cacheAside, const char* find, const char* insert) {
+  using Cache = TCache<TKey, TValue>;
+  registerCache<Cache, TKey, TValue, 0>(cacheAside, &BM_CacheAside<Cache, TKey, TValue>);
+  registerCache<Cache, TKey, TValue, Capacity / 2>(find, &BM_Find<Cache, TKey, TValue>);
+  registerCache<Cache, TKey, TValue, Capacity>(insert, &BM_Insert<Cache, TKey, TValue>);
+}
+
+// benchmarks are registered at static initialization, after the functions above are defined.
+const bool Registered = [] {
+  registerAll<General, int, int>("BM_CacheAside<LRUCache, int>", "BM_Find<LRUCache, int>", "BM_Insert<LRUCache, int>");
+  registerAll<Flat, int, int>("BM_CacheAside<FlatLRUCache, int>", "BM_Find<FlatLRUCache, int>",
+                              "BM_Insert<FlatLRUCache, int>");
+  registerAll<General, uint64_t, Small>("BM_CacheAside<LRUCache, Small>", "BM_Find<LRUCache, Small>",
+                                        "BM_Insert<LRUCache, Small>");
+  registerAll<Flat, uint64_t, Small>("BM_CacheAside<FlatLRUCache, Small>", "BM_Find<FlatLRUCache, Small>",
+                                     "BM_Insert<FlatLRUCache, Small>");
+  return true;
+}();
+
+}  // namespace
+
+BENCHMARK_MAIN();
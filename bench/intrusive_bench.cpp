@@ -0,0 +1,612 @@
+/**
+ * IntrusiveHashTable and FlatHashTable benchmarks against std::unordered_map.
+ *
+ * Both tables hold state.range(0) items and are sized for them upfront, IntrusiveHashTable with the
+ * size hint and std::unordered_map with reserve(), so that no benchmark measures a rehash but the *Growing
+ * ones, starting from the default size.
+ * Keys are 1..N in a shuffled order, IntrusiveHashTable does not allow a 0 hash.
+ * Insert and find benchmarks run against both bucket policies, PrimeBuckets(Table) and PowerOfTwoBuckets,
+ * and against FlatHashTable.
+ * Dense keys are the best case of PrimeBuckets with the identity std::hash<int>: no bucket collides.
+ * findBatch() and forEach() are measured against the same lookups through find() and the iterators.
+ * BM_SharedFind runs the find benchmark from several threads over one table, ConcurrentIntrusiveHashTable
+ * against IntrusiveHashTable behind a std::shared_mutex.
+ * BM_SharedInsertGrowing inserts state.range(0) items into such a table from the default size while reader
+ * threads keep finding its first items, to show what growth costs both sides: max_insert_us and max_find_us
+ * are the slowest single insert and find of the run.
+ *
+ */
+
+#include "../concurrent_intrusive.h"
+#include "../flat_hash_table.h"
+#include "../intrusive.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+struct Item final : public HashTableNode<Item> {
+  Item() = default;
+  explicit Item(int key) : key_(key), value_(key) {}
+
+  int key_{0};
+  int value_{0};
+};
+
+using Table = IntrusiveHashTable<int, Item>;
+using PowerOfTwoTable = IntrusiveHashTable<int, Item, std::hash<int>, HashOnlyEqual, PowerOfTwoBuckets>;
+using FlatTable = FlatHashTable<int, Item>;
+using Map = std::unordered_map<int, Item>;
+
+// string-keyed items, compared by key once hashes match.
+struct NamedItem final : public HashTableNode<NamedItem> {
+  explicit NamedItem(std::string name) : name_(std::move(name)) {}
+
+  std::string name_;
+};
+
+using StringTable =
+  IntrusiveHashTable<std::string, NamedItem, std::hash<std::string>, MemberKeyEqual<&NamedItem::name_>>;
+using FlatStringTable =
+  FlatHashTable<std::string, NamedItem, std::hash<std::string>, MemberKeyEqual<&NamedItem::name_>>;
+using StringMap = std::unordered_map<std::string, NamedItem>;
+
+struct ConcurrentItem final : public ConcurrentHashTableNode<ConcurrentItem> {
+  explicit ConcurrentItem(int key) : key_(key), value_(key) {}
+
+  int key_{0};
+  int value_{0};
+};
+
+using ConcurrentTable = ConcurrentIntrusiveHashTable<int, ConcurrentItem>;
+
+// IntrusiveHashTable made thread-safe the usual way, lookups share a reader-writer lock.
+class LockedTable final {
+ public:
+  LockedTable(bool allowDuplicateKeys, size_t sizeHint) : table_(allowDuplicateKeys, sizeHint) {}
+
+  bool insert(int key, Item* item) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    return table_.insert(key, item);
+  }
+
+  Item* find(int key) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return table_.find(key);
+  }
+
+ private:
+  mutable std::shared_mutex mutex_;
+  Table table_;
+};
+
+// keys 1..count in a shuffled order.
+std::vector<int> shuffledKeys(int64_t count) {
+  std::vector<int> keys(static_cast<size_t>(count));
+  for (size_t i = 0; i < keys.size(); ++i) {
+    keys[i] = static_cast<int>(i) + 1;
+  }
+
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+  return keys;
+}
+
+// string keys of the form "item/<key>", long enough not to fit the small string buffer.
+std::vector<std::string> namesOf(const std::vector<int>& keys) {
+  std::vector<std::string> names;
+  names.reserve(keys.size());
+  for (int key : keys) {
+    names.push_back("item/0000000000000000/" + std::to_string(key));
+  }
+
+  return names;
+}
+
+// items of keys, to be linked into an IntrusiveHashTable.
+std::vector<Item> itemsOf(const std::vector<int>& keys) {
+  std::vector<Item> items;
+  items.reserve(keys.size());
+  for (int key : keys) {
+    items.emplace_back(key);
+  }
+
+  return items;
+}
+
+// insert all items then clear, the clear is not timed.
+template <class T>
+void BM_IntrusiveInsert(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  T table(false, keys.size());
+
+  for (auto _ : state) {
+    for (Item& item : items) {
+      benchmark::DoNotOptimize(table.insert(item.key_, &item));
+    }
+
+    state.PauseTiming();
+    table.clear();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_UnorderedMapInsert(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  Map map;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    map.clear();
+    map.reserve(keys.size());
+    state.ResumeTiming();
+
+    for (int key : keys) {
+      benchmark::DoNotOptimize(map.emplace(key, Item(key)));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// insert all items into a table allocated with the default size, which grows along.
+void BM_IntrusiveInsertGrowing(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  Table table(false);
+
+  for (auto _ : state) {
+    for (Item& item : items) {
+      benchmark::DoNotOptimize(table.insert(item.key_, &item));
+    }
+
+    state.PauseTiming();
+    table.deallocate();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_UnorderedMapInsertGrowing(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  Map map;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    map = Map();
+    state.ResumeTiming();
+
+    for (int key : keys) {
+      benchmark::DoNotOptimize(map.emplace(key, Item(key)));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// find every key, in an order different from the insertion order.
+template <class T>
+void BM_IntrusiveFind(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  T table(false, keys.size());
+  for (Item& item : items) {
+    table.insert(item.key_, &item);
+  }
+
+  std::vector<int> lookups = keys;
+  std::reverse(lookups.begin(), lookups.end());
+
+  for (auto _ : state) {
+    for (int key : lookups) {
+      benchmark::DoNotOptimize(table.find(key));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// BM_IntrusiveFind through findBatch(), which prefetches the keys ahead.
+template <class T>
+void BM_IntrusiveFindBatch(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  T table(false, keys.size());
+  for (Item& item : items) {
+    table.insert(item.key_, &item);
+  }
+
+  std::vector<int> lookups = keys;
+  std::reverse(lookups.begin(), lookups.end());
+  std::vector<Item*> found(lookups.size());
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.findBatch(lookups.data(), lookups.size(), found.data()));
+    benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// visit every item with the iterators, items lie in memory in another order than the buckets.
+void BM_IntrusiveIterate(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  Table table(false, keys.size());
+  for (Item& item : items) {
+    table.insert(item.key_, &item);
+  }
+
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const Item& item : table) {
+      sum += item.value_;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// BM_IntrusiveIterate through forEach(), which prefetches the buckets ahead.
+void BM_IntrusiveForEach(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  Table table(false, keys.size());
+  for (Item& item : items) {
+    table.insert(item.key_, &item);
+  }
+
+  for (auto _ : state) {
+    int64_t sum = 0;
+    table.forEach([&sum](const Item* item) { sum += item->value_; });
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_UnorderedMapFind(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  Map map;
+  map.reserve(keys.size());
+  for (int key : keys) {
+    map.emplace(key, Item(key));
+  }
+
+  std::vector<int> lookups = keys;
+  std::reverse(lookups.begin(), lookups.end());
+
+  for (auto _ : state) {
+    for (int key : lookups) {
+      benchmark::DoNotOptimize(map.find(key));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// find absent keys.
+template <class T>
+void BM_IntrusiveFindMiss(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  T table(false, keys.size());
+  for (Item& item : items) {
+    table.insert(item.key_, &item);
+  }
+
+  const int offset = static_cast<int>(keys.size());
+  for (auto _ : state) {
+    for (int key : keys) {
+      benchmark::DoNotOptimize(table.find(key + offset));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_UnorderedMapFindMiss(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  Map map;
+  map.reserve(keys.size());
+  for (int key : keys) {
+    map.emplace(key, Item(key));
+  }
+
+  const int offset = static_cast<int>(keys.size());
+  for (auto _ : state) {
+    for (int key : keys) {
+      benchmark::DoNotOptimize(map.find(key + offset));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// find every string key.
+template <class T>
+void BM_IntrusiveFindString(benchmark::State& state) {
+  const std::vector<std::string> names = namesOf(shuffledKeys(state.range(0)));
+  std::vector<NamedItem> items;
+  items.reserve(names.size());
+  T table(false, names.size());
+  for (const std::string& name : names) {
+    items.emplace_back(name);
+    table.insert(name, &items.back());
+  }
+
+  std::vector<std::string> lookups = names;
+  std::reverse(lookups.begin(), lookups.end());
+
+  for (auto _ : state) {
+    for (const std::string& name : lookups) {
+      benchmark::DoNotOptimize(table.find(name));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_UnorderedMapFindString(benchmark::State& state) {
+  const std::vector<std::string> names = namesOf(shuffledKeys(state.range(0)));
+  StringMap map;
+  map.reserve(names.size());
+  for (const std::string& name : names) {
+    map.emplace(name, NamedItem(name));
+  }
+
+  std::vector<std::string> lookups = names;
+  std::reverse(lookups.begin(), lookups.end());
+
+  for (auto _ : state) {
+    for (const std::string& name : lookups) {
+      benchmark::DoNotOptimize(map.find(name));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// remove all items, the refill is not timed.
+void BM_IntrusiveRemove(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  std::vector<Item> items = itemsOf(keys);
+  Table table(false, keys.size());
+
+  std::vector<int> removals = keys;
+  std::reverse(removals.begin(), removals.end());
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (Item& item : items) {
+      table.insert(item.key_, &item);
+    }
+    state.ResumeTiming();
+
+    for (int key : removals) {
+      benchmark::DoNotOptimize(table.remove(key));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_UnorderedMapErase(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  Map map;
+  map.reserve(keys.size());
+
+  std::vector<int> removals = keys;
+  std::reverse(removals.begin(), removals.end());
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (int key : keys) {
+      map.emplace(key, Item(key));
+    }
+    state.ResumeTiming();
+
+    for (int key : removals) {
+      benchmark::DoNotOptimize(map.erase(key));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// number of items of the shared tables.
+constexpr int64_t SharedItems = 1 << 16;
+
+// one table and its items per run, shared by the run's threads.
+// A deque never moves the items, ConcurrentItem can't be moved.
+template <class T, class I>
+struct SharedTable {
+  static std::unique_ptr<T> table;
+  static std::deque<I> items;
+
+  // Setup of a run, before its threads start.
+  static void setUp(const benchmark::State&) {
+    const std::vector<int> keys = shuffledKeys(SharedItems);
+    items.clear();
+    table = std::make_unique<T>(false, keys.size());
+    for (int key : keys) {
+      items.emplace_back(key);
+      table->insert(key, &items.back());
+    }
+  }
+
+  static void tearDown(const benchmark::State&) {
+    table.reset();
+    items.clear();
+  }
+};
+
+template <class T, class I>
+std::unique_ptr<T> SharedTable<T, I>::table;
+
+template <class T, class I>
+std::deque<I> SharedTable<T, I>::items;
+
+// find every key of the shared table, each thread in its own order.
+template <class T, class I>
+void BM_SharedFind(benchmark::State& state) {
+  std::vector<int> lookups = shuffledKeys(SharedItems);
+  std::shuffle(lookups.begin(), lookups.end(), std::mt19937(static_cast<unsigned>(state.thread_index())));
+  const T& table = *SharedTable<T, I>::table;
+
+  for (auto _ : state) {
+    for (int key : lookups) {
+      benchmark::DoNotOptimize(table.find(key));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * SharedItems);
+}
+
+int maxThreads() {
+  return static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+// items found by the readers of BM_SharedInsertGrowing, inserted before they start.
+constexpr int64_t ReadItems = 1 << 10;
+
+// DefaultCapacity of ConcurrentIntrusiveHashTable.
+constexpr size_t GrowingSizeHint = 2053;
+
+template <typename FN>
+int64_t nanosOf(FN fn) {
+  const auto start = std::chrono::steady_clock::now();
+  fn();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// one writer growing a fresh table per iteration, range(1) reader threads.
+template <class T, class I>
+void BM_SharedInsertGrowing(benchmark::State& state) {
+  const std::vector<int> keys = shuffledKeys(state.range(0));
+  const auto readers = static_cast<int>(state.range(1));
+  int64_t maxInsert = 0;
+  std::atomic<int64_t> maxFind{0};
+  std::atomic<int64_t> finds{0};
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::deque<I> items;
+    T table(false, GrowingSizeHint);
+    for (int64_t i = 0; i < ReadItems; ++i) {
+      items.emplace_back(keys[static_cast<size_t>(i)]);
+      table.insert(items.back().key_, &items.back());
+    }
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> threads;
+    for (int reader = 0; reader < readers; ++reader) {
+      threads.emplace_back([&, reader] {
+        std::mt19937 rng(static_cast<unsigned>(reader));
+        int64_t slowest = 0;
+        int64_t count = 0;
+        while (running.load(std::memory_order_relaxed)) {
+          const int key = keys[rng() % ReadItems];
+          slowest = std::max(slowest, nanosOf([&] { benchmark::DoNotOptimize(table.find(key)); }));
+          ++count;
+        }
+        finds.fetch_add(count, std::memory_order_relaxed);
+        int64_t max = maxFind.load(std::memory_order_relaxed);
+        while (slowest > max && !maxFind.compare_exchange_weak(max, slowest, std::memory_order_relaxed)) {
+        }
+      });
+    }
+    state.ResumeTiming();
+
+    for (size_t i = ReadItems; i < keys.size(); ++i) {
+      items.emplace_back(keys[i]);
+      I& item = items.back();
+      maxInsert = std::max(maxInsert, nanosOf([&] { table.insert(item.key_, &item); }));
+    }
+
+    state.PauseTiming();
+    running = false;
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * (state.range(0) - ReadItems));
+  state.counters["max_insert_us"] = static_cast<double>(maxInsert) * 1e-3;
+  state.counters["max_find_us"] = static_cast<double>(maxFind.load()) * 1e-3;
+  state.counters["finds"] = benchmark::Counter(static_cast<double>(finds.load()), benchmark::Counter::kIsRate);
+}
+
+// no reader, then 1, then one per other hardware thread.
+std::vector<int64_t> readerCounts() {
+  std::vector<int64_t> counts = {0, 1};
+  if (maxThreads() > 2) {
+    counts.push_back(maxThreads() - 1);
+  }
+  return counts;
+}
+
+constexpr int64_t MinItems = 1 << 10;
+constexpr int64_t MaxItems = 1 << 20;
+
+BENCHMARK_TEMPLATE(BM_IntrusiveInsert, Table)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveInsert, PowerOfTwoTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveInsert, FlatTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_UnorderedMapInsert)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_IntrusiveInsertGrowing)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_UnorderedMapInsertGrowing)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFind, Table)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFind, PowerOfTwoTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFind, FlatTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFindBatch, Table)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFindBatch, PowerOfTwoTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_UnorderedMapFind)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_IntrusiveIterate)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_IntrusiveForEach)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFindMiss, Table)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFindMiss, PowerOfTwoTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFindMiss, FlatTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_UnorderedMapFindMiss)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFindString, StringTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_IntrusiveFindString, FlatStringTable)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_UnorderedMapFindString)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_IntrusiveRemove)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK(BM_UnorderedMapErase)->RangeMultiplier(8)->Range(MinItems, MaxItems);
+BENCHMARK_TEMPLATE(BM_SharedFind, ConcurrentTable, ConcurrentItem)
+  ->Setup(&SharedTable<ConcurrentTable, ConcurrentItem>::setUp)
+  ->Teardown(&SharedTable<ConcurrentTable, ConcurrentItem>::tearDown)
+  ->ThreadRange(1, maxThreads())
+  ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedFind, LockedTable, Item)
+  ->Setup(&SharedTable<LockedTable, Item>::setUp)
+  ->Teardown(&SharedTable<LockedTable, Item>::tearDown)
+  ->ThreadRange(1, maxThreads())
+  ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedInsertGrowing, ConcurrentTable, ConcurrentItem)
+  ->ArgsProduct({{MaxItems}, readerCounts()})
+  ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SharedInsertGrowing, LockedTable, Item)
+  ->ArgsProduct({{MaxItems}, readerCounts()})
+  ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,317 @@
+/**
+ * LRUCache throughput and latency benchmarks.
+ *
+ * Every benchmark runs on 1..N threads sharing a single cache, N being the hardware concurrency.
+ * Keys are drawn from pre-generated per-thread sequences so that key generation stays out of the timed loop:
+ *  Uniform: every key of the key space equally likely.
+ *  Zipf: Zipf(0.99) over the key space, a few hot keys and a long tail.
+ *  Scan: each thread sweeps the key space sequentially, the LRU worst case.
+ *
+ * Reported counters besides time per operation:
+ *  hit_ratio: ratio of find() hits, averaged over threads.
+ *  p99_ns: 99th percentile latency of a sampled operation, averaged over threads.
+ *
+ */
+
+#include "../cache.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using LRUC::EvictionPolicy;
+
+constexpr int Capacity = 1 << 16;
+
+// keys drawn from a space 4 times the capacity, so that Uniform hits about a quarter of the time.
+constexpr int KeySpace = Capacity * 4;
+
+// keys pre-generated per thread, cycled through. As long as the key space, so that Scan sweeps all of it.
+constexpr size_t SequenceLength = KeySpace;
+
+// one operation out of SampleInterval is timed for the latency percentile.
+constexpr uint64_t SampleInterval = 32;
+
+enum Distribution : int64_t { Uniform, Zipf, Scan };
+
+const char* const DistributionNames[] = {"uniform", "zipf", "scan"};
+
+int maxThreads() {
+  return static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+// sequence of SequenceLength keys in [1, KeySpace] for the given thread.
+std::vector<int> keySequence(Distribution distribution, int threadIndex) {
+  std::vector<int> keys(SequenceLength);
+  std::mt19937_64 rng(0x9E3779B97F4A7C15ull + static_cast<uint64_t>(threadIndex));
+
+  switch (distribution) {
+    case Uniform: {
+      std::uniform_int_distribution<int> uniform(1, KeySpace);
+      std::generate(keys.begin(), keys.end(), [&] { return uniform(rng); });
+      break;
+    }
+
+    case Zipf: {
+      // inverse transform sampling over the cumulative distribution of ranks.
+      static const std::vector<double> cdf = [] {
+        std::vector<double> c(KeySpace);
+        double sum = 0;
+        for (int rank = 0; rank < KeySpace; ++rank) {
+          sum += 1.0 / std::pow(rank + 1, 0.99);
+          c[rank] = sum;
+        }
+        for (double& p : c) {
+          p /= sum;
+        }
+        return c;
+      }();
+
+      std::uniform_real_distribution<double> uniform(0.0, 1.0);
+      for (int& key : keys) {
+        const auto rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+        key = static_cast<int>(std::min<std::ptrdiff_t>(rank, KeySpace - 1)) + 1;
+      }
+      break;
+    }
+
+    case Scan: {
+      int key = static_cast<int>(rng() % KeySpace);
+      for (int& k : keys) {
+        k = key + 1;
+        key = (key + 1) % KeySpace;
+      }
+      break;
+    }
+  }
+
+  return keys;
+}
+
+/**
+ * Latency samples of the calling thread, reported as the p99_ns counter.
+ *
+ */
+class LatencySampler final {
+ public:
+  LatencySampler() {
+    samples_.reserve(1 << 16);
+  }
+
+  // run op, timing it once every SampleInterval calls.
+  template <typename F>
+  void run(F&& op) {
+    if (++count_ % SampleInterval != 0) {
+      op();
+      return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    op();
+    const auto stop = std::chrono::steady_clock::now();
+    samples_.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+  }
+
+  void report(benchmark::State& state) {
+    if (samples_.empty()) {
+      return;
+    }
+
+    const auto p99 = samples_.begin() + static_cast<std::ptrdiff_t>(samples_.size() * 99 / 100);
+    std::nth_element(samples_.begin(), p99, samples_.end());
+    state.counters["p99_ns"] = benchmark::Counter(static_cast<double>(*p99), benchmark::Counter::kAvgThreads);
+  }
+
+ private:
+  std::vector<int64_t> samples_;
+  uint64_t count_{0};
+};
+
+template <size_t ValueSize>
+using Value = std::array<char, ValueSize>;
+
+template <EvictionPolicy Policy, size_t ValueSize>
+using Cache = LRUC::LRUCache<int, Value<ValueSize>, tbb::tbb_hash_compare<int>, Policy>;
+
+// one cache per benchmark run, shared by its threads.
+template <EvictionPolicy Policy, size_t ValueSize>
+std::unique_ptr<Cache<Policy, ValueSize>>& sharedCache() {
+  static std::unique_ptr<Cache<Policy, ValueSize>> cache;
+  return cache;
+}
+
+// Setup of a run, before its threads start: a new cache holding keys [1, Prefill].
+template <EvictionPolicy Policy, size_t ValueSize, int Prefill>
+void setUp(const benchmark::State&) {
+  auto& cache = sharedCache<Policy, ValueSize>();
+  cache = std::make_unique<Cache<Policy, ValueSize>>(Capacity);
+  for (int key = 1; key <= Prefill; ++key) {
+    cache->insert(key, Value<ValueSize>{});
+  }
+}
+
+template <EvictionPolicy Policy, size_t ValueSize>
+void tearDown(const benchmark::State&) {
+  sharedCache<Policy, ValueSize>().reset();
+}
+
+// registers benchmark fn of a cache prefilled with Prefill keys.
+template <EvictionPolicy Policy, size_t ValueSize, int Prefill = Capacity>
+benchmark::internal::Benchmark* registerCache(const char* name, void (*fn)(benchmark::State&)) {
+  return benchmark::RegisterBenchmark(name, fn)
+    ->Setup(&setUp<Policy, ValueSize, Prefill>)
+    ->Teardown(&tearDown<Policy, ValueSize>)
+    ->ThreadRange(1, maxThreads())
+    ->UseRealTime();
+}
+
+/**
+ * Cache-aside access pattern: find the key, insert it on a miss.
+ * state.range(0) is the key Distribution.
+ *
+ */
+template <EvictionPolicy Policy, size_t ValueSize>
+void BM_CacheAside(benchmark::State& state) {
+  auto& cache = *sharedCache<Policy, ValueSize>();
+
+  const auto distribution = static_cast<Distribution>(state.range(0));
+  const std::vector<int> keys = keySequence(distribution, state.thread_index());
+  const Value<ValueSize> value{};
+  typename Cache<Policy, ValueSize>::ConstAccessor ac;
+  LatencySampler sampler;
+  size_t i = 0;
+  int64_t hits = 0;
+
+  for (auto _ : state) {
+    const int key = keys[i++ & (SequenceLength - 1)];
+    sampler.run([&] {
+      if (cache.find(ac, key)) {
+        ++hits;
+      } else {
+        cache.insert(key, value);
+      }
+    });
+  }
+
+  state.SetLabel(DistributionNames[distribution]);
+  state.SetItemsProcessed(state.iterations());
+  state.counters["hit_ratio"] = benchmark::Counter(
+    static_cast<double>(hits) / static_cast<double>(std::max<int64_t>(state.iterations(), 1)),
+    benchmark::Counter::kAvgThreads);
+  sampler.report(state);
+}
+
+/**
+ * find() only, every key cached.
+ *
+ */
+template <EvictionPolicy Policy, size_t ValueSize>
+void BM_Find(benchmark::State& state) {
+  auto& cache = *sharedCache<Policy, ValueSize>();
+
+  std::vector<int> keys = keySequence(Uniform, state.thread_index());
+  for (int& key : keys) {
+    key = (key - 1) % Capacity + 1;
+  }
+
+  typename Cache<Policy, ValueSize>::ConstAccessor ac;
+  LatencySampler sampler;
+  size_t i = 0;
+
+  for (auto _ : state) {
+    const int key = keys[i++ & (SequenceLength - 1)];
+    sampler.run([&] { benchmark::DoNotOptimize(cache.find(ac, key)); });
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  sampler.report(state);
+}
+
+/**
+ * insert() of absent keys into a full cache, every insert evicts.
+ *
+ */
+template <EvictionPolicy Policy, size_t ValueSize>
+void BM_Insert(benchmark::State& state) {
+  auto& cache = *sharedCache<Policy, ValueSize>();
+
+  const Value<ValueSize> value{};
+  LatencySampler sampler;
+
+  // distinct keys per thread, beyond the prefilled ones.
+  constexpr int MaxKey = 1 << 30;
+  int key = Capacity + 1 + state.thread_index();
+
+  for (auto _ : state) {
+    sampler.run([&] { cache.insert(key, value); });
+    key += state.threads();
+    if (key > MaxKey) {
+      key = Capacity + 1 + state.thread_index();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  sampler.report(state);
+}
+
+/**
+ * erase() then insert() of keys owned by the calling thread, the cache stays within capacity.
+ * Each iteration counts as 2 items.
+ *
+ */
+template <EvictionPolicy Policy, size_t ValueSize>
+void BM_EraseInsert(benchmark::State& state) {
+  auto& cache = *sharedCache<Policy, ValueSize>();
+
+  const Value<ValueSize> value{};
+  LatencySampler sampler;
+  int key = 1 + state.thread_index();
+
+  for (auto _ : state) {
+    sampler.run([&] { benchmark::DoNotOptimize(cache.erase(key)); });
+    cache.insert(key, value);
+    key += state.threads();
+    if (key > Capacity / 2) {
+      key = 1 + state.thread_index();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * 2);
+  sampler.report(state);
+}
+
+// benchmarks are registered at static initialization, after the functions above are defined.
+const bool Registered = [] {
+  using P = EvictionPolicy;
+
+  // recency policies with small values, across key distributions.
+  for (int64_t distribution : {Uniform, Zipf, Scan}) {
+    registerCache<P::LRU, 8>("BM_CacheAside<LRU, 8>", &BM_CacheAside<P::LRU, 8>)->Arg(distribution);
+    registerCache<P::Clock, 8>("BM_CacheAside<Clock, 8>", &BM_CacheAside<P::Clock, 8>)->Arg(distribution);
+    registerCache<P::WTinyLFU, 8>("BM_CacheAside<WTinyLFU, 8>", &BM_CacheAside<P::WTinyLFU, 8>)->Arg(distribution);
+  }
+
+  // value size, copied by find() and insert().
+  registerCache<P::LRU, 256>("BM_CacheAside<LRU, 256>", &BM_CacheAside<P::LRU, 256>)->Arg(Zipf);
+  registerCache<P::LRU, 4096>("BM_CacheAside<LRU, 4096>", &BM_CacheAside<P::LRU, 4096>)->Arg(Zipf);
+
+  registerCache<P::LRU, 8>("BM_Find<LRU, 8>", &BM_Find<P::LRU, 8>);
+  registerCache<P::Clock, 8>("BM_Find<Clock, 8>", &BM_Find<P::Clock, 8>);
+  registerCache<P::LRU, 8>("BM_Insert<LRU, 8>", &BM_Insert<P::LRU, 8>);
+  registerCache<P::WTinyLFU, 8>("BM_Insert<WTinyLFU, 8>", &BM_Insert<P::WTinyLFU, 8>);
+  registerCache<P::LRU, 8, Capacity / 2>("BM_EraseInsert<LRU, 8>", &BM_EraseInsert<P::LRU, 8>);
+  return true;
+}();
+
+}  // namespace
+
+BENCHMARK_MAIN();
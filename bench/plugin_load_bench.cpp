@@ -0,0 +1,207 @@
+/**
+ * Plugin startup benchmarks, run from the directory holding liba.so, libb.so, libno.so and libsingleton.so.
+ *
+ * ColdOpen: dlopen() of one plugin into a fresh process, forked for every iteration so that neither the
+ *  plugin nor its dependencies(libsingleton.so, libtbb) are loaded yet. Timed in the child, reported as
+ *  manual time:
+ *   lazy: loading, RTLD_LAZY relocations and initializers.
+ *   now: the same, every function binding resolved up front too. now - lazy is the binding cost that
+ *    lazy defers to first calls, the work prelink() moves to a background thread.
+ * MainPath: main.cpp's path from a fresh process, its plugins registered with a PluginLoader, timed until
+ *  add() returned(startup_*) or until add(), get() and noop() all returned(main_*):
+ *   eager: every function resolved up front, every plugin dlopen()ed before add() is called.
+ *   lazy: call-time stubs as main.cpp, each plugin opened right before its first function is called.
+ *   prelink: the stubs with prelink() started first, as main.cpp with LRUC_PLUGIN_PRELINK=1.
+ * Symbol: lookup of an already resolved symbol, dlsym() against the Plugin table hit.
+ *
+ */
+
+#include "../plugin_loader.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+
+namespace {
+
+const char* const Plugins[] = {"./liba.so", "./libb.so", "./libno.so"};
+
+// runs fn in a forked child, returns the nanoseconds it reports, -1 if it failed.
+template <typename FN>
+int64_t inChild(FN fn) {
+  int pipefd[2];
+  if (pipe(pipefd) != 0) {
+    return -1;
+  }
+
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(pipefd[0]);
+    // the plugins' output, not the benchmark's.
+    const int devNull = open("/dev/null", O_WRONLY);
+    if (devNull >= 0) {
+      dup2(devNull, STDOUT_FILENO);
+      close(devNull);
+    }
+    const int64_t nanos = fn();
+    const bool written = write(pipefd[1], &nanos, sizeof(nanos)) == sizeof(nanos);
+    // no exit handlers, they would flush the parent's buffered output a second time.
+    _exit(written ? 0 : 1);
+  }
+
+  close(pipefd[1]);
+  int64_t nanos = -1;
+  if (pid < 0 || read(pipefd[0], &nanos, sizeof(nanos)) != sizeof(nanos)) {
+    nanos = -1;
+  }
+  close(pipefd[0]);
+
+  int status = 0;
+  if (pid > 0) {
+    waitpid(pid, &status, 0);
+  }
+  return pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? nanos : -1;
+}
+
+template <typename FN>
+int64_t timed(FN fn) {
+  const auto start = std::chrono::steady_clock::now();
+  if (!fn()) {
+    return -1;
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// every iteration in a fresh child: the benchmark is meaningless if the parent already loaded a plugin.
+bool checkColdParent(benchmark::State& state) {
+  for (const char* path : Plugins) {
+    if (dlopen(path, RTLD_LAZY | RTLD_NOLOAD) != nullptr) {
+      state.SkipWithError("plugin already loaded by the benchmark process, run the Symbol benchmarks apart");
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename FN>
+void runInChildren(benchmark::State& state, FN fn) {
+  if (!checkColdParent(state)) {
+    return;
+  }
+
+  for (auto _ : state) {
+    const int64_t nanos = inChild(fn);
+    if (nanos < 0) {
+      state.SkipWithError("plugin could not be loaded, see the README");
+      break;
+    }
+    state.SetIterationTime(static_cast<double>(nanos) * 1e-9);
+  }
+}
+
+void BM_ColdOpen(benchmark::State& state, const char* path, int flags) {
+  runInChildren(state, [path, flags] { return timed([path, flags] { return dlopen(path, flags) != nullptr; }); });
+}
+
+using AddFunc = void (*)();
+using GetFunc = int (*)();
+using NoopFunc = AddFunc;
+
+enum class Resolution { Eager, Lazy, Prelink };
+
+// main.cpp up to its first call(calls = 1) or through its last one(calls = 3), false if a function is missing.
+bool mainPath(PluginLoader& loader, Resolution resolution, int calls) {
+  loader.add("a", Plugins[0]);
+  loader.add("b", Plugins[1]);
+  loader.add("no", Plugins[2]);
+  if (resolution == Resolution::Prelink) {
+    loader.prelink();
+  }
+
+  if (resolution == Resolution::Eager) {
+    AddFunc add = loader.function<AddFunc>("a", "add");
+    GetFunc get = loader.function<GetFunc>("b", "get");
+    NoopFunc noop = loader.function<NoopFunc>("no", "noop");
+    if (!add || !get || !noop) {
+      return false;
+    }
+    add();
+    if (calls > 1) {
+      benchmark::DoNotOptimize(get());
+      noop();
+    }
+    return true;
+  }
+
+  auto add = loader.lazyFunction<AddFunc>("a", "add");
+  auto get = loader.lazyFunction<GetFunc>("b", "get");
+  auto noop = loader.lazyFunction<NoopFunc>("no", "noop");
+  if (!add) {
+    return false;
+  }
+  add();
+  if (calls > 1) {
+    if (!get || !noop) {
+      return false;
+    }
+    benchmark::DoNotOptimize(get());
+    noop();
+  }
+  return true;
+}
+
+void BM_MainPath(benchmark::State& state, Resolution resolution, int calls) {
+  runInChildren(state, [resolution, calls] {
+    PluginLoader loader;
+    return timed([&loader, resolution, calls] { return mainPath(loader, resolution, calls); });
+  });
+}
+
+void BM_SymbolDlsym(benchmark::State& state) {
+  void* handle = dlopen(Plugins[1], RTLD_LAZY);
+  if (handle == nullptr) {
+    state.SkipWithError("libb.so could not be loaded, see the README");
+    return;
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(dlsym(handle, "get"));
+  }
+}
+
+void BM_SymbolPlugin(benchmark::State& state) {
+  Plugin plugin("b", Plugins[1]);
+  if (plugin.symbol("get") == nullptr) {
+    state.SkipWithError("libb.so could not be loaded, see the README");
+    return;
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(plugin.symbol("get"));
+  }
+}
+
+}  // namespace
+
+// fork()ing benchmarks first, the Symbol ones load libb.so into this process.
+BENCHMARK_CAPTURE(BM_ColdOpen, liba_lazy, Plugins[0], RTLD_LAZY)->UseManualTime();
+BENCHMARK_CAPTURE(BM_ColdOpen, liba_now, Plugins[0], RTLD_NOW)->UseManualTime();
+BENCHMARK_CAPTURE(BM_ColdOpen, libb_lazy, Plugins[1], RTLD_LAZY)->UseManualTime();
+BENCHMARK_CAPTURE(BM_ColdOpen, libb_now, Plugins[1], RTLD_NOW)->UseManualTime();
+BENCHMARK_CAPTURE(BM_ColdOpen, libno_lazy, Plugins[2], RTLD_LAZY)->UseManualTime();
+BENCHMARK_CAPTURE(BM_ColdOpen, libno_now, Plugins[2], RTLD_NOW)->UseManualTime();
+BENCHMARK_CAPTURE(BM_MainPath, startup_eager, Resolution::Eager, 1)->UseManualTime();
+BENCHMARK_CAPTURE(BM_MainPath, startup_lazy, Resolution::Lazy, 1)->UseManualTime();
+BENCHMARK_CAPTURE(BM_MainPath, startup_prelink, Resolution::Prelink, 1)->UseManualTime();
+BENCHMARK_CAPTURE(BM_MainPath, main_eager, Resolution::Eager, 3)->UseManualTime();
+BENCHMARK_CAPTURE(BM_MainPath, main_lazy, Resolution::Lazy, 3)->UseManualTime();
+BENCHMARK_CAPTURE(BM_MainPath, main_prelink, Resolution::Prelink, 3)->UseManualTime();
+BENCHMARK(BM_SymbolDlsym);
+BENCHMARK(BM_SymbolPlugin);
+
+BENCHMARK_MAIN();
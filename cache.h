@@ -4,16 +4,132 @@
 
 #pragma once
 
+#include "frequency_sketch.h"
+#include "snapshot.h"
+
 #include <tbb/concurrent_hash_map.h>
+#include <tbb/tbb_allocator.h>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <new>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace LRUC {
 
+/**
+ * CacheLineSize is the alignment keeping data written by different threads on separate cache lines.
+ *
+ * A fixed value rather than std::hardware_destructive_interference_size: LRUCache objects are shared
+ * across DSOs, the layout must not vary with compiler version or tuning flags.
+ * Override with -DLRUC_CACHELINE_SIZE=<bytes>, consistently for every DSO.
+ *
+ */
+#ifndef LRUC_CACHELINE_SIZE
+#define LRUC_CACHELINE_SIZE 64
+#endif
+
+inline constexpr size_t CacheLineSize = LRUC_CACHELINE_SIZE;
+
+/**
+ * EvictionPolicy selects how LRUCache tracks recency.
+ *
+ * LRU: find() moves the hit key to the most-recently used end of the double-linked list,
+ *  guarded with try-lock on the list mutex. If the lock can't be obtained, the hit is recorded
+ *  into a read buffer and replayed by the next thread holding the list mutex.
+ *
+ * Clock: approximate LRU(CLOCK / second-chance). find() only sets the key's reference bit with a
+ *  relaxed atomic store and never touches the list mutex. The double-linked list serves as the
+ *  CLOCK ring with head_ as the hand: eviction sweeps from the hand, clears the reference bit of
+ *  referenced keys and moves them behind the hand, evicting the first unreferenced key.
+ *
+ * WTinyLFU: scan-resistant W-TinyLFU. New keys enter a small window LRU(1% of the capacity), keys
+ *  leaving the window are only admitted into the main space if a count-min sketch of recent accesses
+ *  estimates them more frequent than the main space's eviction candidate, otherwise they are evicted.
+ *  The main space is a segmented LRU(probation, protected). find() behaves as with LRU.
+ *
+ */
+enum class EvictionPolicy { LRU, Clock, WTinyLFU };
+
+/**
+ * UnitWeigher weighs every entry as 1, LRUCache weight() then equals size().
+ *
+ * A weigher is a function object returning the cost of an entry as size_t, e.g. its memory footprint
+ * in bytes, called as weigher(key, value) whenever the value is inserted or assigned.
+ *
+ */
+struct UnitWeigher final {
+  template <typename TKey, typename TValue>
+  constexpr size_t operator()(const TKey&, const TValue&) const noexcept {
+    return 1;
+  }
+};
+
+/**
+ * CacheStats is a snapshot of the counters of a cache instantiated WithStats, see LRUCache::stats().
+ *
+ * Counters are cumulative since construction. A snapshot taken under concurrent operations is not
+ * atomic across counters, compare two snapshots for rates.
+ *
+ */
+struct CacheStats final {
+  // find() and find_many() keys found, get_or_load() keys found or loaded by another caller.
+  uint64_t hits_{0};
+
+  // find() and find_many() keys absent or expired, including get_or_load() misses.
+  uint64_t misses_{0};
+
+  // get_or_load() values loaded by the calling thread.
+  uint64_t loads_{0};
+
+  // values evicted to fit in capacity or max weight.
+  uint64_t evictions_{0};
+
+  // expired values reclaimed.
+  uint64_t expirations_{0};
+
+  // hits whose list update was deferred to the read buffer as the list lock was busy.
+  uint64_t deferredHits_{0};
+
+  // hits whose list update was dropped as the read buffer was full.
+  uint64_t droppedHits_{0};
+
+  // list lock acquisitions which had to wait for another thread.
+  uint64_t lockContentions_{0};
+
+  // ratio of hits among lookups, 0 without lookup.
+  double hitRatio() const {
+    const uint64_t lookups = hits_ + misses_;
+    return lookups == 0 ? 0.0 : static_cast<double>(hits_) / static_cast<double>(lookups);
+  }
+
+  CacheStats& operator+=(const CacheStats& other) {
+    hits_ += other.hits_;
+    misses_ += other.misses_;
+    loads_ += other.loads_;
+    evictions_ += other.evictions_;
+    expirations_ += other.expirations_;
+    deferredHits_ += other.deferredHits_;
+    droppedHits_ += other.droppedHits_;
+    lockContentions_ += other.lockContentions_;
+    return *this;
+  }
+};
+
 /**
  * LRUCache is a thread-safe Least Recently Used cache with defined size.
  *
@@ -22,23 +138,40 @@ namespace LRUC {
  * the cache.
  *
  * find() takes LRUCache::ConstAccessor as argument which stores the found value inside the
- * cache with specified key.
+ * cache with specified key, or LRUCache::PinnedAccessor which refers to the value in place.
  *
- * insert() takes key and value to insert into the cache.
+ * insert() takes key and value to insert into the cache, emplace() constructs the value in place,
+ * insert_or_assign() also updates the value of an existing key.
  *
  * erase() takes key to remove the entry from the cache.
  *
+ * insert() and insert_or_assign() optionally take a time to live, see Duration. Expired entries are
+ * never found and are reclaimed through a timing wheel swept by inserts and expire().
+ *
  * clear() clear the cache. Not thread safe.
  *
  * size() returns the current cache size.
  *
- * capacity() returns the defined capacity.
+ * capacity() returns the defined capacity, setCapacity() changes it at run-time.
+ *
+ * weight() returns the total weight of the cached entries as measured by TWeigher, insert() also evicts
+ * until weight() fits in maxWeight(). An entry heavier than maxWeight() on its own is evicted right away
+ * rather than flushing the whole cache.
  *
  * Internal double-linked list is guarded with mutex for modifying the list.
  *
+ * Policy selects the recency tracking, see EvictionPolicy.
+ *
+ * WithStats enables the counters behind stats(). Off by default, the counting is then compiled out.
+ *
+ * TAllocator backs the per-entry memory, see allocator_type. Defaults to tbb::tbb_allocator as the hash-table did.
+ *
  * Type concepts:
  * TKey type requires TBB::HashCompare concept.
- * TValue type requires CopyInsertable concept.
+ * TValue type requires CopyInsertable(MoveInsertable for rvalue inserts) and DefaultConstructible concept.
+ * insert_or_assign additionally requires TValue to be assignable from the given value.
+ * TWeigher type requires DefaultConstructible concept, see UnitWeigher.
+ * TAllocator type requires Allocator concept, rebindable to any type.
  *
  * Good performance depends on having good pseudo-randomness in the low-order bits of the hash code.
  * When keys are pointers, simply casting the pointer to a hash code may cause poor performance because the low-order
@@ -48,6 +181,7 @@ namespace LRUC {
  * Exception Safety:
  * The following functions must not throw exceptions:
  *  The hash function
+ *  The weigher
  *  The destructors for types TKey and TValue.
  *
  * The following holds true:
@@ -62,15 +196,27 @@ namespace LRUC {
  *
  */
 
-template <typename TKey, typename TValue, typename THash = tbb::tbb_hash_compare<TKey>>
+template <typename TKey,
+          typename TValue,
+          typename THash = tbb::tbb_hash_compare<TKey>,
+          EvictionPolicy Policy = EvictionPolicy::LRU,
+          typename TWeigher = UnitWeigher,
+          bool WithStats = false,
+          typename TAllocator = tbb::tbb_allocator<TValue>>
 class LRUCache final {
  private:
+  // save() and load() of the shards.
+  template <typename, typename, typename, size_t, EvictionPolicy, typename, bool, typename>
+  friend class ShardedLRUCache;
+
   // forward declaration
   struct Value;
   struct ListNode;
 
   // type defs
-  using HashMap = tbb::concurrent_hash_map<TKey, Value, THash>;
+  using AllocatorTraits = std::allocator_traits<TAllocator>;
+  using HashMapAllocator = typename AllocatorTraits::template rebind_alloc<std::pair<const TKey, Value>>;
+  using HashMap = tbb::concurrent_hash_map<TKey, Value, THash, HashMapAllocator>;
   using HashMapConstAccessor = typename HashMap::const_accessor;
   using HashMapAccessor = typename HashMap::accessor;
   using HashMapValuePair = typename HashMap::value_type;
@@ -78,390 +224,2755 @@ class LRUCache final {
 
  private:
   // static data members
+  // entries weigh 1 and never change weight, weight bookkeeping is compiled out.
+  static constexpr bool IsUnitWeigher = std::is_same_v<TWeigher, UnitWeigher>;
+
   // used for judging a node exist inside the double-linked list.
   static ListNode* const NullNodePtr;
 
  private:
+  // EvictionPolicy::WTinyLFU segment of a node, see TinyLfu.
+  enum Segment : uint8_t { Window, Probation, Protected };
+
   /**
    * ListNode is the element type forms the internal double-linked list,
    * which serves as the LRU cache eviction manipulator.
    *
+   * ListNodes are owned by the cache's NodePool, not by the hash-table. key_ refers back to the
+   * hash-table key, which outlives the node's membership in the list: a hash-table entry is only
+   * erased by the thread that unlinked its node.
+   *
    */
   struct ListNode final {
     ListNode* prev_;
     ListNode* next_;
-    TKey key_;
+    const TKey* key_;
+
+    // weight accounted for the entry in current_weight_, listMutex should be held.
+    size_t weight_{1};
 
-    constexpr ListNode() : prev_(NullNodePtr), next_(nullptr) {}
+    // CLOCK reference bit, set by find() without holding the list mutex.
+    std::atomic<bool> referenced_{false};
 
-    // explicit to avoid unintended conversions with UDT.
-    // https://isocpp.github.io/CppCoreGuidelines/CppCoreGuidelines#Rc-explicit
-    explicit constexpr ListNode(const TKey& key) : prev_(NullNodePtr), next_(nullptr), key_(key) {}
+    // TimerWheel slot membership, timerPrevNext_ is nullptr if the node is not scheduled.
+    ListNode* timerNext_{nullptr};
+    ListNode** timerPrevNext_{nullptr};
+    uint64_t expiry_{0};  // tick
+
+    // EvictionPolicy::WTinyLFU only, hash code of key_ for the frequency sketch.
+    size_t hash_{0};
+    Segment segment_{Window};
+
+    constexpr ListNode() : prev_(NullNodePtr), next_(nullptr), key_(nullptr) {}
 
     // false if node is not in cache's double-linked list.
     constexpr bool inList() const {
       return prev_ != NullNodePtr;
     }
+
+    // true if node is in the list on behalf of the hash-table entry holding key.
+    // A released node can be re-acquired by another entry while a stale pointer to it is still around.
+    constexpr bool linkedTo(const TKey* key) const {
+      return inList() && key_ == key;
+    }
   };
 
   /**
-   * Value is the value stored in the hash-table.
-   * listNode_ as back-reference to node to the double-linked list,
-   * which contains hash-table key.
+   * NodePool hands out ListNodes from slabs owned by the cache.
+   *
+   * Nodes are recycled through a free-list and their memory is only returned when the cache is
+   * destroyed(type-stable memory), thus a stale ListNode pointer is always safe to inspect under
+   * the list mutex, no reference counting or deferred reclamation is required.
+   * Steady-state inserts and evictions do no heap allocation for list nodes.
+   * Slabs come from the cache's TAllocator.
+   *
+   * Not thread-safe except retire(). listMutex_ should be held.
    *
    */
-  struct Value final {
-    std::shared_ptr<ListNode> listNode_;
-    TValue value_;
+  struct NodePool final {
+    static constexpr size_t SlabSize = 256;
 
-    Value() = default;
-    Value(const TValue& value, std::shared_ptr<ListNode> node) : listNode_(node), value_(value) {}
-  };
+    using Allocator = typename AllocatorTraits::template rebind_alloc<ListNode>;
+    using Traits = std::allocator_traits<Allocator>;
 
- private:
-  // data members
-  // consider padding and false sharing
-  ListMutex listMutex_;
+    explicit NodePool(const TAllocator& allocator) : allocator_(allocator) {}
 
-  /**
-   * head_ is the least-recently used node.
-   * tail_ is the most-recently used node.
-   * listMutex should be held during list modification.
-   *
-   */
-  ListNode head_;
-  ListNode tail_;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
 
-  /**
-   * oneTBB concurrent_hash_map
-   *
-   */
-  HashMap hash_map_;
+    ~NodePool() {
+      for (ListNode* slab : slabs_) {
+        for (size_t i = 0; i < SlabSize; ++i) {
+          Traits::destroy(allocator_, slab + i);
+        }
+        Traits::deallocate(allocator_, slab, SlabSize);
+      }
+    }
 
-  /**
-   * cache size.
-   *
-   */
-  std::atomic<int> current_size_;
+    Allocator allocator_;
+    std::vector<ListNode*> slabs_;
+    ListNode* free_{nullptr};
 
-  /**
-   * cache capacity
-   *
-   */
-  const int capacity_;
+    // nodes given back without the list mutex, moved to free_ by acquire().
+    // Lock-free stack, ABA-free as the only pop is a whole-stack exchange.
+    std::atomic<ListNode*> retired_{nullptr};
 
- private:
-  /**
-   * Append a node to the double-linked list as the most-recently used.
-   * Not thread-safe. Caller is responsible for a lock.
-   *
-   */
-  void append(ListNode* node);
+    ListNode* acquire() {
+      if (free_ == nullptr) {
+        free_ = retired_.exchange(nullptr, std::memory_order_acquire);
+      }
 
-  /**
-   * Unlink a node from the list.
-   * Not thread-safe. Caller is responsible for a lock.
-   *
-   */
-  void unlink(ListNode* node);
+      if (free_ == nullptr) {
+        grow();
+      }
 
-  /**
-   * Remove the least-recently used value from the LRUCache.
-   * Thread-safe.
-   *
-   */
-  void popFront();
+      ListNode* node = free_;
+      free_ = node->next_;
+      node->next_ = nullptr;
+      return node;
+    }
+
+    void release(ListNode* node) {
+      // key_ is kept as is, it only tells identity along with inList().
+      node->referenced_.store(false, std::memory_order_relaxed);
+      node->next_ = free_;
+      free_ = node;
+    }
+
+    // Give back an unlinked node exclusively owned by the caller.
+    // Thread-safe.
+    void retire(ListNode* node) {
+      node->referenced_.store(false, std::memory_order_relaxed);
+      ListNode* head = retired_.load(std::memory_order_relaxed);
+      do {
+        node->next_ = head;
+      } while (!retired_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+   private:
+    void grow() {
+      slabs_.reserve(slabs_.size() + 1);
+      ListNode* slab = Traits::allocate(allocator_, SlabSize);
+      slabs_.push_back(slab);
+
+      // ListNode construction does not throw.
+      for (size_t i = 0; i < SlabSize; ++i) {
+        Traits::construct(allocator_, slab + i);
+        slab[i].next_ = free_;
+        free_ = &slab[i];
+      }
+    }
+  };
 
- public:
   /**
-   * ConstAccessor is a helper type wraped over tbb::concurrent_hash_map::const_accessor with
-   * operator overloaded to retrieve value stored in the hash-table based on key.
+   * ReadBuffer records hits of which find() could not obtain the list mutex, replayed in batches by
+   * whichever thread holds the list mutex next(drain()).
+   *
+   * The buffer is striped by thread, each stripe being a bounded multi-producer single-consumer ring.
+   * Recording never blocks: when the thread's stripe is full or contended the hit is dropped, as
+   * recency is approximate anyway.
+   *
+   * Buffered nodes are not owned, by the time they are replayed they may have been unlinked or
+   * recycled: unlinked nodes are skipped, a recycled node promotes the entry it got linked to,
+   * which only affects recency.
    *
    */
-  struct ConstAccessor final {
-    constexpr ConstAccessor() = default;
-    constexpr ConstAccessor(const ConstAccessor&) = delete;
+  struct ReadBuffer final {
+    struct alignas(CacheLineSize) Stripe final {
+      static constexpr uint32_t Size = 16;  // power of two
+      static constexpr uint32_t Mask = Size - 1;
+
+      // read position, only written by the consumer under the list mutex.
+      std::atomic<uint32_t> head_{0};
+      // write position, reserved by producers.
+      std::atomic<uint32_t> tail_{0};
+      std::atomic<ListNode*> slots_[Size] = {};
+    };
+
+    std::unique_ptr<Stripe[]> stripes_;
+    size_t mask_{0};
+
+    explicit ReadBuffer(size_t stripeCount) {
+      size_t count = 1;
+      while (count < stripeCount) {
+        count <<= 1;
+      }
 
-    constexpr const TValue& operator*() const {
-      return *get();
+      stripes_.reset(new Stripe[count]);
+      mask_ = count - 1;
     }
 
-    constexpr const TValue* operator->() const {
-      return get();
-    }
+    /**
+     * Record node into the calling thread's stripe.
+     * Return false if the hit is dropped.
+     * Thread-safe, wait-free.
+     *
+     */
+    bool record(ListNode* node) {
+      Stripe& stripe = stripes_[threadIndex() & mask_];
+      uint32_t tail = stripe.tail_.load(std::memory_order_relaxed);
 
-    constexpr bool empty() const {
-      return constAccessor_.empty();
-    }
+      if (tail - stripe.head_.load(std::memory_order_acquire) >= Stripe::Size) {
+        return false;
+      }
 
-    constexpr const TValue* get() const {
-      return &value_;
+      if (!stripe.tail_.compare_exchange_strong(tail, tail + 1, std::memory_order_relaxed)) {
+        return false;
+      }
+
+      stripe.slots_[tail & Stripe::Mask].store(node, std::memory_order_release);
+      return true;
     }
 
-    constexpr void release() {
-      constAccessor_.release();
+    /**
+     * Consume all recorded nodes, calling fn on each.
+     * Not thread-safe. Caller is responsible for the list lock.
+     *
+     */
+    template <typename F>
+    void drain(F&& fn) {
+      for (size_t i = 0; i <= mask_; ++i) {
+        Stripe& stripe = stripes_[i];
+        uint32_t head = stripe.head_.load(std::memory_order_relaxed);
+        const uint32_t tail = stripe.tail_.load(std::memory_order_acquire);
+
+        for (; head != tail; ++head) {
+          std::atomic<ListNode*>& slot = stripe.slots_[head & Stripe::Mask];
+          ListNode* node = slot.load(std::memory_order_acquire);
+
+          // reserved but not yet published, picked up by a later drain.
+          if (node == nullptr) {
+            break;
+          }
+
+          slot.store(nullptr, std::memory_order_relaxed);
+          fn(node);
+        }
+
+        stripe.head_.store(head, std::memory_order_release);
+      }
     }
 
-   private:
     /**
-     * copy TValue from concurrent_hash_map thus caller could release read lock early.
+     * Sequential index of the calling thread, spreads threads over stripes.
      *
      */
-    void setValue() {
-      value_ = constAccessor_->second.value_;
+    static size_t threadIndex() {
+      static std::atomic<size_t> nextIndex{0};
+      static thread_local const size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+      return index;
     }
+  };
 
-   private:
-    friend class LRUCache;  // for LRUCache member function to access tbb::concurrent_hash_map::const_accessor
-    HashMapConstAccessor constAccessor_;
-    TValue value_;
+  // CacheStats counter, index into StatsCounters::Stripe::counts_.
+  enum Counter : uint8_t {
+    Hits,
+    Misses,
+    Loads,
+    Evictions,
+    Expirations,
+    DeferredHits,
+    DroppedHits,
+    LockContentions,
+    CounterCount
   };
 
   /**
-   * size: initial size for the cache.
-   * The size should be tunable at run-time TODO(shchang)
+   * StatsCounters are the WithStats counters, striped like ReadBuffer: each thread increments the counters
+   * of its own cache line, stats() sums all stripes.
    *
-   * bucketCount: used for initial setup the tbb:concurrent_hash_map, the bucket size
-   * will grow depends on internal oneTBB algorithm.
    */
-  explicit LRUCache(int size, size_t bucketCount = std::thread::hardware_concurrency() * 8);
+  struct StatsCounters final {
+    struct alignas(CacheLineSize) Stripe final {
+      std::atomic<uint64_t> counts_[CounterCount] = {};
+    };
+
+    std::unique_ptr<Stripe[]> stripes_;
+    size_t mask_{0};
+
+    explicit StatsCounters(size_t stripeCount) {
+      size_t count = 1;
+      while (count < stripeCount) {
+        count <<= 1;
+      }
 
-  ~LRUCache() noexcept {
-    clear();
-  }
+      stripes_.reset(new Stripe[count]);
+      mask_ = count - 1;
+    }
 
-  LRUCache(const LRUCache& other) = delete;
-  LRUCache& operator=(const LRUCache&) = delete;
+    // Thread-safe, wait-free.
+    void add(Counter counter, uint64_t n) {
+      stripes_[ReadBuffer::threadIndex() & mask_].counts_[counter].fetch_add(n, std::memory_order_relaxed);
+    }
 
-  /**
-   * erase removes key from LRUCache along with its value.
-   * returns number of elements removed (0 or 1).
-   *
-   */
-  size_t erase(const TKey& key);
+    uint64_t sum(Counter counter) const {
+      uint64_t sum = 0;
+      for (size_t i = 0; i <= mask_; ++i) {
+        sum += stripes_[i].counts_[counter].load(std::memory_order_relaxed);
+      }
 
-  /**
-   * find finds data inside hash-table through provided key.
-   * ConstAccessor stores a copy of the found result.
-   * Return true if key exist, otherwise false.
-   *
-   * find updates key access frequency.
-   *
-   */
-  bool find(ConstAccessor& ac, const TKey& key);
+      return sum;
+    }
+  };
 
   /**
-   * insert key/value into cache. Both key and value is copied into the cache.
-   * insert updates key access frequency.
+   * TimerWheel schedules the nodes of expiring entries, hierarchical timing wheel of LevelCount levels
+   * of SlotCount slots, each level spanning SlotCount times the level below.
    *
-   * If key already exists in the cache, the value will not be updated and return
-   * false. Otherwise return true.
+   * schedule() and cancel() are O(1), nodes are linked into their slot through intrusive pointers.
+   * advance() only visits the occupied slots of the elapsed ticks: nodes of higher levels are cascaded
+   * down as their slot comes due, empty slots of every level are skipped through per level occupancy
+   * bitmaps. Thus catching up after an idle gap costs O(LevelCount) per occupied slot, not per window.
    *
-   */
-  bool insert(const TKey& key, const TValue& value);
-
-  /**
-   * clear erases all elements from the container.
-   * After this call, size() returns zero.
-   * Not thread-safe.
+   * Not thread-safe. listMutex_ should be held.
    *
    */
-  void clear() noexcept;
+  struct TimerWheel final {
+    static constexpr int SlotBits = 6;
+    static constexpr uint64_t SlotCount = uint64_t{1} << SlotBits;
+    static constexpr uint64_t SlotMask = SlotCount - 1;
+    // 2^30 ticks, ~13 days with the cache's 2^20 ns ticks. Farther expiries are rescheduled on cascade.
+    static constexpr int LevelCount = 5;
+    static constexpr int TopShift = SlotBits * (LevelCount - 1);
 
-  /**
-   * size returns the current cache size.
-   *
-   */
-  int size() const {
-    return current_size_.load();
-  }
+    ListNode* slots_[LevelCount][SlotCount] = {};
+    uint64_t occupied_[LevelCount] = {};
 
-  /**
-   * capacity returns the cache capacity.
-   *
-   */
-  constexpr int capacity() const {
-    return capacity_;
-  }
-};
+    // first tick not processed yet.
+    uint64_t now_{0};
 
-template <class TKey, class TValue, class THash>
-typename LRUCache<TKey, TValue, THash>::ListNode* const LRUCache<TKey, TValue, THash>::NullNodePtr =
-  reinterpret_cast<ListNode*>(-1);
+    // number of scheduled nodes, atomic for peeking without the list mutex.
+    std::atomic<size_t> count_{0};
 
-// ---- private member functions ----
-template <class TKey, class TValue, class THash>
-void LRUCache<TKey, TValue, THash>::unlink(ListNode* node) {
-  ListNode* prev = node->prev_;
-  ListNode* next = node->next_;
-  prev->next_ = next;
-  next->prev_ = prev;
+    /**
+     * Schedule node to expire at tick, now being the current tick.
+     *
+     */
+    void schedule(ListNode* node, uint64_t tick, uint64_t now) {
+      if (count_.load(std::memory_order_relaxed) == 0) {
+        // nothing to process in between, skip the elapsed ticks.
+        now_ = std::max(now_, now);
+      }
 
-  // assign to NullNodePtr as indicator that this node is no longer in the double-linked list.
-  node->prev_ = NullNodePtr;
-}
+      node->expiry_ = tick;
+      insert(node);
+      count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
 
-template <class TKey, class TValue, class THash>
-void LRUCache<TKey, TValue, THash>::append(ListNode* node) {
-  ListNode* prevLatestNode = tail_.prev_;
+    /**
+     * Unschedule node, no-op if it is not scheduled.
+     *
+     */
+    void cancel(ListNode* node) {
+      if (node->timerPrevNext_ == nullptr) {
+        return;
+      }
 
-  node->next_ = &tail_;
-  node->prev_ = prevLatestNode;
+      remove(node);
+      count_.store(count_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
 
-  tail_.prev_ = node;
-  prevLatestNode->next_ = node;
-}
+    /**
+     * Process ticks up to tick, calling fn on each unscheduled node which expired by then.
+     * Stop after maxCount nodes, the remaining ones are picked up by the next call.
+     * Return number of nodes expired.
+     *
+     */
+    template <typename F>
+    size_t advance(uint64_t tick, size_t maxCount, F&& fn) {
+      size_t expired = 0;
+
+      while (now_ <= tick) {
+        if (count_.load(std::memory_order_relaxed) == 0) {
+          now_ = tick + 1;
+          break;
+        }
+
+        const uint64_t slot = now_ & SlotMask;
+        if (slot == 0) {
+          cascade();
+        }
+
+        while (ListNode* node = slots_[0][slot]) {
+          if (expired == maxCount) {
+            return expired;
+          }
+
+          remove(node);
+          if (node->expiry_ <= tick) {
+            count_.store(count_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            fn(node);
+            ++expired;
+          } else {
+            // placed past the top level span, goes to a later slot.
+            insert(node);
+          }
+        }
+
+        // skip to the next occupied slot of this window, or to the next window with a slot to cascade.
+        const uint64_t ahead = occupied_[0] & (~uint64_t{0} << slot);
+        const uint64_t next = ahead != 0 ? (now_ & ~SlotMask) + static_cast<uint64_t>(__builtin_ctzll(ahead))
+                                         : dueWindow();
+        now_ = std::min(next, tick + 1);
+      }
 
-template <class TKey, class TValue, class THash>
-void LRUCache<TKey, TValue, THash>::popFront() {
-  ListNode* candidate{nullptr};
+      return expired;
+    }
 
-  {
-    std::unique_lock<ListMutex> lock(listMutex_);
-    candidate = head_.next_;
+   private:
+    /**
+     * First tick past the current window at which cascade() moves nodes down: the start of the next
+     * occupied slot of the lowest level having one ahead of now_.
+     * Nodes of a level below the top are all ahead of now_ within the span of the level above, top level
+     * slots behind now_'s come due in the next round of the top level.
+     *
+     */
+    uint64_t dueWindow() const {
+      for (int level = 1; level < LevelCount; ++level) {
+        const int shift = SlotBits * level;
+        const uint64_t slot = (now_ >> shift) & SlotMask;
+        const uint64_t ahead = slot == SlotMask ? 0 : occupied_[level] & (~uint64_t{0} << (slot + 1));
+        if (ahead != 0) {
+          const uint64_t span = (now_ >> (shift + SlotBits)) << (shift + SlotBits);
+          return span + (static_cast<uint64_t>(__builtin_ctzll(ahead)) << shift);
+        }
+      }
 
-    if (candidate == &tail_) {
-      return;
+      if (occupied_[LevelCount - 1] != 0) {
+        const uint64_t round = ((now_ >> (TopShift + SlotBits)) + 1) << (TopShift + SlotBits);
+        return round + (static_cast<uint64_t>(__builtin_ctzll(occupied_[LevelCount - 1])) << TopShift);
+      }
+
+      return (now_ & ~SlotMask) + SlotCount;
     }
 
-    unlink(candidate);
-  }
+    // Move the nodes of the higher level slots coming due at now_ to lower levels.
+    void cascade() {
+      for (int level = 1; level < LevelCount; ++level) {
+        const uint64_t slot = (now_ >> (SlotBits * level)) & SlotMask;
 
-  HashMapConstAccessor accessor;
-  if (!hash_map_.find(accessor, candidate->key_)) {
-    return;
-  }
+        ListNode* node = slots_[level][slot];
+        slots_[level][slot] = nullptr;
+        occupied_[level] &= ~(uint64_t{1} << slot);
 
-  // erase issues lock, do not call this API inside linked-list lock.
-  // https://github.com/jckarter/tbb/blob/0343100743d23f707a9001bc331988a31778c9f4/include/tbb/concurrent_hash_map.h#L1093
-  hash_map_.erase(accessor);
-}
+        while (node != nullptr) {
+          ListNode* next = node->timerNext_;
+          insert(node);
+          node = next;
+        }
 
-// ---- private member functions end ----
+        if (slot != 0) {
+          break;
+        }
+      }
+    }
 
-template <class TKey, class TValue, class THash>
-LRUCache<TKey, TValue, THash>::LRUCache(int size, size_t bucketCount)
-  : hash_map_(bucketCount), current_size_(0), capacity_(size) {
-  head_.prev_ = nullptr;
-  head_.next_ = &tail_;
-  tail_.prev_ = &head_;
-}
+    void insert(ListNode* node) {
+      // overdue nodes go to the slot processed next.
+      uint64_t tick = std::max(node->expiry_, now_);
 
-template <class TKey, class TValue, class THash>
-size_t LRUCache<TKey, TValue, THash>::erase(const TKey& key) {
-  std::shared_ptr<ListNode> found_node;
-  bool marked = false;
+      // the lowest level of which the slot span covers both now_ and tick.
+      int level = 0;
+      while (level < LevelCount - 1 && (tick >> (SlotBits * (level + 1))) != (now_ >> (SlotBits * (level + 1)))) {
+        ++level;
+      }
 
-  // fine-grained read lock for hash_map
-  {
-    HashMapConstAccessor accessor;
-    if (!hash_map_.find(accessor, key)) {
-      return 0;
+      if (level == LevelCount - 1 && (tick >> TopShift) - (now_ >> TopShift) > SlotMask) {
+        tick = now_ + (SlotMask << TopShift);
+      }
+
+      const uint64_t slot = (tick >> (SlotBits * level)) & SlotMask;
+      ListNode*& head = slots_[level][slot];
+
+      node->timerNext_ = head;
+      if (head != nullptr) {
+        head->timerPrevNext_ = &node->timerNext_;
+      }
+      node->timerPrevNext_ = &head;
+      head = node;
+      occupied_[level] |= uint64_t{1} << slot;
+    }
+
+    void remove(ListNode* node) {
+      ListNode** prevNext = node->timerPrevNext_;
+      *prevNext = node->timerNext_;
+      if (node->timerNext_ != nullptr) {
+        node->timerNext_->timerPrevNext_ = prevNext;
+      }
+
+      node->timerNext_ = nullptr;
+      node->timerPrevNext_ = nullptr;
+
+      // prevNext is a slot head if it points into slots_.
+      ListNode** const first = &slots_[0][0];
+      if (*prevNext == nullptr && std::greater_equal<ListNode**>()(prevNext, first) &&
+          std::less<ListNode**>()(prevNext, first + LevelCount * SlotCount)) {
+        const size_t index = static_cast<size_t>(prevNext - first);
+        occupied_[index / SlotCount] &= ~(uint64_t{1} << (index % SlotCount));
+      }
+    }
+  };
+
+  /**
+   * NodeList is a double-linked list of ListNodes between two sentinels.
+   * listMutex should be held.
+   *
+   */
+  struct NodeList final {
+    ListNode head_;
+    ListNode tail_;
+    int size_{0};
+
+    NodeList() {
+      head_.prev_ = nullptr;
+      head_.next_ = &tail_;
+      tail_.prev_ = &head_;
+    }
+
+    // least-recently used node, nullptr if empty.
+    ListNode* front() const {
+      return head_.next_ == &tail_ ? nullptr : head_.next_;
+    }
+  };
+
+  /**
+   * TinyLfu is the EvictionPolicy::WTinyLFU state along with the window, which is the cache's own
+   * double-linked list.
+   *
+   * New keys are appended to the window, sized WindowPercent of the capacity. A key leaving the window
+   * is the candidate for admission into the main space, competing with the main space's least-recently
+   * used key: whichever of both the frequency sketch estimates as less frequently accessed is evicted.
+   * Thus a scan of keys used once can't flush the frequently used ones.
+   *
+   * The main space is a segmented LRU: admitted keys enter probation and are promoted to protected on
+   * their next hit, protected overflow is demoted back to probation. While the cache has room, keys
+   * leave the window for probation without competing.
+   *
+   * Segments are sized by entry count, weights only take part through eviction.
+   * listMutex should be held.
+   *
+   */
+  struct TinyLfu final {
+    static constexpr int WindowPercent = 1;
+    // share of the main space.
+    static constexpr int ProtectedPercent = 80;
+
+    NodeList probation_;
+    NodeList protected_;
+    int windowSize_{0};
+    FrequencySketch sketch_;
+
+    explicit TinyLfu(int capacity) : sketch_(static_cast<size_t>(std::max(capacity, 0))) {}
+
+    int& sizeOf(Segment segment) {
+      return segment == Window ? windowSize_ : (segment == Probation ? probation_.size_ : protected_.size_);
+    }
+  };
+
+  /**
+   * Value is the value stored in the hash-table.
+   * listNode_ as back-reference to node to the double-linked list,
+   * which refers back to the hash-table key.
+   *
+   * listNode_ is nullptr until the entry is appended to the list, which happens after the
+   * hash-table write lock is released.
+   *
+   * weight_ is the weight of value_, expiresAt_ the time value_ expires at(steady clock nanoseconds,
+   * 0 if never). Both are written under the hash-table write lock and accounted under the list lock
+   * when the entry is linked or updated.
+   *
+   */
+  struct Value final {
+    std::atomic<ListNode*> listNode_{nullptr};
+    std::atomic<size_t> weight_{1};
+    std::atomic<int64_t> expiresAt_{0};
+
+    // a refresh-ahead reload is pending, set by hits on a const entry.
+    mutable std::atomic<bool> refreshing_{false};
+
+    TValue value_;
+
+    Value() = default;
+
+    // constructs TValue in place from args.
+    template <typename... Args>
+    explicit Value(std::in_place_t, Args&&... args) : value_(std::forward<Args>(args)...) {}
+  };
+
+  /**
+   * Footprint is the size and weight of the keys in the list, accumulated under the list lock while
+   * linking and evicting, then stored into current_size_ and current_weight_ by evictOverflow() once
+   * it fits, so that size() and weight() never observe an intermediate overflow.
+   *
+   */
+  struct Footprint final {
+    int size_;
+    size_t weight_;
+  };
+
+  /**
+   * RefreshAhead is the refresh-ahead configuration along with the bounded pool of threads running the
+   * reloads, see setRefreshAhead().
+   *
+   * Hits only queue the key, loader runs on the pool threads. Dedicated threads rather than TBB workers:
+   * loaders usually block on I/O, which would starve the TBB pool, and TBB may have no worker at all.
+   * Destruction waits for pending reloads.
+   *
+   */
+  struct RefreshAhead final {
+    RefreshAhead(LRUCache& cache,
+                 int64_t window,
+                 std::chrono::steady_clock::duration ttl,
+                 std::function<TValue(const TKey&)> loader,
+                 int maxConcurrency)
+      : window_(window), ttl_(ttl), loader_(std::move(loader)) {
+      for (int i = 0; i < std::max(maxConcurrency, 1); ++i) {
+        threads_.emplace_back([this, &cache] { run(cache); });
+      }
+    }
+
+    ~RefreshAhead() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+
+      wakeup_.notify_all();
+      for (std::thread& thread : threads_) {
+        thread.join();
+      }
+    }
+
+    // queue a reload of key.
+    void submit(const TKey& key) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(key);
+      }
+
+      wakeup_.notify_one();
+    }
+
+    // wait until no reload is queued or running.
+    void wait() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      idle_.wait(lock, [this] { return queue_.empty() && running_ == 0; });
+    }
+
+    // reload queued keys until stopped, the queue is drained first.
+    void run(LRUCache& cache) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      for (;;) {
+        wakeup_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+
+        TKey key = std::move(queue_.front());
+        queue_.pop_front();
+        ++running_;
+
+        lock.unlock();
+        cache.refreshEntry(*this, key);
+        lock.lock();
+
+        if (--running_ == 0 && queue_.empty()) {
+          idle_.notify_all();
+        }
+      }
+    }
+
+    // nanoseconds before expiry from which a hit schedules a reload.
+    const int64_t window_;
+    const std::chrono::steady_clock::duration ttl_;
+    const std::function<TValue(const TKey&)> loader_;
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::condition_variable idle_;
+    std::deque<TKey> queue_;
+    int running_{0};
+    bool stop_{false};
+
+    // started last, once the members they use are constructed.
+    std::vector<std::thread> threads_;
+  };
+
+ private:
+  // data members
+  // Grouped by access pattern, each group starting a cache line: threads spinning on the list mutex,
+  // the list lock holder, hash-table readers and size() pollers do not invalidate each other's lines.
+
+  // contended by every thread taking the list lock, alone on its cache line.
+  alignas(CacheLineSize) ListMutex listMutex_;
+
+  // ---- written by the list lock holder ----
+
+  /**
+   * head_ is the least-recently used node.
+   * tail_ is the most-recently used node.
+   * With EvictionPolicy::WTinyLFU the list is the window, see TinyLfu.
+   * listMutex should be held during list modification.
+   *
+   */
+  alignas(CacheLineSize) ListNode head_;
+  ListNode tail_;
+
+  /**
+   * list node storage.
+   * listMutex should be held.
+   *
+   */
+  NodePool nodePool_;
+
+  /**
+   * EvictionPolicy::WTinyLFU only.
+   * listMutex should be held.
+   *
+   */
+  std::unique_ptr<TinyLfu> tinyLfu_;
+
+  /**
+   * expiry schedule of entries inserted with a time to live.
+   * listMutex should be held.
+   *
+   */
+  TimerWheel timerWheel_;
+
+  // ---- read by every operation, written rarely ----
+
+  /**
+   * hits pending list update, EvictionPolicy::LRU and EvictionPolicy::WTinyLFU only.
+   * The stripes are cache-line aligned on their own.
+   *
+   */
+  alignas(CacheLineSize) std::unique_ptr<ReadBuffer> readBuffer_;
+
+  /**
+   * cache capacity, read under listMutex_ when evicting.
+   *
+   */
+  std::atomic<int> capacity_;
+
+  /**
+   * cache weight budget
+   *
+   */
+  const size_t maxWeight_;
+
+  TWeigher weigher_;
+  THash hasher_;
+
+  /**
+   * WithStats only.
+   *
+   */
+  std::unique_ptr<StatsCounters> stats_;
+
+  /**
+   * refresh-ahead of entries hit near expiry, nullptr unless enabled.
+   * Reset first on destruction, pending reloads still use the other members.
+   *
+   */
+  std::unique_ptr<RefreshAhead> refreshAhead_;
+
+  /**
+   * oneTBB concurrent_hash_map, its bucket mask and element count are written by inserts.
+   *
+   */
+  alignas(CacheLineSize) HashMap hash_map_;
+
+  // ---- written by the list lock holder, read lock-free ----
+
+  /**
+   * cache size, number of keys in the list.
+   * Only modified under listMutex_, atomic for lock-free size().
+   *
+   */
+  alignas(CacheLineSize) std::atomic<int> current_size_;
+
+  /**
+   * total weight of the keys in the list.
+   * Only modified under listMutex_, atomic for lock-free weight().
+   *
+   */
+  std::atomic<size_t> current_weight_;
+
+ private:
+  /**
+   * Append a node to the double-linked list as the most-recently used.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void append(ListNode* node);
+
+  /**
+   * Unlink a node from the list.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void unlink(ListNode* node);
+
+  /**
+   * Append a node to list as its most-recently used, node becomes part of segment.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void appendTo(NodeList& list, Segment segment, ListNode* node);
+
+  /**
+   * Move a node hit by find() according to Policy.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void promote(ListNode* node);
+
+  /**
+   * EvictionPolicy::WTinyLFU segment capacities, derived from the current capacity.
+   *
+   */
+  int windowCapacity() const {
+    const int64_t capacity = capacity_.load(std::memory_order_relaxed);
+    return std::max(1, static_cast<int>(capacity * TinyLfu::WindowPercent / 100));
+  }
+
+  int protectedCapacity() const {
+    const int64_t mainCapacity = int64_t{capacity_.load(std::memory_order_relaxed)} - windowCapacity();
+    return static_cast<int>(mainCapacity * TinyLfu::ProtectedPercent / 100);
+  }
+
+  /**
+   * Pick the node to evict according to Policy and unlink it from the list.
+   * Return nullptr if the list is empty.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  ListNode* unlinkVictim();
+
+  /**
+   * Current footprint of the list.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  Footprint footprint() const {
+    return {current_size_.load(std::memory_order_relaxed), current_weight_.load(std::memory_order_relaxed)};
+  }
+
+  /**
+   * Unlink node, remove it from footprint and chain it through next_ in front of evicted, to be passed
+   * to releaseEvicted() once the list lock is released.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void evict(ListNode* node, Footprint& footprint, ListNode*& evicted);
+
+  /**
+   * Evict values according to Policy until footprint size fits in the capacity and weight in the max
+   * weight, then store it as the current footprint.
+   * If the cache already exceeded a shrunk capacity, at most EvictionBatch values more than the ones
+   * added to footprint are evicted, the remaining excess is left to subsequent calls.
+   * Evicted nodes are chained in front of evicted, see evict().
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void evictOverflow(Footprint footprint, ListNode*& evicted);
+
+  /**
+   * Evict values according to Policy until footprint size fits in targetSize and weight in the max
+   * weight, then store it as the current footprint.
+   * Evicted nodes are chained in front of evicted, see evict().
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void evictTo(Footprint footprint, int targetSize, ListNode*& evicted);
+
+  /**
+   * Store footprint as the current footprint.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void setFootprint(const Footprint& footprint) {
+    current_size_.store(footprint.size_, std::memory_order_relaxed);
+    current_weight_.store(footprint.weight_, std::memory_order_relaxed);
+  }
+
+  /**
+   * Evict up to maxCount values of which the time to live elapsed, see evict().
+   * Return number of values evicted.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  size_t evictExpired(Footprint& footprint, ListNode*& evicted, size_t maxCount);
+
+  /**
+   * Erase the hash-table entries of the evicted chain and recycle its nodes.
+   * Thread-safe. Do not call inside linked-list lock.
+   *
+   */
+  void releaseEvicted(ListNode* evicted);
+
+  /**
+   * Erase the hash-table entry of key, which the caller made sure is not linked to the list.
+   * Thread-safe. Do not call inside linked-list lock.
+   *
+   */
+  void eraseUnlinked(const TKey& key);
+
+  /**
+   * Unlink the entry held by accessor and erase it from the hash-table.
+   * Return number of elements removed (0 or 1), see erase().
+   * Thread-safe. Do not call inside linked-list lock.
+   *
+   */
+  size_t eraseEntry(HashMapConstAccessor& accessor);
+
+  /**
+   * Erase the entry of key if it expired, so that it can be inserted again.
+   * Thread-safe. Do not call inside linked-list lock.
+   *
+   */
+  void eraseIfExpired(const TKey& key);
+
+  /**
+   * Schedule a background reload of entry if refresh-ahead is enabled and entry expires within the window,
+   * unless one is pending already.
+   * Caller should hold a hash_map lock on entry.
+   *
+   */
+  void refreshIfNearExpiry(const HashMapValuePair& entry);
+
+  /**
+   * Reload the value of key and reset its time to live, run by the refresh-ahead executor.
+   * The entry is not brought back if it was evicted or erased meanwhile.
+   * Never throws, the stale value, its weight and expiry are kept if the loader, the weigher or the
+   * accounting does.
+   *
+   */
+  void refreshEntry(const RefreshAhead& refresh, const TKey& key) noexcept;
+
+  // ticks of the timing wheel are 2^TickBits nanoseconds.
+  static constexpr int TickBits = 20;
+
+  // steady clock time in nanoseconds.
+  static int64_t clockNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+  }
+
+  // expiry time of a value inserted now with time to live ttl, never 0.
+  static int64_t expiryOf(std::chrono::steady_clock::duration ttl) {
+    return std::max<int64_t>(clockNow() + std::chrono::duration_cast<std::chrono::nanoseconds>(ttl).count(), 1);
+  }
+
+  /**
+   * Schedule node to expire at expiresAt, unless 0.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void scheduleExpiry(ListNode* node, int64_t expiresAt);
+
+  // true if the time to live of value elapsed.
+  static bool isExpired(const Value& value) {
+    const int64_t expiresAt = value.expiresAt_.load(std::memory_order_relaxed);
+    return expiresAt != 0 && expiresAt <= clockNow();
+  }
+
+  /**
+   * Hint the CPU to bring addr into cache for writing.
+   *
+   */
+  static void prefetch(const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr, 1);
+#endif
+  }
+
+  // add n to counter, compiled out unless WithStats.
+  void increment(Counter counter, uint64_t n = 1) {
+    if constexpr (WithStats) {
+      stats_->add(counter, n);
+    }
+  }
+
+  /**
+   * Lock the list mutex, counting the acquisitions which have to wait if WithStats.
+   *
+   */
+  std::unique_lock<ListMutex> lockList() {
+    if constexpr (WithStats) {
+      std::unique_lock<ListMutex> lock{listMutex_, std::try_to_lock};
+      if (!lock) {
+        increment(LockContentions);
+        lock.lock();
+      }
+
+      return lock;
     } else {
-      found_node = accessor->second.listNode_;
+      return std::unique_lock<ListMutex>(listMutex_);
+    }
+  }
+
+  /**
+   * Record an access to entry according to Policy.
+   * Caller should hold a hash_map lock on entry.
+   *
+   */
+  void touch(const HashMapValuePair& entry);
+
+  /**
+   * Replay hits recorded into readBuffer_.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void drainReadBuffer();
+
+  /**
+   * Copy the keys of the linked entries, most-recently used first.
+   * With EvictionPolicy::WTinyLFU protected keys come first, then probation's, then the window's.
+   * Thread-safe.
+   *
+   */
+  std::vector<TKey> hotKeys();
+
+  /**
+   * Append the entry of key to writer, unless key is missing or expired, with no access recorded.
+   * Return true if appended.
+   * Thread-safe.
+   *
+   */
+  template <typename TSerializer>
+  bool saveEntry(SnapshotWriter& writer, const TKey& key, const TSerializer& serializer);
+
+  /**
+   * Insert key and a TValue constructed from args into the hash-table, then link the new entry.
+   * expiresAt is the expiry time of the value, 0 if it never expires.
+   * Return false if key already exists, in which case args may have been moved from.
+   * Thread-safe.
+   *
+   */
+  template <typename K, typename... Args>
+  bool emplaceEntry(int64_t expiresAt, K&& key, Args&&... args);
+
+  /**
+   * Insert key or assign value to the existing entry under a single hash-table write lock.
+   * expiresAt is the expiry time of the value, 0 if it never expires.
+   * Return true if inserted, false if assigned.
+   * Thread-safe.
+   *
+   */
+  template <typename K, typename M>
+  bool assignEntry(int64_t expiresAt, K&& key, M&& value);
+
+  /**
+   * insert_many, the value of keys[i] expiring at expiresAt(i), 0 if it never expires.
+   * Thread-safe.
+   *
+   */
+  template <typename F>
+  size_t insertMany(const TKey* keys, const TValue* values, size_t count, F&& expiresAt);
+
+  /**
+   * Store the weight of entry's value.
+   * Caller should hold the hash_map write lock on entry.
+   *
+   */
+  void weigh(HashMapValuePair& entry);
+
+  // weight of value stored under key, 1 with the UnitWeigher.
+  size_t weightOf(const TKey& key, const TValue& value);
+
+  /**
+   * Append a node for entry to the double-linked list and add it to footprint.
+   * A node heavier than the max weight on its own is evicted right away.
+   * Not thread-safe. Caller is responsible for a lock.
+   *
+   */
+  void linkNode(HashMapValuePair& entry, Footprint& footprint, ListNode*& evicted);
+
+  /**
+   * Account the new weight and expiry of entry after its value got assigned and record the access,
+   * evicting values until weight fits in the max weight.
+   * Return the evicted chain to be passed to releaseEvicted() once the hash-table lock is released.
+   * Caller should hold the hash_map write lock on entry.
+   *
+   */
+  ListNode* updateEntry(const HashMapValuePair& entry);
+
+  /**
+   * Link an entry newly inserted into the hash-table to the double-linked list, evicting the
+   * least-recently used value if the cache is full.
+   * If linking throws, entry is erased from the hash-table.
+   * The hash-table write lock on entry should have been released.
+   * Thread-safe.
+   *
+   */
+  void link(HashMapValuePair& entry);
+
+ public:
+  /**
+   * Duration is the time to live of an entry, any std::chrono::duration converts to it, e.g. 30s.
+   *
+   */
+  using Duration = std::chrono::steady_clock::duration;
+
+  /**
+   * allocator_type allocates the hash-table elements and the list nodes, rebound to each, e.g.
+   * tbb::cache_aligned_allocator or an arena allocator. Stateful allocators are copied at construction.
+   *
+   */
+  using allocator_type = TAllocator;
+
+  /**
+   * EvictionBatch is the max number of values in excess of a shrunk capacity evicted by a single insert,
+   * see setCapacity().
+   *
+   */
+  static constexpr int EvictionBatch = 32;
+
+  /**
+   * ConstAccessor is a helper type wraped over tbb::concurrent_hash_map::const_accessor with
+   * operator overloaded to retrieve value stored in the hash-table based on key.
+   *
+   */
+  struct ConstAccessor final {
+    constexpr ConstAccessor() = default;
+    constexpr ConstAccessor(const ConstAccessor&) = delete;
+
+    constexpr const TValue& operator*() const {
+      return *get();
+    }
+
+    constexpr const TValue* operator->() const {
+      return get();
+    }
+
+    // true if the accessor holds no value, e.g. the last find() missed.
+    constexpr bool empty() const {
+      return !hasValue_;
+    }
+
+    constexpr const TValue* get() const {
+      return &value_;
+    }
+
+    constexpr void release() {
+      constAccessor_.release();
+      hasValue_ = false;
+    }
+
+   private:
+    /**
+     * copy TValue from concurrent_hash_map thus caller could release read lock early.
+     *
+     */
+    void setValue() {
+      setValue(constAccessor_->second.value_);
+    }
+
+    void setValue(const TValue& value) {
+      value_ = value;
+      hasValue_ = true;
+    }
+
+   private:
+    friend class LRUCache;  // for LRUCache member function to access tbb::concurrent_hash_map::const_accessor
+    HashMapConstAccessor constAccessor_;
+    TValue value_;
+    bool hasValue_{false};
+  };
+
+  /**
+   * PinnedAccessor is the zero-copy counterpart of ConstAccessor.
+   *
+   * Instead of copying TValue, it keeps holding the tbb::concurrent_hash_map read lock on the found
+   * entry and exposes the value stored inside the hash-table, thus lookup cost does not depend on
+   * the value size.
+   *
+   * The pinned entry can't be erased nor evicted until release() or destruction, any thread doing
+   * so waits for the read lock. Keep the lifetime short:
+   *  Do not insert/erase through the same cache while holding a PinnedAccessor, the operation may
+   *   need to evict the pinned entry and wait for itself.
+   *  Do not hold more than one PinnedAccessor per thread, see tbb::concurrent_hash_map accessors.
+   *
+   */
+  struct PinnedAccessor final {
+    PinnedAccessor() = default;
+    PinnedAccessor(const PinnedAccessor&) = delete;
+
+    const TValue& operator*() const {
+      return *get();
+    }
+
+    const TValue* operator->() const {
+      return get();
+    }
+
+    bool empty() const {
+      return constAccessor_.empty();
+    }
+
+    const TValue* get() const {
+      return &constAccessor_->second.value_;
+    }
+
+    void release() {
+      constAccessor_.release();
+    }
+
+   private:
+    friend class LRUCache;  // for LRUCache member function to access tbb::concurrent_hash_map::const_accessor
+    HashMapConstAccessor constAccessor_;
+  };
+
+  /**
+   * size: initial size for the cache, see setCapacity().
+   *
+   * bucketCount: used for initial setup the tbb:concurrent_hash_map, the bucket size
+   * will grow depends on internal oneTBB algorithm.
+   *
+   * maxWeight: upper bound of the total weight of cached entries as measured by TWeigher,
+   * unbounded by default.
+   *
+   * allocator: copied, rebound to the hash-table elements and to the list nodes.
+   */
+  explicit LRUCache(int size,
+                    size_t bucketCount = std::thread::hardware_concurrency() * 8,
+                    size_t maxWeight = std::numeric_limits<size_t>::max(),
+                    const TAllocator& allocator = TAllocator());
+
+  ~LRUCache() noexcept {
+    refreshAhead_.reset();
+    clear();
+  }
+
+  LRUCache(const LRUCache& other) = delete;
+  LRUCache& operator=(const LRUCache&) = delete;
+
+  /**
+   * erase removes key from LRUCache along with its value.
+   * returns number of elements removed (0 or 1).
+   *
+   */
+  size_t erase(const TKey& key);
+
+  /**
+   * find finds data inside hash-table through provided key.
+   * ConstAccessor stores a copy of the found result.
+   * Return true if key exist, otherwise false.
+   *
+   * find updates key access frequency.
+   * With EvictionPolicy::Clock find only sets the key's reference bit, no list mutex involved.
+   *
+   */
+  bool find(ConstAccessor& ac, const TKey& key);
+
+  /**
+   * find finds data inside hash-table through provided key without copying it.
+   * PinnedAccessor keeps the entry read-locked until released.
+   * Return true if key exist, otherwise false.
+   *
+   * find updates key access frequency.
+   *
+   */
+  bool find(PinnedAccessor& ac, const TKey& key);
+
+  /**
+   * find_many finds count keys at once, results[i] stores a copy of the value found for keys[i].
+   * results[i].empty() is true if keys[i] does not exist.
+   * Return number of keys found.
+   *
+   * find_many updates access frequency of all keys found under a single list lock acquisition,
+   * list nodes are prefetched while probing the hash-table.
+   *
+   */
+  size_t find_many(const TKey* keys, size_t count, ConstAccessor* results);
+
+  /**
+   * insert key/value into cache. Both key and value is copied into the cache.
+   * insert updates key access frequency.
+   *
+   * If key already exists in the cache, the value will not be updated and return
+   * false. Otherwise return true.
+   *
+   */
+  bool insert(const TKey& key, const TValue& value) {
+    return emplaceEntry(0, key, value);
+  }
+
+  /**
+   * insert key/value into cache, the entry expires once ttl elapsed.
+   * An expired entry is never found, it is reclaimed by subsequent inserts or expire(), and insert treats
+   * its key as absent.
+   *
+   */
+  bool insert(const TKey& key, const TValue& value, Duration ttl) {
+    return emplaceEntry(expiryOf(ttl), key, value);
+  }
+
+  /**
+   * insert key/value into cache. Both key and value is moved into the cache.
+   * insert updates key access frequency.
+   *
+   * If key already exists in the cache, the value will not be updated and return
+   * false, key and value may have been moved from. Otherwise return true.
+   *
+   */
+  bool insert(TKey&& key, TValue&& value) {
+    return emplaceEntry(0, std::move(key), std::move(value));
+  }
+
+  bool insert(TKey&& key, TValue&& value, Duration ttl) {
+    return emplaceEntry(expiryOf(ttl), std::move(key), std::move(value));
+  }
+
+  /**
+   * insert_many inserts count key/value pairs at once, keys[i] with values[i]. Both keys and values is
+   * copied into the cache.
+   *
+   * Pairs of which key already exists in the cache are skipped, their value will not be updated.
+   * Return number of pairs inserted.
+   *
+   * insert_many appends all new keys and picks all keys to evict under a single list lock acquisition.
+   *
+   * If an exception happens, pairs inserted before remain in the cache.
+   *
+   */
+  size_t insert_many(const TKey* keys, const TValue* values, size_t count) {
+    return insertMany(keys, values, count, [](size_t) { return int64_t{0}; });
+  }
+
+  /**
+   * insert_many with a time to live per pair: values[i] expires ttls[i] after the insert, never if ttls[i]
+   * is Duration::zero().
+   *
+   */
+  size_t insert_many(const TKey* keys, const TValue* values, size_t count, const Duration* ttls) {
+    return insertMany(keys, values, count,
+                      [ttls](size_t i) { return ttls[i] == Duration::zero() ? int64_t{0} : expiryOf(ttls[i]); });
+  }
+
+  /**
+   * emplace inserts key with the value constructed in place inside the hash-table from args.
+   * emplace updates key access frequency.
+   *
+   * If key already exists in the cache, the value will not be updated and return
+   * false, args may have been moved from. Otherwise return true.
+   *
+   */
+  template <typename... Args>
+  bool emplace(const TKey& key, Args&&... args) {
+    return emplaceEntry(0, key, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  bool emplace(TKey&& key, Args&&... args) {
+    return emplaceEntry(0, std::move(key), std::forward<Args>(args)...);
+  }
+
+  /**
+   * insert_or_assign inserts key/value into cache, or assigns value to the existing key.
+   * Either way it takes a single hash-table write lock and updates key access frequency.
+   *
+   * Return true if key was inserted, false if value was assigned.
+   *
+   * The entry expires once ttl elapsed if given, otherwise never, whatever its previous time to live.
+   * An expired key counts as inserted.
+   *
+   */
+  template <typename M>
+  bool insert_or_assign(const TKey& key, M&& value) {
+    return assignEntry(0, key, std::forward<M>(value));
+  }
+
+  template <typename M>
+  bool insert_or_assign(TKey&& key, M&& value) {
+    return assignEntry(0, std::move(key), std::forward<M>(value));
+  }
+
+  template <typename M>
+  bool insert_or_assign(const TKey& key, M&& value, Duration ttl) {
+    return assignEntry(expiryOf(ttl), key, std::forward<M>(value));
+  }
+
+  template <typename M>
+  bool insert_or_assign(TKey&& key, M&& value, Duration ttl) {
+    return assignEntry(expiryOf(ttl), std::move(key), std::forward<M>(value));
+  }
+
+  /**
+   * get_or_load finds key, or inserts it with the value returned by loader(key) on a miss.
+   * ConstAccessor stores a copy of the found or loaded value.
+   * Return true if the value was loaded, false if key was found.
+   *
+   * Loading is single-flight: concurrent misses on the same key coalesce, exactly one caller runs loader
+   * while the others wait for the entry's write lock and then find the loaded value. find() and erase()
+   * of that key wait as well, other keys are not affected.
+   *
+   * loader is called with no list lock held, but it must not use this cache: it holds a hash-table
+   * write lock, see tbb::concurrent_hash_map accessors.
+   * If loader throws, nothing is inserted and the exception propagates, a waiting caller then runs
+   * loader itself.
+   *
+   * The entry expires once ttl elapsed if given, otherwise never. An expired key is loaded again.
+   *
+   * Type concepts:
+   * loader is invocable with const TKey&, TValue is assignable from its result.
+   *
+   */
+  template <typename F>
+  bool get_or_load(ConstAccessor& ac, const TKey& key, F&& loader) {
+    return loadEntry(0, ac, key, std::forward<F>(loader));
+  }
+
+  template <typename F>
+  bool get_or_load(ConstAccessor& ac, const TKey& key, F&& loader, Duration ttl) {
+    return loadEntry(expiryOf(ttl), ac, key, std::forward<F>(loader));
+  }
+
+  /**
+   * setRefreshAhead enables refresh-ahead: a hit(find(), find_many(), get_or_load()) on an entry expiring
+   * within window returns the current value right away and schedules loader(key) to reload it in the
+   * background, the reloaded value expiring once ttl elapsed. Entries without time to live are never refreshed.
+   *
+   * Reloads run on a dedicated pool of maxConcurrency threads, so hits never wait for loader.
+   * At most one reload per entry is pending, an entry evicted or erased meanwhile is not brought back.
+   * If loader throws, the stale value is kept until it expires and a later hit retries.
+   *
+   * loader runs with no cache lock held.
+   * Not thread-safe, call before sharing the cache. Replacing or clearing the configuration waits for
+   * pending reloads, as do clear() and destruction.
+   *
+   */
+  void setRefreshAhead(Duration window,
+                       Duration ttl,
+                       std::function<TValue(const TKey&)> loader,
+                       int maxConcurrency = 1) {
+    refreshAhead_.reset();
+    refreshAhead_ = std::make_unique<RefreshAhead>(*this,
+                                                   std::chrono::duration_cast<std::chrono::nanoseconds>(window).count(),
+                                                   ttl,
+                                                   std::move(loader),
+                                                   maxConcurrency);
+  }
+
+  /**
+   * clearRefreshAhead disables refresh-ahead once pending reloads completed.
+   * Not thread-safe.
+   *
+   */
+  void clearRefreshAhead() {
+    refreshAhead_.reset();
+  }
+
+  /**
+   * expire evicts up to maxCount entries of which the time to live elapsed, under a single list lock
+   * acquisition. Inserts already reclaim expired entries a batch at a time, expire() lets a background
+   * thread keep up with entries expiring faster than keys get inserted, see ExpiryThread.
+   * Return number of entries evicted, 0 once no expired entry is left.
+   * Thread-safe.
+   *
+   */
+  size_t expire(size_t maxCount = EvictionBatch);
+
+  /**
+   * clear erases all elements from the container.
+   * After this call, size() returns zero.
+   * Not thread-safe.
+   *
+   */
+  void clear() noexcept;
+
+  /**
+   * checkConsistency walks the double-linked list(s) and the hash-table, for tests and debugging.
+   * Return true if every linked node refers back to an entry whose listNode_ is that node, every entry is
+   * linked exactly once, and size() and weight() are accounted for by the linked nodes.
+   * Not thread-safe: no insert may be in progress, whose entry exists but is not linked yet.
+   *
+   */
+  bool checkConsistency();
+
+  /**
+   * size returns the current cache size.
+   * size never exceeds capacity, keys being inserted are only counted once linked.
+   * After the capacity shrank, size does not grow and comes down to capacity as the excess is evicted.
+   *
+   */
+  int size() const {
+    return current_size_.load();
+  }
+
+  /**
+   * capacity returns the cache capacity.
+   *
+   */
+  int capacity() const {
+    return capacity_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * setCapacity changes the cache capacity.
+   * Thread-safe.
+   *
+   * Shrinking does not evict by itself: values in excess are evicted incrementally, at most a small
+   * batch per subsequent insert, so that a large shrink does not stall a single caller.
+   * Call trim() to drain the excess from a background thread instead.
+   * With EvictionPolicy::WTinyLFU the frequency sketch is resized by the next insert, see
+   * FrequencySketch::ensureCapacity().
+   *
+   */
+  void setCapacity(int size) {
+    capacity_.store(size, std::memory_order_relaxed);
+  }
+
+  /**
+   * trim evicts up to maxCount values in excess of the capacity, under a single list lock acquisition.
+   * Return number of values evicted, 0 once size fits in capacity.
+   * Thread-safe.
+   *
+   */
+  int trim(int maxCount = EvictionBatch);
+
+  /**
+   * weight returns the total weight of the cached entries.
+   * weight never exceeds maxWeight, keys being inserted are only counted once linked.
+   *
+   */
+  size_t weight() const {
+    return current_weight_.load();
+  }
+
+  /**
+   * maxWeight returns the cache weight budget.
+   *
+   */
+  constexpr size_t maxWeight() const {
+    return maxWeight_;
+  }
+
+  /**
+   * stats returns a snapshot of the cache counters, see CacheStats.
+   * Requires WithStats. Thread-safe, lock-free.
+   *
+   */
+  CacheStats stats() const;
+
+  /**
+   * save writes the cached entries to a snapshot file at path, hottest first, to warm up another cache with
+   * load(). Keys and values are converted by serializer, see TrivialSerializer. Entries expired are skipped,
+   * the others keep their remaining time to live.
+   * The snapshot is written to a temporary file which replaces path once complete.
+   * Return false on I/O failure, path is then left untouched.
+   * Thread-safe, concurrent writers may or may not see their changes saved.
+   *
+   */
+  template <typename TSerializer = TrivialSerializer>
+  bool save(const std::string& path, const TSerializer& serializer = TSerializer());
+
+  /**
+   * save appends the cached entries to writer, hottest first, see save(path).
+   * Return number of entries appended.
+   *
+   */
+  template <typename TSerializer = TrivialSerializer>
+  size_t save(SnapshotWriter& writer, const TSerializer& serializer = TSerializer());
+
+  /**
+   * load inserts the entries of the snapshot file at path written by save(), up to capacity of them.
+   * The hottest entries are inserted last, thus the recency order of the saved cache is kept. Keys already
+   * cached keep their value, entries expired since the save are skipped. The file is mapped in memory
+   * rather than read.
+   * Requires default-constructible TKey and TValue.
+   * Return number of entries inserted, 0 if path is missing or not a snapshot.
+   * Thread-safe.
+   *
+   */
+  template <typename TSerializer = TrivialSerializer>
+  size_t load(const std::string& path, const TSerializer& serializer = TSerializer());
+
+  /**
+   * load inserts up to capacity entries of reader, see load(path).
+   *
+   */
+  template <typename TSerializer = TrivialSerializer>
+  size_t load(const SnapshotReader& reader, const TSerializer& serializer = TSerializer());
+
+ private:
+  /**
+   * Find key, or insert it with the value returned by loader(key) under the hash-table write lock of the
+   * new entry, thus concurrent loads of the same key wait for the first one and share its value.
+   * Declared here as it needs the complete ConstAccessor.
+   * expiresAt is the expiry time of the loaded value, 0 if it never expires.
+   * Return true if the value was loaded, false if found.
+   * If loader throws, the entry is erased and the exception propagates.
+   * Thread-safe.
+   *
+   */
+  template <typename F>
+  bool loadEntry(int64_t expiresAt, ConstAccessor& caccessor, const TKey& key, F&& loader);
+};
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+typename LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::ListNode* const
+  LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::NullNodePtr = reinterpret_cast<ListNode*>(-1);
+
+// ---- private member functions ----
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::unlink(ListNode* node) {
+  ListNode* prev = node->prev_;
+  ListNode* next = node->next_;
+  prev->next_ = next;
+  next->prev_ = prev;
+
+  // assign to NullNodePtr as indicator that this node is no longer in the double-linked list.
+  node->prev_ = NullNodePtr;
+
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    --tinyLfu_->sizeOf(node->segment_);
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::append(ListNode* node) {
+  ListNode* prevLatestNode = tail_.prev_;
+
+  node->next_ = &tail_;
+  node->prev_ = prevLatestNode;
+
+  tail_.prev_ = node;
+  prevLatestNode->next_ = node;
+
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    node->segment_ = Window;
+    ++tinyLfu_->windowSize_;
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::appendTo(NodeList& list,
+                                                                                      Segment segment,
+                                                                                      ListNode* node) {
+  ListNode* prevLatestNode = list.tail_.prev_;
+
+  node->next_ = &list.tail_;
+  node->prev_ = prevLatestNode;
+
+  list.tail_.prev_ = node;
+  prevLatestNode->next_ = node;
+
+  node->segment_ = segment;
+  ++list.size_;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::promote(ListNode* node) {
+  if constexpr (Policy == EvictionPolicy::Clock) {
+    node->referenced_.store(true, std::memory_order_relaxed);
+  } else if constexpr (Policy == EvictionPolicy::LRU) {
+    unlink(node);
+    append(node);
+  } else {
+    TinyLfu& lfu = *tinyLfu_;
+    lfu.sketch_.increment(node->hash_);
+
+    if (node->segment_ == Window) {
+      unlink(node);
+      append(node);
+      return;
+    }
+
+    unlink(node);
+    appendTo(lfu.protected_, Protected, node);
+
+    if (lfu.protected_.size_ > protectedCapacity()) {
+      ListNode* demoted = lfu.protected_.front();
+      unlink(demoted);
+      appendTo(lfu.probation_, Probation, demoted);
+    }
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+typename LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::ListNode*
+LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::unlinkVictim() {
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    TinyLfu& lfu = *tinyLfu_;
+    ListNode* victim = lfu.probation_.front();
+    if (victim == nullptr) {
+      victim = lfu.protected_.front();
+    }
+
+    // the window's least-recently used key competes with the main space's for admission.
+    ListNode* candidate = head_.next_ != &tail_ ? head_.next_ : nullptr;
+    if (candidate != nullptr && (victim == nullptr || lfu.windowSize_ > windowCapacity())) {
+      if (victim != nullptr && lfu.sketch_.frequency(candidate->hash_) > lfu.sketch_.frequency(victim->hash_)) {
+        unlink(candidate);
+        appendTo(lfu.probation_, Probation, candidate);
+      } else {
+        victim = candidate;
+      }
+    }
+
+    if (victim != nullptr) {
+      unlink(victim);
+    }
+    return victim;
+  }
+
+  ListNode* candidate = head_.next_;
+
+  if constexpr (Policy == EvictionPolicy::Clock) {
+    // Sweep the ring from the hand, referenced nodes get a second chance behind the hand.
+    // Sweep is bounded since readers may keep setting reference bits concurrently.
+    const int sweepLimit = capacity_.load(std::memory_order_relaxed);
+    for (int sweep = 0; candidate != &tail_ && sweep < sweepLimit; ++sweep, candidate = head_.next_) {
+      if (!candidate->referenced_.load(std::memory_order_relaxed)) {
+        break;
+      }
+
+      candidate->referenced_.store(false, std::memory_order_relaxed);
+      unlink(candidate);
+      append(candidate);
+    }
+  }
+
+  if (candidate == &tail_) {
+    return nullptr;
+  }
+
+  unlink(candidate);
+  return candidate;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::evict(ListNode* node,
+                                                                                   Footprint& footprint,
+                                                                                   ListNode*& evicted) {
+  unlink(node);
+  timerWheel_.cancel(node);
+  --footprint.size_;
+  footprint.weight_ -= node->weight_;
+
+  // key_ is still needed to erase the hash-table entry, the node is recycled afterwards.
+  node->next_ = evicted;
+  evicted = node;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::evictOverflow(Footprint footprint,
+                                                                                           ListNode*& evicted) {
+  // When within capacity before this operation, every value added in excess is evicted. Otherwise the
+  // capacity shrank meanwhile: the size does not grow and comes down by at most EvictionBatch.
+  const int committed = current_size_.load(std::memory_order_relaxed);
+  const int targetSize =
+    std::max(capacity_.load(std::memory_order_relaxed), std::min(committed, footprint.size_) - EvictionBatch);
+
+  evictTo(footprint, targetSize, evicted);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::evictTo(Footprint footprint,
+                                                                                     int targetSize,
+                                                                                     ListNode*& evicted) {
+  while (footprint.size_ > targetSize || footprint.weight_ > maxWeight_) {
+    ListNode* candidate = unlinkVictim();
+    if (candidate == nullptr) {
+      break;
+    }
+
+    timerWheel_.cancel(candidate);
+    --footprint.size_;
+    footprint.weight_ -= candidate->weight_;
+    candidate->next_ = evicted;
+    evicted = candidate;
+    increment(Evictions);
+  }
+
+  setFootprint(footprint);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::evictExpired(Footprint& footprint,
+                                                                                            ListNode*& evicted,
+                                                                                            size_t maxCount) {
+  if (timerWheel_.count_.load(std::memory_order_relaxed) == 0) {
+    return 0;
+  }
+
+  const uint64_t tick = static_cast<uint64_t>(clockNow()) >> TickBits;
+  const size_t expired = timerWheel_.advance(tick, maxCount, [&](ListNode* node) { evict(node, footprint, evicted); });
+  increment(Expirations, expired);
+  return expired;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::scheduleExpiry(ListNode* node,
+                                                                                            int64_t expiresAt) {
+  if (expiresAt == 0) {
+    return;
+  }
+
+  // rounded up, a node never expires before its value does.
+  const uint64_t tick = (static_cast<uint64_t>(expiresAt) + (uint64_t{1} << TickBits) - 1) >> TickBits;
+  timerWheel_.schedule(node, tick, static_cast<uint64_t>(clockNow()) >> TickBits);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::releaseEvicted(ListNode* evicted) {
+  while (evicted != nullptr) {
+    ListNode* next = evicted->next_;
+
+    // An unlinked entry is only erased by the thread which unlinked it, no other entry with the same key
+    // can be inserted meanwhile.
+    eraseUnlinked(*evicted->key_);
+    nodePool_.retire(evicted);
+    evicted = next;
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::eraseUnlinked(const TKey& key) {
+  HashMapConstAccessor accessor;
+  if (!hash_map_.find(accessor, key)) {
+    return;
+  }
+
+  // erase issues lock, do not call this API inside linked-list lock.
+  // https://github.com/jckarter/tbb/blob/0343100743d23f707a9001bc331988a31778c9f4/include/tbb/concurrent_hash_map.h#L1093
+  hash_map_.erase(accessor);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::eraseEntry(
+    HashMapConstAccessor& accessor) {
+  ListNode* found_node = accessor->second.listNode_.load(std::memory_order_acquire);
+  if (found_node == nullptr) {
+    // the insert of the entry is still in progress, erase takes effect before it.
+    return 0;
+  }
+
+  {
+    std::unique_lock<ListMutex> lock = lockList();
+    drainReadBuffer();
+
+    if (!found_node->linkedTo(&accessor->first)) {
+      // evicted or erased by another thread, which also erases the entry from hash_map.
+      return 0;
     }
+
+    unlink(found_node);
+    timerWheel_.cancel(found_node);
+    current_size_.store(current_size_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    current_weight_.store(current_weight_.load(std::memory_order_relaxed) - found_node->weight_,
+                          std::memory_order_relaxed);
+    nodePool_.release(found_node);
+  }
+
+  // erase issues lock, do not call this API inside linked-list lock.
+  // https://github.com/jckarter/tbb/blob/0343100743d23f707a9001bc331988a31778c9f4/include/tbb/concurrent_hash_map.h#L1093
+  hash_map_.erase(accessor);
+  return 1;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::eraseIfExpired(const TKey& key) {
+  // no entry can have expired unless some are scheduled.
+  if (timerWheel_.count_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+
+  HashMapConstAccessor accessor;
+  if (hash_map_.find(accessor, key) && isExpired(accessor->second)) {
+    eraseEntry(accessor);
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::refreshIfNearExpiry(
+    const HashMapValuePair& entry) {
+  RefreshAhead* refresh = refreshAhead_.get();
+  if (refresh == nullptr) {
+    return;
+  }
+
+  const int64_t expiresAt = entry.second.expiresAt_.load(std::memory_order_relaxed);
+  if (expiresAt == 0 || clockNow() + refresh->window_ < expiresAt ||
+      entry.second.refreshing_.exchange(true, std::memory_order_relaxed)) {
+    return;
   }
 
+  try {
+    refresh->submit(entry.first);
+  } catch (...) {
+    // best effort, the hit itself succeeded.
+    entry.second.refreshing_.store(false, std::memory_order_relaxed);
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::refreshEntry(const RefreshAhead& refresh,
+                                                                                          const TKey& key) noexcept {
+  ListNode* evicted{nullptr};
+
   {
-    if (found_node->inList()) {
-      std::unique_lock<ListMutex> lock(listMutex_);
-      if (found_node->inList()) {
-        unlink(found_node.get());
-        current_size_--;
-        marked = true;
+    HashMapAccessor accessor;
+    try {
+      TValue value = refresh.loader_(key);
+      // weighed before the entry is written, a throwing weigher leaves it untouched.
+      const size_t weight = weightOf(key, value);
+
+      // a key erased and inserted again meanwhile is not pending a reload, its value is kept.
+      if (!hash_map_.find(accessor, key) || !accessor->second.refreshing_.load(std::memory_order_relaxed)) {
+        return;
+      }
+
+      Value& entry = accessor->second;
+      std::swap(entry.value_, value);
+      const size_t previousWeight = entry.weight_.exchange(weight, std::memory_order_relaxed);
+      const int64_t previousExpiresAt = entry.expiresAt_.exchange(expiryOf(refresh.ttl_), std::memory_order_relaxed);
+      try {
+        evicted = updateEntry(*accessor);
+      } catch (...) {
+        // not accounted, the entry gets back what the list knows of it.
+        std::swap(entry.value_, value);
+        entry.weight_.store(previousWeight, std::memory_order_relaxed);
+        entry.expiresAt_.store(previousExpiresAt, std::memory_order_relaxed);
+        throw;
+      }
+      entry.refreshing_.store(false, std::memory_order_relaxed);
+    } catch (...) {
+      // the stale value stays until it expires, a later hit retries.
+      accessor.release();
+      HashMapConstAccessor caccessor;
+      if (hash_map_.find(caccessor, key)) {
+        caccessor->second.refreshing_.store(false, std::memory_order_relaxed);
       }
+      return;
     }
   }
 
-  if (marked) {
-    // erase issues lock, do not call this API inside linked-list lock.
-    // https://github.com/jckarter/tbb/blob/0343100743d23f707a9001bc331988a31778c9f4/include/tbb/concurrent_hash_map.h#L1093
-    hash_map_.erase(key);
+  releaseEvicted(evicted);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::touch(const HashMapValuePair& entry) {
+  // nodes are type-stable, reading through the pointer needs no ownership.
+  ListNode* found_node = entry.second.listNode_.load(std::memory_order_acquire);
+
+  if (found_node == nullptr) {
+    return;
   }
 
-  return 1;
+  if constexpr (Policy == EvictionPolicy::Clock) {
+    // skip the store if already referenced, avoids invalidating the cache line on hot keys.
+    if (!found_node->referenced_.load(std::memory_order_relaxed)) {
+      found_node->referenced_.store(true, std::memory_order_relaxed);
+    }
+  } else {
+    // Key found, update double-linked list with try lock.
+    // If lock can't be obtained, record the hit for the next list lock holder.
+    // The entry is locked by caller, it can't be erased and its node can't be recycled meanwhile.
+    std::unique_lock<ListMutex> lock{listMutex_, std::try_to_lock};
+    if (!lock) {
+      increment(readBuffer_->record(found_node) ? DeferredHits : DroppedHits);
+      return;
+    }
+
+    drainReadBuffer();
+    if (found_node->linkedTo(&entry.first)) {
+      promote(found_node);
+    }
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::drainReadBuffer() {
+  if constexpr (Policy != EvictionPolicy::Clock) {
+    readBuffer_->drain([this](ListNode* node) {
+      if (node->inList()) {
+        promote(node);
+      }
+    });
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+std::vector<TKey> LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::hotKeys() {
+  std::vector<TKey> keys;
+  keys.reserve(static_cast<size_t>(std::max(size(), 0)));
+
+  std::unique_lock<ListMutex> lock = lockList();
+  drainReadBuffer();
+
+  // linked keys outlive the list lock holder's walk, only the thread unlinking a node erases its entry.
+  auto appendAll = [&keys](const ListNode* head, const ListNode* tail) {
+    for (const ListNode* node = tail->prev_; node != head; node = node->prev_) {
+      keys.push_back(*node->key_);
+    }
+  };
+
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    appendAll(&tinyLfu_->protected_.head_, &tinyLfu_->protected_.tail_);
+    appendAll(&tinyLfu_->probation_.head_, &tinyLfu_->probation_.tail_);
+  }
+  appendAll(&head_, &tail_);
+
+  return keys;
 }
 
-template <class TKey, class TValue, class THash>
-bool LRUCache<TKey, TValue, THash>::find(ConstAccessor& caccessor, const TKey& key) {
-  std::shared_ptr<ListNode> found_node;
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename K, typename... Args>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::emplaceEntry(int64_t expiresAt,
+                                                                                          K&& key,
+                                                                                          Args&&... args) {
+  HashMapValuePair* entry{nullptr};
+  eraseIfExpired(key);
 
   {
-    // fine-grained read lock on hash_map
-    if (!hash_map_.find(caccessor.constAccessor_, key)) {
-      caccessor.constAccessor_.release();  // manual release, reference object can't count on RAII
+    // fine-grained write lock for hash_map, prevents other lock acquires hash_map
+    // key and value are constructed in place inside the hash_map node.
+    HashMapAccessor accessor;
+    if (!hash_map_.emplace(accessor,
+                           std::piecewise_construct,
+                           std::forward_as_tuple(std::forward<K>(key)),
+                           std::forward_as_tuple(std::in_place, std::forward<Args>(args)...))) {
       return false;
-    } else {
-      // copy value from hash_map
-      caccessor.setValue();
-      // shared owner-ship for listNode. ref cnt increased, decrease when found_node out of the scope.
-      found_node = caccessor.constAccessor_->second.listNode_;
-      caccessor.constAccessor_.release();  // manual release, reference object can't count on RAII
     }
+
+    // entry stays valid after the write lock is released, until its node gets unlinked.
+    entry = &*accessor;
+    entry->second.expiresAt_.store(expiresAt, std::memory_order_relaxed);
+    weigh(*entry);
   }
 
+  link(*entry);
+  return true;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename K, typename M>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::assignEntry(int64_t expiresAt,
+                                                                                         K&& key,
+                                                                                         M&& value) {
+  HashMapValuePair* entry{nullptr};
+  ListNode* evicted{nullptr};
+  bool expired = false;
+
   {
-    // Key found, update double-linked list with try lock.
-    // If lock can't be obtained, skip updating the LRU linked list.
-    std::unique_lock<ListMutex> lock{listMutex_, std::try_to_lock};
-    if (lock) {
-      if (found_node->inList()) {
-        // share linkNode ownership to unlink API.
-        unlink(found_node.get());
-        // share linkNode ownership to append API.
-        append(found_node.get());
+    HashMapAccessor accessor;
+    bool inserted = false;
+
+    if constexpr (std::is_lvalue_reference_v<K>) {
+      // key is only copied if absent.
+      inserted = hash_map_.insert(accessor, key);
+    } else {
+      inserted =
+        hash_map_.emplace(accessor, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::tuple<>());
+    }
+
+    // an expired entry is replaced as if it was absent.
+    expired = !inserted && isExpired(accessor->second);
+    const int64_t previousExpiresAt = accessor->second.expiresAt_.load(std::memory_order_relaxed);
+
+    accessor->second.value_ = std::forward<M>(value);
+    accessor->second.expiresAt_.store(expiresAt, std::memory_order_relaxed);
+    weigh(*accessor);
+
+    if (!inserted) {
+      if (IsUnitWeigher && previousExpiresAt == 0 && expiresAt == 0) {
+        // neither weight nor expiry changed, a hit.
+        touch(*accessor);
+        return false;
       }
+
+      evicted = updateEntry(*accessor);
+    } else {
+      // entry stays valid after the write lock is released, until its node gets unlinked.
+      entry = &*accessor;
     }
   }
 
+  if (entry == nullptr) {
+    // the assigned entry itself may have been evicted, erased once its write lock is released.
+    releaseEvicted(evicted);
+    return expired;
+  }
+
+  link(*entry);
   return true;
 }
 
-template <class TKey, class TValue, class THash>
-bool LRUCache<TKey, TValue, THash>::insert(const TKey& key, const TValue& value) {
-  std::shared_ptr<ListNode> node = std::make_shared<ListNode>(key);
-  HashMapValuePair hashMapValue{key, Value{value, node}};
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename F>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::loadEntry(int64_t expiresAt,
+                                                                                       ConstAccessor& caccessor,
+                                                                                       const TKey& key,
+                                                                                       F&& loader) {
+  // hits only take the read lock.
+  if (find(caccessor, key)) {
+    return false;
+  }
+
+  HashMapValuePair* entry{nullptr};
+  ListNode* evicted{nullptr};
 
   {
-    // fine-grained write lock for hash_map, prevents other lock acquires hash_map
+    // the write lock is held while loading, concurrent loads of key wait here for the loaded value.
     HashMapAccessor accessor;
-    if (!hash_map_.insert(accessor, hashMapValue)) {
+    const bool inserted = hash_map_.insert(accessor, key);
+
+    if (!inserted && !isExpired(accessor->second)) {
+      // loaded by another caller meanwhile.
+      caccessor.setValue(accessor->second.value_);
+      increment(Hits);
+      touch(*accessor);
+      refreshIfNearExpiry(*accessor);
       return false;
     }
+
+    try {
+      accessor->second.value_ = std::forward<F>(loader)(accessor->first);
+      caccessor.setValue(accessor->second.value_);
+    } catch (...) {
+      // a new entry is not linked yet, an expired one stays expired.
+      if (inserted) {
+        hash_map_.erase(accessor);
+      }
+      throw;
+    }
+
+    accessor->second.expiresAt_.store(expiresAt, std::memory_order_relaxed);
+    weigh(*accessor);
+    increment(Loads);
+
+    if (inserted) {
+      // entry stays valid after the write lock is released, until its node gets unlinked.
+      entry = &*accessor;
+    } else {
+      evicted = updateEntry(*accessor);
+    }
   }
 
-  int size = current_size_.load();
-  bool popped = false;
-  if (size >= capacity_) {
-    popFront();
-    popped = true;
+  if (entry == nullptr) {
+    releaseEvicted(evicted);
+    return true;
   }
 
-  {
-    std::unique_lock<ListMutex> lock(listMutex_);
+  link(*entry);
+  return true;
+}
 
-    append(node.get());
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::weigh(HashMapValuePair& entry) {
+  if constexpr (!IsUnitWeigher) {
+    entry.second.weight_.store(weightOf(entry.first, entry.second.value_), std::memory_order_relaxed);
   }
+}
 
-  if (!popped) {
-    size = current_size_++;
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::weightOf(const TKey& key,
+                                                                                        const TValue& value) {
+  if constexpr (IsUnitWeigher) {
+    return 1;
+  } else {
+    return weigher_(key, value);
   }
+}
 
-  if (size > capacity_) {
-    if (current_size_.compare_exchange_strong(size, size - 1)) {
-      popFront();
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::linkNode(HashMapValuePair& entry,
+                                                                                      Footprint& footprint,
+                                                                                      ListNode*& evicted) {
+  ListNode* node = nodePool_.acquire();
+  node->key_ = &entry.first;
+  // a concurrent assignment stores the new weight and expiry before taking the list lock, see updateEntry().
+  node->weight_ = entry.second.weight_.load(std::memory_order_relaxed);
+
+  append(node);
+  scheduleExpiry(node, entry.second.expiresAt_.load(std::memory_order_relaxed));
+  entry.second.listNode_.store(node, std::memory_order_release);
+  ++footprint.size_;
+  footprint.weight_ += node->weight_;
+
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    TinyLfu& lfu = *tinyLfu_;
+    node->hash_ = hasher_.hash(entry.first);
+    // follows setCapacity(), lazily: a sketch narrower than the cache saturates and admits at random.
+    lfu.sketch_.ensureCapacity(static_cast<size_t>(std::max(capacity_.load(std::memory_order_relaxed), 0)));
+    lfu.sketch_.increment(node->hash_);
+
+    // while the cache has room, the window overflows into probation without any admission decision.
+    while (lfu.windowSize_ > windowCapacity() && footprint.size_ <= capacity_.load(std::memory_order_relaxed)) {
+      ListNode* candidate = head_.next_;
+      unlink(candidate);
+      appendTo(lfu.probation_, Probation, candidate);
     }
   }
 
-  return true;
+  if (node->weight_ > maxWeight_) {
+    evict(node, footprint, evicted);
+    increment(Evictions);
+  }
 }
 
-template <class TKey, class TValue, class THash>
-void LRUCache<TKey, TValue, THash>::clear() noexcept {
-  hash_map_.clear();
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+typename LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::ListNode*
+LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::updateEntry(const HashMapValuePair& entry) {
+  ListNode* evicted{nullptr};
+
+  std::unique_lock<ListMutex> lock = lockList();
+  drainReadBuffer();
+
+  // nullptr if the entry is still being linked, linkNode() then accounts the new weight and expiry.
+  ListNode* found_node = entry.second.listNode_.load(std::memory_order_acquire);
+  if (found_node == nullptr || !found_node->linkedTo(&entry.first)) {
+    return evicted;
+  }
+
+  promote(found_node);
+
+  const size_t weight = entry.second.weight_.load(std::memory_order_relaxed);
+  Footprint current = footprint();
+  current.weight_ = current.weight_ - found_node->weight_ + weight;
+  found_node->weight_ = weight;
+
+  timerWheel_.cancel(found_node);
+  scheduleExpiry(found_node, entry.second.expiresAt_.load(std::memory_order_relaxed));
+
+  if (weight > maxWeight_) {
+    evict(found_node, current, evicted);
+    increment(Evictions);
+  }
+
+  evictExpired(current, evicted, EvictionBatch);
+  evictOverflow(current, evicted);
+  return evicted;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::link(HashMapValuePair& entry) {
+  ListNode* evicted{nullptr};
+  std::exception_ptr failure;
+
+  {
+    std::unique_lock<ListMutex> lock = lockList();
+    drainReadBuffer();
+
+    // linking and evicting under the same lock keeps size() within capacity() at any time.
+    Footprint current = footprint();
+    evictExpired(current, evicted, EvictionBatch);
+
+    try {
+      linkNode(entry, current, evicted);
+    } catch (...) {
+      // no node could be acquired, entry is not linked. Expired entries evicted above still are.
+      failure = std::current_exception();
+    }
+
+    evictOverflow(current, evicted);
+  }
+
+  releaseEvicted(evicted);
 
+  if (failure) {
+    // the insert has no effect.
+    eraseUnlinked(entry.first);
+    std::rethrow_exception(failure);
+  }
+}
+
+// ---- private member functions end ----
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::LRUCache(int size,
+                                                                                 size_t bucketCount,
+                                                                                 size_t maxWeight,
+                                                                                 const TAllocator& allocator)
+  : nodePool_(allocator),
+    capacity_(size),
+    maxWeight_(maxWeight),
+    hash_map_(bucketCount, HashMapAllocator(allocator)),
+    current_size_(0),
+    current_weight_(0) {
+  head_.prev_ = nullptr;
   head_.next_ = &tail_;
   tail_.prev_ = &head_;
-  current_size_ = 0;
+
+  if constexpr (Policy != EvictionPolicy::Clock) {
+    readBuffer_ = std::make_unique<ReadBuffer>(std::thread::hardware_concurrency());
+  }
+
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    tinyLfu_ = std::make_unique<TinyLfu>(size);
+  }
+
+  if constexpr (WithStats) {
+    stats_ = std::make_unique<StatsCounters>(std::thread::hardware_concurrency());
+  }
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::erase(const TKey& key) {
+  // fine-grained read lock for hash_map, held while unlinking so the entry can't be recycled meanwhile.
+  HashMapConstAccessor accessor;
+  if (!hash_map_.find(accessor, key)) {
+    return 0;
+  }
+
+  return eraseEntry(accessor);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::find(ConstAccessor& caccessor,
+                                                                                  const TKey& key) {
+  // fine-grained read lock on hash_map
+  if (!hash_map_.find(caccessor.constAccessor_, key) || isExpired(caccessor.constAccessor_->second)) {
+    caccessor.release();  // manual release, reference object can't count on RAII
+    increment(Misses);
+    return false;
+  }
+
+  // copy value from hash_map
+  caccessor.setValue();
+  increment(Hits);
+  touch(*caccessor.constAccessor_);
+  refreshIfNearExpiry(*caccessor.constAccessor_);
+
+  caccessor.constAccessor_.release();  // manual release, reference object can't count on RAII
+  return true;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::find(PinnedAccessor& paccessor,
+                                                                                  const TKey& key) {
+  // read lock on hash_map is kept by the accessor
+  if (!hash_map_.find(paccessor.constAccessor_, key)) {
+    increment(Misses);
+    return false;
+  }
+
+  if (isExpired(paccessor.constAccessor_->second)) {
+    paccessor.release();
+    increment(Misses);
+    return false;
+  }
+
+  increment(Hits);
+  touch(*paccessor.constAccessor_);
+  refreshIfNearExpiry(*paccessor.constAccessor_);
+  return true;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::find_many(const TKey* keys,
+                                                                                         size_t count,
+                                                                                         ConstAccessor* results) {
+  // nodes to promote, along with the key of the entry they were linked to while it was read-locked.
+  std::vector<std::pair<ListNode*, const TKey*>> hits;
+  if constexpr (Policy != EvictionPolicy::Clock) {
+    hits.reserve(count);
+  }
+
+  size_t found = 0;
+  for (size_t i = 0; i < count; ++i) {
+    ConstAccessor& caccessor = results[i];
+
+    // fine-grained read lock on hash_map
+    if (!hash_map_.find(caccessor.constAccessor_, keys[i]) || isExpired(caccessor.constAccessor_->second)) {
+      caccessor.release();  // manual release, reference object can't count on RAII
+      continue;
+    }
+
+    // copy value from hash_map
+    caccessor.setValue();
+    ++found;
+
+    const HashMapValuePair& entry = *caccessor.constAccessor_;
+    refreshIfNearExpiry(entry);
+    if constexpr (Policy == EvictionPolicy::Clock) {
+      touch(entry);
+    } else {
+      ListNode* found_node = entry.second.listNode_.load(std::memory_order_acquire);
+      if (found_node != nullptr) {
+        // promoted below under the list lock, have it in cache by then.
+        prefetch(found_node);
+        hits.emplace_back(found_node, &entry.first);
+      }
+    }
+
+    caccessor.constAccessor_.release();  // manual release, reference object can't count on RAII
+  }
+
+  increment(Hits, found);
+  increment(Misses, count - found);
+
+  if (!hits.empty()) {
+    std::unique_lock<ListMutex> lock = lockList();
+    drainReadBuffer();
+
+    for (const auto& [node, key] : hits) {
+      // Entries are no longer read-locked, a node may have been recycled meanwhile and is skipped.
+      // In the unlikely case its entry was erased and another one allocated at the same address,
+      // the other entry gets promoted, which only affects recency.
+      if (node->linkedTo(key)) {
+        promote(node);
+      }
+    }
+  }
+
+  return found;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename F>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::insertMany(const TKey* keys,
+                                                                                          const TValue* values,
+                                                                                          size_t count,
+                                                                                          F&& expiresAt) {
+  std::vector<HashMapValuePair*> entries;
+  entries.reserve(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    eraseIfExpired(keys[i]);
+
+    // fine-grained write lock for hash_map, one entry at a time.
+    HashMapAccessor accessor;
+    if (hash_map_.emplace(accessor,
+                          std::piecewise_construct,
+                          std::forward_as_tuple(keys[i]),
+                          std::forward_as_tuple(std::in_place, values[i]))) {
+      // entry stays valid after the write lock is released, until its node gets unlinked.
+      entries.push_back(&*accessor);
+      accessor->second.expiresAt_.store(expiresAt(i), std::memory_order_relaxed);
+      weigh(*accessor);
+    }
+  }
+
+  if (entries.empty()) {
+    return 0;
+  }
+
+  ListNode* evicted{nullptr};
+  size_t linked = 0;
+  std::exception_ptr failure;
+
+  {
+    std::unique_lock<ListMutex> lock = lockList();
+    drainReadBuffer();
+
+    Footprint current = footprint();
+    evictExpired(current, evicted, EvictionBatch);
+
+    try {
+      for (; linked < entries.size(); ++linked) {
+        linkNode(*entries[linked], current, evicted);
+      }
+    } catch (...) {
+      // pairs already linked stay in the cache, evictions below still keep size() within capacity().
+      failure = std::current_exception();
+    }
+
+    evictOverflow(current, evicted);
+  }
+
+  releaseEvicted(evicted);
+
+  if (failure) {
+    for (size_t i = linked; i < entries.size(); ++i) {
+      eraseUnlinked(entries[i]->first);
+    }
+    std::rethrow_exception(failure);
+  }
+
+  return entries.size();
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+int LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::trim(int maxCount) {
+  ListNode* evicted{nullptr};
+  int count = 0;
+
+  {
+    std::unique_lock<ListMutex> lock = lockList();
+    drainReadBuffer();
+
+    const Footprint current = footprint();
+    const int targetSize = std::max(capacity_.load(std::memory_order_relaxed), current.size_ - maxCount);
+    evictTo(current, targetSize, evicted);
+    count = current.size_ - current_size_.load(std::memory_order_relaxed);
+  }
+
+  releaseEvicted(evicted);
+  return count;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::expire(size_t maxCount) {
+  ListNode* evicted{nullptr};
+  size_t count = 0;
+
+  {
+    std::unique_lock<ListMutex> lock = lockList();
+    drainReadBuffer();
+
+    Footprint current = footprint();
+    count = evictExpired(current, evicted, maxCount);
+    setFootprint(current);
+  }
+
+  releaseEvicted(evicted);
+  return count;
 }
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+CacheStats LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::stats() const {
+  static_assert(WithStats, "stats() requires LRUCache instantiated WithStats");
+
+  CacheStats stats;
+  stats.hits_ = stats_->sum(Hits);
+  stats.misses_ = stats_->sum(Misses);
+  stats.loads_ = stats_->sum(Loads);
+  stats.evictions_ = stats_->sum(Evictions);
+  stats.expirations_ = stats_->sum(Expirations);
+  stats.deferredHits_ = stats_->sum(DeferredHits);
+  stats.droppedHits_ = stats_->sum(DroppedHits);
+  stats.lockContentions_ = stats_->sum(LockContentions);
+  return stats;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::clear() noexcept {
+  if (refreshAhead_ != nullptr) {
+    refreshAhead_->wait();
+  }
+
+  drainReadBuffer();
+  hash_map_.clear();
+
+  auto releaseAll = [this](ListNode* head, ListNode* tail) {
+    for (ListNode* node = head->next_; node != tail;) {
+      ListNode* next = node->next_;
+      unlink(node);
+      timerWheel_.cancel(node);
+      nodePool_.release(node);
+      node = next;
+    }
+  };
+
+  releaseAll(&head_, &tail_);
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    releaseAll(&tinyLfu_->probation_.head_, &tinyLfu_->probation_.tail_);
+    releaseAll(&tinyLfu_->protected_.head_, &tinyLfu_->protected_.tail_);
+  }
+
+  current_size_.store(0, std::memory_order_relaxed);
+  current_weight_.store(0, std::memory_order_relaxed);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::checkConsistency() {
+  drainReadBuffer();
+
+  int linked = 0;
+  size_t weight = 0;
+  auto checkList = [this, &linked, &weight](const ListNode* head, const ListNode* tail, Segment segment) {
+    int count = 0;
+    for (const ListNode* node = head->next_; node != tail; node = node->next_) {
+      if (node->next_ == nullptr || node->next_->prev_ != node || node->key_ == nullptr) {
+        return -1;
+      }
+      if (Policy == EvictionPolicy::WTinyLFU && node->segment_ != segment) {
+        return -1;
+      }
+
+      HashMapConstAccessor accessor;
+      if (!hash_map_.find(accessor, *node->key_) || &accessor->first != node->key_ ||
+          accessor->second.listNode_.load() != node) {
+        return -1;
+      }
+
+      weight += node->weight_;
+      ++count;
+    }
+    linked += count;
+    return count;
+  };
+
+  const int windowSize = checkList(&head_, &tail_, Window);
+  if (windowSize < 0) {
+    return false;
+  }
+  if constexpr (Policy == EvictionPolicy::WTinyLFU) {
+    if (windowSize != tinyLfu_->windowSize_ ||
+        checkList(&tinyLfu_->probation_.head_, &tinyLfu_->probation_.tail_, Probation) !=
+          tinyLfu_->probation_.size_ ||
+        checkList(&tinyLfu_->protected_.head_, &tinyLfu_->protected_.tail_, Protected) !=
+          tinyLfu_->protected_.size_) {
+      return false;
+    }
+  }
+
+  // linked nodes all refer to distinct entries, every entry is linked if there are as many.
+  const size_t entries = static_cast<size_t>(std::distance(hash_map_.begin(), hash_map_.end()));
+  return entries == static_cast<size_t>(linked) && linked == current_size_.load() &&
+         weight == current_weight_.load();
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename TSerializer>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::save(const std::string& path,
+                                                                                  const TSerializer& serializer) {
+  SnapshotWriter writer(path);
+  save(writer, serializer);
+  return writer.commit();
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename TSerializer>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::save(SnapshotWriter& writer,
+                                                                                    const TSerializer& serializer) {
+  size_t count = 0;
+
+  // values are copied under their hash-table read lock only, the list lock is released by then.
+  for (const TKey& key : hotKeys()) {
+    if (saveEntry(writer, key, serializer)) {
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename TSerializer>
+bool LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::saveEntry(SnapshotWriter& writer,
+                                                                                       const TKey& key,
+                                                                                       const TSerializer& serializer) {
+  HashMapConstAccessor accessor;
+  if (!hash_map_.find(accessor, key) || isExpired(accessor->second)) {
+    return false;
+  }
+
+  const int64_t expiresAt = accessor->second.expiresAt_.load(std::memory_order_relaxed);
+  const int64_t ttl = expiresAt == 0 ? 0 : std::max<int64_t>(expiresAt - clockNow(), 1);
+  return writer.append(key, accessor->second.value_, ttl, serializer);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename TSerializer>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::load(const std::string& path,
+                                                                                    const TSerializer& serializer) {
+  const SnapshotReader reader(path);
+  return load(reader, serializer);
+}
+
+template <class TKey, class TValue, class THash, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename TSerializer>
+size_t LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>::load(const SnapshotReader& reader,
+                                                                                    const TSerializer& serializer) {
+  const size_t maxCount = static_cast<size_t>(std::max(capacity(), 0));
+
+  std::vector<TKey> keys;
+  std::vector<TValue> values;
+  std::vector<Duration> ttls;
+  reader.forEachColdestFirst<TKey, TValue>(maxCount, serializer, [&](TKey&& key, TValue&& value, int64_t ttl) {
+    keys.push_back(std::move(key));
+    values.push_back(std::move(value));
+    ttls.push_back(std::chrono::nanoseconds(ttl));
+  });
+
+  // coldest first, the hottest entry is linked last under a single list lock acquisition.
+  return insert_many(keys.data(), values.data(), keys.size(), ttls.data());
+}
+
+/**
+ * ExpiryThread reclaims the expired entries of a cache from a background thread, calling
+ * cache.expire() every interval until no expired entry is left.
+ *
+ * Optional, inserts already reclaim expired entries a batch at a time. Works with any cache type
+ * providing expire(), e.g. LRUCache and ShardedLRUCache.
+ * The thread is stopped and joined on destruction, which must happen before the cache is destroyed.
+ *
+ */
+template <typename TCache>
+class ExpiryThread final {
+ public:
+  ExpiryThread(TCache& cache, std::chrono::milliseconds interval)
+    : thread_([this, &cache, interval] { run(cache, interval); }) {}
+
+  ~ExpiryThread() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+
+    wakeup_.notify_one();
+    thread_.join();
+  }
+
+  ExpiryThread(const ExpiryThread&) = delete;
+  ExpiryThread& operator=(const ExpiryThread&) = delete;
+
+ private:
+  void run(TCache& cache, std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wakeup_.wait_for(lock, interval, [this] { return stop_; })) {
+      lock.unlock();
+      while (cache.expire() > 0) {
+      }
+      lock.lock();
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  bool stop_{false};
+
+  // started last, once the members it uses are constructed.
+  std::thread thread_;
+};
 }  // namespace LRUC
@@ -0,0 +1,879 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// Types that will be inserted into the ConcurrentIntrusiveHashTable
+// must inherit from this template class.
+template <class T> class ConcurrentHashTableNode {
+public:
+  // Hash-table needs access to internal data of its nodes.
+  template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+  friend class ConcurrentIntrusiveHashTable;
+
+  // ConcurrentIntrusiveHashTable interface:
+  std::size_t getHashTableKeyHash() const {
+    return htKeyHash.load(std::memory_order_relaxed);
+  }
+  bool isLinkedToHashTable() const { return getHashTableKeyHash() != 0; }
+
+protected:
+  ConcurrentHashTableNode() : htNext(nullptr), htKeyHash(0) {}
+  ~ConcurrentHashTableNode() {}
+
+private:
+  // Next node in the bucket chain, read concurrently by lookups.
+  // Left as is on removal, lookups standing on the node carry on from it.
+  std::atomic<T *> htNext;
+
+  // Hash of the node's key.
+  // Zero only if not linked to a table.
+  std::atomic<std::size_t> htKeyHash;
+};
+
+// Thread-safe variant of IntrusiveHashTable, for indexes shared by many
+// threads and mostly read.
+//
+// Lookups take no lock: bucket heads and chain links are published with
+// release stores and read with acquire loads, and a lookup only announces
+// itself on a counter striped by thread, so readers never write a shared
+// cache line. They are not lock-free though: a lookup of a bucket being
+// migrated spins until that bucket is relinked, which a writer preempted in
+// the middle of a migration step, holding every stripe lock, delays for as
+// long as it is descheduled, along with every other writer. Writers lock the
+// stripe of the bucket they modify, thus insertions and removals in distinct
+// stripes proceed in parallel.
+//
+// Removed items are unlinked at once but lookups that started earlier may
+// still be traversing them, RCU style: do not destroy or re-insert an item
+// removed (or unlinked by clear()) before a subsequent synchronize() call
+// returned, which waits for such lookups to complete.
+//
+// The table grows past MaxLoadFactor items per bucket by publishing a bucket
+// array twice as large, then migrates the chains of the previous one a few
+// buckets at a time on each subsequent insertion or removal, as
+// IntrusiveHashTable does: no writer relinks the whole table. Lookups
+// meanwhile traverse the key's chain of both arrays. A lookup only retries if
+// a growth was published or the key's bucket was migrated meanwhile, which
+// takes relinking the few items of that bucket. The previous array, once
+// migrated, is freed by the next synchronize() call or by the destructor.
+//
+// Duplicate keys, item ownership and EQUAL/BUCKETS parameters are as with
+// IntrusiveHashTable.
+template <class K,                     // The key type
+          class V,                     // The mapped type (value)
+          class HASH = std::hash<K>,   // Hashes a key instance
+          class EQUAL = HashOnlyEqual, // Compares an item with a key
+          class BUCKETS = PrimeBuckets // Bucket count policy
+          >
+class ConcurrentIntrusiveHashTable {
+public:
+  // Nested typedefs:
+  using ValueType = V;
+  using KeyHasher = HASH;
+  using KeyEqual = EQUAL;
+  using BucketPolicy = BUCKETS;
+  using KeyType = typename std::remove_cv<K>::type;
+
+  // No copy or assignment:
+  ConcurrentIntrusiveHashTable(const ConcurrentIntrusiveHashTable &) = delete;
+  ConcurrentIntrusiveHashTable &
+  operator=(const ConcurrentIntrusiveHashTable &) = delete;
+
+  // Construct and allocate storage with num buckets hint.
+  explicit ConcurrentIntrusiveHashTable(bool allowDuplicateKeys,
+                                        std::size_t sizeHint = DefaultCapacity);
+
+  // Destructor clears the table and unlinks all items.
+  // Not thread-safe.
+  ~ConcurrentIntrusiveHashTable();
+
+  // Unlinks all items. Thread-safe, see synchronize() before reusing them.
+  void clear();
+
+  // Wait until the lookups in progress completed: items removed before the
+  // call are no longer traversed once it returns. Frees the bucket arrays
+  // retired by growths meanwhile.
+  // Thread-safe, blocks.
+  void synchronize();
+
+  // Test if empty.
+  bool isEmpty() const;
+
+  // Get size in items.
+  std::size_t getSize() const;
+
+  // Number of buckets allocated.
+  std::size_t getBucketCount() const;
+
+  // Get the "allow duplicate keys" flag, fixed at construction.
+  bool isAllowingDuplicateKeys() const;
+
+  // Access item by key. Returns null if key is not present.
+  // Thread-safe, takes no lock, blocks only on a bucket being migrated.
+  ValueType *find(const KeyType &key) const;
+
+  // Find all entries matching `key` in the table, see
+  // IntrusiveHashTable::findAllMatching().
+  // Thread-safe, takes no lock, blocks only on a bucket being migrated.
+  std::size_t findAllMatching(const KeyType &key, ValueType **items,
+                              std::size_t maxItems) const;
+
+  // Count number of items with the given key.
+  // Thread-safe, takes no lock, blocks only on a bucket being migrated.
+  std::size_t countAllMatching(const KeyType &key) const;
+
+  // Operator[] to access items by key (same as `find()`).
+  ValueType *operator[](const KeyType &key) const;
+
+  // Insertion. Fails in case of duplicate keys only when duplicate keys are
+  // being disallowed.
+  // Thread-safe, locks the stripe of the key's bucket.
+  bool insert(const KeyType &key, ValueType *value);
+
+  // Remove (unlink) single key/value pair. Returns a reference to the removed
+  // item. Null if no key found.
+  // Thread-safe, locks the stripe of the key's bucket.
+  ValueType *remove(const KeyType &key);
+
+  // Remove (unlink) all items matching the key. Returns number of items
+  // removed.
+  // Thread-safe, locks the stripe of the key's bucket.
+  std::size_t removeAllMatching(const KeyType &key);
+
+private:
+  // A prime number close to 2048, rounded up by the bucket policy.
+  static constexpr std::size_t DefaultCapacity = 2053;
+
+  // Average chain length that triggers growing.
+  static constexpr std::size_t MaxLoadFactor = 1;
+
+  // Number of writer locks and of reader counters, a power of two.
+  static constexpr std::size_t StripeCount = 64;
+
+  // Buckets of the previous array migrated per insertion or removal, under
+  // all stripe locks: enough to amortize taking them, few enough to bound
+  // the wait of other writers.
+  static constexpr std::size_t MigrationStep = 256;
+
+  // Cache-line size, stripes never share a line.
+  static constexpr std::size_t CacheLine = 64;
+
+  // Bucket heads, replaced as a whole on growth.
+  struct BucketArray {
+    explicit BucketArray(std::size_t count)
+        : heads(new std::atomic<ValueType *>[count]), count(count),
+          previous(nullptr), migration(0), retiredNext(nullptr) {
+      for (std::size_t bucket = 0; bucket < count; ++bucket) {
+        heads[bucket].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    ~BucketArray() { delete[] heads; }
+
+    std::atomic<ValueType *> *heads;
+    const std::size_t count;
+
+    // The array being migrated into this one, null once migrated.
+    std::atomic<BucketArray *> previous;
+
+    // Twice the number of buckets of `previous` migrated in index order, plus
+    // one while migrating the next. Written under all stripe locks.
+    std::atomic<std::size_t> migration;
+
+    std::size_t migrated() const {
+      return migration.load(std::memory_order_relaxed) / 2;
+    }
+
+    // Next array of the retired list, see retire().
+    BucketArray *retiredNext;
+  };
+
+  // Chains of a key's bucket locked by a writer, see lockChains().
+  struct Chains {
+    std::atomic<ValueType *> *current;
+    // Null unless the bucket of the previous array is not migrated yet.
+    std::atomic<ValueType *> *previous;
+  };
+
+  // Writer lock of the buckets whose index is congruent to the stripe's.
+  struct alignas(CacheLine) WriterStripe {
+    std::mutex mutex;
+  };
+
+  // Lookups in progress per phase, see synchronize().
+  struct alignas(CacheLine) ReaderStripe {
+    std::atomic<std::size_t> counts[2] = {};
+  };
+
+  // RAII announcement of a lookup.
+  class ReadSection {
+  public:
+    explicit ReadSection(const ConcurrentIntrusiveHashTable &table);
+    ~ReadSection();
+
+    ReadSection(const ReadSection &) = delete;
+    ReadSection &operator=(const ReadSection &) = delete;
+
+  private:
+    std::atomic<std::size_t> &count;
+  };
+
+  // Internal helpers:
+  std::size_t hashOf(const KeyType &key) const;
+  static bool isMatch(const ValueType *item, std::size_t keyHash,
+                      const KeyType &key);
+  static std::size_t readerSlot();
+
+  // Call `fn(item)` on the items matching `key` while it returns true,
+  // retrying if a growth or a migration raced the traversal. `restart()` is
+  // called before each retry, which reports the matches again: callers
+  // accumulating them start over. Caller holds a ReadSection.
+  template <class FN, class RESTART>
+  void forEachMatch(std::size_t keyHash, const KeyType &key, FN &&fn,
+                    RESTART &&restart) const;
+
+  // Lock the writer stripes of the buckets of `keyHash` in the current
+  // array and, while migrating, in the previous one, return their chain
+  // heads. No array can be replaced or migrated until the locks are released.
+  Chains lockChains(std::size_t keyHash, std::unique_lock<std::mutex> &lock,
+                    std::unique_lock<std::mutex> &previousLock);
+
+  // Unlink `item` following `previous` (null if the chain head).
+  void unlink(std::atomic<ValueType *> *chain, ValueType *previous,
+              ValueType *item);
+
+  void growIfNeeded();
+
+  // Migrate up to `maxBuckets` buckets of the previous array, if any.
+  void migrateBuckets(std::size_t maxBuckets);
+
+  // Same, all stripe locks held.
+  void migrateLocked(BucketArray *array, std::size_t maxBuckets);
+
+  // Move the items of the next bucket of `previous` to their chain in
+  // `array`.
+  static void migrateBucket(BucketArray *array, BucketArray *previous);
+
+  // Queue a migrated array to be freed by synchronize().
+  void retire(BucketArray *array);
+
+  static void freeArrays(BucketArray *arrays);
+
+  void lockAllStripes();
+  void unlockAllStripes();
+
+  // Current bucket array, read by lookups.
+  std::atomic<BucketArray *> buckets;
+
+  // True while the current array has a previous one, checked by writers
+  // before taking any lock.
+  std::atomic<bool> migrating;
+
+  // Migrated arrays lookups may still traverse, linked through `retiredNext`.
+  std::atomic<BucketArray *> retired;
+
+  std::atomic<std::size_t> usedBuckets;
+  const bool allowDupKeys;
+
+  // Writers of each stripe of buckets:
+  WriterStripe writerStripes[StripeCount];
+
+  // Lookups of each stripe of threads, for the current and previous phase:
+  mutable ReaderStripe readerStripes[StripeCount];
+  std::atomic<unsigned> readerPhase;
+
+  // Serializes synchronize() calls.
+  std::mutex synchronizeMutex;
+};
+
+//
+// Inline implementation of ConcurrentIntrusiveHashTable:
+//
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::ReadSection::
+    ReadSection(const ConcurrentIntrusiveHashTable &table)
+    : count(table.readerStripes[readerSlot()].counts
+                [table.readerPhase.load(std::memory_order_relaxed)]) {
+  count.fetch_add(1, std::memory_order_relaxed);
+  // Pairs with the fence of synchronize(): either it sees this lookup, or
+  // the lookup sees every unlink published before it.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::ReadSection::
+    ~ReadSection() {
+  count.fetch_sub(1, std::memory_order_release);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::
+    ConcurrentIntrusiveHashTable(const bool allowDuplicateKeys,
+                                 const std::size_t sizeHint)
+    : buckets(new BucketArray(BucketPolicy::roundUp(sizeHint))),
+      migrating(false), retired(nullptr), usedBuckets(0),
+      allowDupKeys(allowDuplicateKeys), readerPhase(0) {}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL,
+                             BUCKETS>::~ConcurrentIntrusiveHashTable() {
+  clear();
+  freeArrays(retired.load(std::memory_order_relaxed));
+  delete buckets.load(std::memory_order_relaxed);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::clear() {
+  lockAllStripes();
+
+  auto unlinkAll = [](BucketArray *array, const std::size_t firstBucket) {
+    for (std::size_t bucket = firstBucket; bucket < array->count; ++bucket) {
+      ValueType *item = array->heads[bucket].load(std::memory_order_relaxed);
+      array->heads[bucket].store(nullptr, std::memory_order_release);
+
+      // Chain links are kept for lookups standing on the items:
+      for (; item != nullptr;
+           item = item->htNext.load(std::memory_order_relaxed)) {
+        item->htKeyHash.store(0, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  // Emptied buckets of the previous array are migrated at no cost:
+  BucketArray *array = buckets.load(std::memory_order_relaxed);
+  if (BucketArray *previous = array->previous.load(std::memory_order_relaxed)) {
+    unlinkAll(previous, array->migrated());
+    migrateLocked(array, previous->count);
+  }
+  unlinkAll(array, 0);
+
+  usedBuckets.store(0, std::memory_order_relaxed);
+  unlockAllStripes();
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::synchronize() {
+  std::lock_guard<std::mutex> lock(synchronizeMutex);
+
+  // Arrays retired by now are no longer reachable from `buckets`, only
+  // lookups in progress may still traverse them.
+  BucketArray *const arrays =
+      retired.exchange(nullptr, std::memory_order_acquire);
+
+  // Pairs with the fence of ReadSection, see there.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  auto waitForReaders = [this](const unsigned phase) {
+    for (const ReaderStripe &stripe : readerStripes) {
+      while (stripe.counts[phase].load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  // New lookups count in the other phase, so that the current one drains
+  // even under a steady flow of lookups. Lookups of the other phase still
+  // in progress started before the previous call flipped it: wait for them
+  // first.
+  const unsigned phase = readerPhase.load(std::memory_order_relaxed);
+  waitForReaders(phase ^ 1);
+  readerPhase.store(phase ^ 1, std::memory_order_seq_cst);
+  waitForReaders(phase);
+
+  freeArrays(arrays);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+bool ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::isEmpty() const {
+  return getSize() == 0;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+std::size_t
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::getSize() const {
+  return usedBuckets.load(std::memory_order_relaxed);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+std::size_t
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::getBucketCount()
+    const {
+  const ReadSection section(*this);
+  return buckets.load(std::memory_order_acquire)->count;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+bool ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL,
+                                  BUCKETS>::isAllowingDuplicateKeys() const {
+  return allowDupKeys;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+typename ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::ValueType *
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::find(
+    const KeyType &key) const {
+  const ReadSection section(*this);
+
+  ValueType *found = nullptr;
+  forEachMatch(
+      hashOf(key), key,
+      [&found](ValueType *item) {
+        found = item;
+        return false;
+      },
+      [&found] { found = nullptr; });
+
+  return found;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+std::size_t
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::findAllMatching(
+    const KeyType &key, ValueType **items, const std::size_t maxItems) const {
+  assert(items != nullptr);
+  assert(maxItems != 0);
+
+  const ReadSection section(*this);
+
+  std::size_t foundCount = 0;
+  forEachMatch(
+      hashOf(key), key,
+      [&](ValueType *item) {
+        items[foundCount++] = item;
+        return foundCount != maxItems;
+      },
+      [&foundCount] { foundCount = 0; });
+
+  return foundCount;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+std::size_t
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::countAllMatching(
+    const KeyType &key) const {
+  const ReadSection section(*this);
+
+  std::size_t foundCount = 0;
+  forEachMatch(
+      hashOf(key), key,
+      [&foundCount](ValueType *) {
+        ++foundCount;
+        return true;
+      },
+      [&foundCount] { foundCount = 0; });
+
+  return foundCount;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+typename ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::ValueType *
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::operator[](
+    const KeyType &key) const {
+  return find(key);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+bool ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::insert(
+    const KeyType &key, ValueType *value) {
+  assert(value != nullptr);
+  assert(!value->isLinkedToHashTable());
+
+  const std::size_t keyHash = hashOf(key);
+  {
+    std::unique_lock<std::mutex> lock;
+    std::unique_lock<std::mutex> previousLock;
+    const Chains chains = lockChains(keyHash, lock, previousLock);
+    std::atomic<ValueType *> *chain = chains.current;
+    ValueType *head = chain->load(std::memory_order_relaxed);
+
+    // If disallowing duplicate keys we must scan the chains
+    // and make sure no key with the same name already exists.
+    if (!isAllowingDuplicateKeys()) {
+      for (std::atomic<ValueType *> *scanned : {chains.previous, chain}) {
+        if (scanned == nullptr) {
+          continue;
+        }
+        for (ValueType *item = scanned->load(std::memory_order_relaxed);
+             item != nullptr;
+             item = item->htNext.load(std::memory_order_relaxed)) {
+          if (isMatch(item, keyHash, key)) {
+            return false; // This specific key is already in use, fail.
+          }
+        }
+      }
+    }
+
+    // Make the new value head of the chain, published once linked:
+    value->htKeyHash.store(keyHash, std::memory_order_relaxed);
+    value->htNext.store(head, std::memory_order_relaxed);
+    chain->store(value, std::memory_order_release);
+  }
+
+  usedBuckets.fetch_add(1, std::memory_order_relaxed);
+  growIfNeeded();
+  return true;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+typename ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::ValueType *
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::remove(
+    const KeyType &key) {
+  const std::size_t keyHash = hashOf(key);
+  ValueType *removed = nullptr;
+  {
+    std::unique_lock<std::mutex> lock;
+    std::unique_lock<std::mutex> previousLock;
+    const Chains chains = lockChains(keyHash, lock, previousLock);
+
+    for (std::atomic<ValueType *> *chain : {chains.previous, chains.current}) {
+      if (chain == nullptr || removed != nullptr) {
+        continue;
+      }
+
+      ValueType *previous = nullptr;
+      for (ValueType *item = chain->load(std::memory_order_relaxed);
+           item != nullptr;
+           item = item->htNext.load(std::memory_order_relaxed)) {
+        if (isMatch(item, keyHash, key)) {
+          unlink(chain, previous, item);
+          removed = item;
+          break;
+        }
+        previous = item;
+      }
+    }
+  }
+
+  migrateBuckets(MigrationStep);
+  return removed;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+std::size_t
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::removeAllMatching(
+    const KeyType &key) {
+  const std::size_t keyHash = hashOf(key);
+  std::size_t removedCount = 0;
+  {
+    std::unique_lock<std::mutex> lock;
+    std::unique_lock<std::mutex> previousLock;
+    const Chains chains = lockChains(keyHash, lock, previousLock);
+
+    for (std::atomic<ValueType *> *chain : {chains.previous, chains.current}) {
+      if (chain == nullptr) {
+        continue;
+      }
+
+      ValueType *previous = nullptr;
+      for (ValueType *item = chain->load(std::memory_order_relaxed);
+           item != nullptr;) {
+        // The link of an unlinked item still leads to the rest of the chain:
+        ValueType *nextItem = item->htNext.load(std::memory_order_relaxed);
+        if (isMatch(item, keyHash, key)) {
+          unlink(chain, previous, item);
+          ++removedCount;
+        } else {
+          previous = item;
+        }
+        item = nextItem;
+      }
+    }
+  }
+
+  migrateBuckets(MigrationStep);
+  return removedCount;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+std::size_t ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::hashOf(
+    const KeyType &key) const {
+  const std::size_t keyHash = KeyHasher()(key);
+  if (keyHash != 0) {
+    return keyHash;
+  }
+
+  // Zero marks unlinked items, see IntrusiveHashTable::hashOf():
+  assert(!(std::is_same<EQUAL, HashOnlyEqual>::value) &&
+         "Null hash indexes not allowed!");
+  return 1;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+bool ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::isMatch(
+    const ValueType *item, const std::size_t keyHash, const KeyType &key) {
+  // Hashes first, a cheap filter ahead of key comparisons:
+  return keyHash == item->htKeyHash.load(std::memory_order_relaxed) &&
+         KeyEqual()(*item, key);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+std::size_t
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::readerSlot() {
+  // Threads take slots round-robin, on first use.
+  static std::atomic<std::size_t> nextSlot{0};
+  thread_local const std::size_t slot =
+      nextSlot.fetch_add(1, std::memory_order_relaxed) & (StripeCount - 1);
+  return slot;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+template <class FN, class RESTART>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::forEachMatch(
+    const std::size_t keyHash, const KeyType &key, FN &&fn,
+    RESTART &&restart) const {
+  // False if `fn` stopped the traversal.
+  auto visit = [&](const std::atomic<ValueType *> &head) {
+    for (ValueType *item = head.load(std::memory_order_acquire);
+         item != nullptr;
+         item = item->htNext.load(std::memory_order_acquire)) {
+      if (isMatch(item, keyHash, key) && !fn(item)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  for (;;) {
+    const BucketArray *array = buckets.load(std::memory_order_acquire);
+    const BucketArray *previous =
+        array->previous.load(std::memory_order_acquire);
+
+    // Seqlock read side on the key's bucket of the previous array, the
+    // chain of which is traversed first until migrated:
+    std::size_t previousBucket = 0;
+    bool unmigrated = false;
+    if (previous != nullptr) {
+      previousBucket = BucketPolicy::indexOf(keyHash, previous->count);
+      const std::size_t migration =
+          array->migration.load(std::memory_order_acquire);
+      if (migration == 2 * previousBucket + 1) {
+        // Its items are being relinked:
+        std::this_thread::yield();
+        continue;
+      }
+      unmigrated = migration < 2 * previousBucket + 1;
+    }
+
+    if (!unmigrated || visit(previous->heads[previousBucket])) {
+      visit(array->heads[BucketPolicy::indexOf(keyHash, array->count)]);
+    }
+
+    // Unless the bucket got migrated or a growth started migrating `array`
+    // meanwhile, the chains were complete and no item was reported twice:
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (buckets.load(std::memory_order_relaxed) == array &&
+        (!unmigrated || array->migration.load(std::memory_order_relaxed) <
+                            2 * previousBucket + 1)) {
+      return;
+    }
+    restart();
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+typename ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::Chains
+ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::lockChains(
+    const std::size_t keyHash, std::unique_lock<std::mutex> &lock,
+    std::unique_lock<std::mutex> &previousLock) {
+  for (;;) {
+    // Like lookups, the arrays can't be freed until locked and checked.
+    const ReadSection section(*this);
+    BucketArray *array = buckets.load(std::memory_order_acquire);
+    BucketArray *previous = array->previous.load(std::memory_order_acquire);
+    const std::size_t bucket = BucketPolicy::indexOf(keyHash, array->count);
+    const std::size_t previousBucket =
+        previous != nullptr ? BucketPolicy::indexOf(keyHash, previous->count)
+                            : bucket;
+
+    // In index order, like lockAllStripes():
+    std::size_t first = bucket & (StripeCount - 1);
+    std::size_t second = previousBucket & (StripeCount - 1);
+    if (second < first) {
+      std::swap(first, second);
+    }
+    lock = std::unique_lock<std::mutex>(writerStripes[first].mutex);
+    if (second != first) {
+      previousLock = std::unique_lock<std::mutex>(writerStripes[second].mutex);
+    }
+
+    // Growth and migration hold every stripe lock: if the array is still
+    // current, it stays so while locked. Its previous one may have been
+    // migrated meanwhile, never replaced.
+    if (buckets.load(std::memory_order_relaxed) == array) {
+      Chains chains{&array->heads[bucket], nullptr};
+      if (array->previous.load(std::memory_order_relaxed) != nullptr &&
+          previousBucket >= array->migrated()) {
+        chains.previous = &previous->heads[previousBucket];
+      }
+      return chains;
+    }
+
+    lock.unlock();
+    if (previousLock.owns_lock()) {
+      previousLock.unlock();
+    }
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::unlink(
+    std::atomic<ValueType *> *chain, ValueType *previous, ValueType *item) {
+  ValueType *nextItem = item->htNext.load(std::memory_order_relaxed);
+  if (previous != nullptr) {
+    // Not the head of the chain, remove from middle:
+    previous->htNext.store(nextItem, std::memory_order_release);
+  } else {
+    chain->store(nextItem, std::memory_order_release);
+  }
+
+  item->htKeyHash.store(0, std::memory_order_relaxed);
+  usedBuckets.fetch_sub(1, std::memory_order_relaxed);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::growIfNeeded() {
+  migrateBuckets(MigrationStep);
+
+  const std::size_t bucketCount = getBucketCount();
+  if (getSize() <= bucketCount * MaxLoadFactor) {
+    return;
+  }
+
+  // Allocated before locking, other writers only wait for the publication.
+  std::unique_ptr<BucketArray> newArray(
+      new BucketArray(BucketPolicy::roundUp(bucketCount * 2)));
+
+  lockAllStripes();
+
+  // Another writer may have grown the table meanwhile.
+  BucketArray *array = buckets.load(std::memory_order_relaxed);
+  if (array->count != bucketCount ||
+      getSize() <= array->count * MaxLoadFactor) {
+    unlockAllStripes();
+    return;
+  }
+
+  // Only when inserting faster than migrating:
+  if (BucketArray *previous = array->previous.load(std::memory_order_relaxed)) {
+    migrateLocked(array, previous->count);
+  }
+
+  // Lookups traverse the chains of both arrays from now on, writers migrate
+  // the old ones:
+  newArray->previous.store(array, std::memory_order_relaxed);
+  migrating.store(true, std::memory_order_relaxed);
+  buckets.store(newArray.release(), std::memory_order_release);
+  unlockAllStripes();
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::migrateBuckets(
+    const std::size_t maxBuckets) {
+  if (!migrating.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  lockAllStripes();
+  migrateLocked(buckets.load(std::memory_order_relaxed), maxBuckets);
+  unlockAllStripes();
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::migrateLocked(
+    BucketArray *const array, const std::size_t maxBuckets) {
+  BucketArray *const previous = array->previous.load(std::memory_order_relaxed);
+  if (previous == nullptr) {
+    return;
+  }
+
+  const std::size_t lastBucket =
+      previous->count - array->migrated() > maxBuckets
+          ? array->migrated() + maxBuckets
+          : previous->count;
+  while (array->migrated() < lastBucket) {
+    migrateBucket(array, previous);
+  }
+
+  if (array->migrated() == previous->count) {
+    array->previous.store(nullptr, std::memory_order_release);
+    migrating.store(false, std::memory_order_relaxed);
+    retire(previous);
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::migrateBucket(
+    BucketArray *const array, BucketArray *const previous) {
+  const std::size_t bucket = array->migrated();
+
+  // Seqlock write side: lookups that observe a relinked item observe the odd
+  // migration, then retry.
+  array->migration.store(2 * bucket + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  // Move each item of the chain to the head of its new chain. Items of
+  // duplicate keys end up in the same new chain again:
+  ValueType *item = previous->heads[bucket].load(std::memory_order_relaxed);
+  previous->heads[bucket].store(nullptr, std::memory_order_relaxed);
+  while (item != nullptr) {
+    ValueType *nextItem = item->htNext.load(std::memory_order_relaxed);
+    std::atomic<ValueType *> &head = array->heads[BucketPolicy::indexOf(
+        item->htKeyHash.load(std::memory_order_relaxed), array->count)];
+    item->htNext.store(head.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+    head.store(item, std::memory_order_release);
+    item = nextItem;
+  }
+
+  array->migration.store(2 * bucket + 2, std::memory_order_release);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::retire(
+    BucketArray *const array) {
+  // synchronize() takes the whole list at once, no ABA:
+  BucketArray *head = retired.load(std::memory_order_relaxed);
+  do {
+    array->retiredNext = head;
+  } while (!retired.compare_exchange_weak(
+      head, array, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS>::freeArrays(
+    BucketArray *arrays) {
+  while (arrays != nullptr) {
+    BucketArray *next = arrays->retiredNext;
+    delete arrays;
+    arrays = next;
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL,
+                                  BUCKETS>::lockAllStripes() {
+  // In index order, concurrent callers can't deadlock.
+  for (WriterStripe &stripe : writerStripes) {
+    stripe.mutex.lock();
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS>
+void ConcurrentIntrusiveHashTable<K, V, HASH, EQUAL,
+                                  BUCKETS>::unlockAllStripes() {
+  for (WriterStripe &stripe : writerStripes) {
+    stripe.mutex.unlock();
+  }
+}
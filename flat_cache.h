@@ -0,0 +1,555 @@
+#pragma once
+
+#include "cache.h"
+
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/concurrent_hash_map.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+namespace LRUC {
+
+/**
+ * FlatEntryMaxSize is the largest key or value FlatLRUCache stores, in bytes.
+ *
+ */
+inline constexpr size_t FlatEntryMaxSize = 16;
+
+/**
+ * IsFlatCacheable is true if FlatLRUCache can store TKey/TValue: trivially copyable types of at most
+ * FlatEntryMaxSize bytes each, both DefaultConstructible.
+ *
+ */
+template <typename TKey, typename TValue>
+inline constexpr bool IsFlatCacheable = std::is_trivially_copyable_v<TKey> && sizeof(TKey) <= FlatEntryMaxSize &&
+                                        std::is_default_constructible_v<TKey> &&
+                                        std::is_trivially_copyable_v<TValue> && sizeof(TValue) <= FlatEntryMaxSize &&
+                                        std::is_default_constructible_v<TValue>;
+
+/**
+ * FlatLRUCache is a thread-safe set-associative LRU cache of small trivially copyable keys and values.
+ *
+ * Entries are stored in place in a flat array of sets, neither hash-table nodes nor list nodes: a key
+ * hashes to a single set of Ways slots, a set spanning as many cache lines as words per slot, all of
+ * its keys, values and recency metadata on them. int->int is 6 ways in a 64 bytes set, about 11 bytes
+ * per entry.
+ *
+ * Every set is guarded by a seqlock: find() copies the slot out without writing to the set unless
+ * the hit changes its recency, and retries if a writer modified the set meanwhile. insert() and
+ * erase() lock the set alone, threads working on different sets never contend.
+ *
+ * Eviction is per set: inserting an absent key into a full set evicts the least recently used key of
+ * that set, which is not necessarily the least recently used key of the whole cache, and may happen
+ * before size() reaches capacity(). Recency is an 8-bit stamp per slot: the set's insert count when
+ * the key was last inserted or found. Ages are exact up to 127 inserts into the set: every 128 inserts,
+ * older stamps are brought back to that age so that they never wrap around to the youngest. Such keys
+ * then age together, the first of equally old keys in way order is evicted.
+ *
+ * The interface is the subset of LRUCache's without TTL, weights, pinning nor snapshots(ConstAccessor,
+ * find(), insert(), insert_or_assign(), erase(), clear(), size(), capacity()), see LRUCacheFor.
+ *
+ * TAllocator backs the sets, rebound to them: it must honor their CacheLineSize alignment, as the
+ * default tbb::cache_aligned_allocator and std::allocator do.
+ *
+ * Type concepts:
+ * TKey and TValue satisfy IsFlatCacheable.
+ * TKey type requires TBB::HashCompare concept.
+ * TAllocator type requires Allocator concept, rebindable to any type.
+ *
+ * FlatLRUCache is C++17 compatible
+ *
+ */
+
+template <typename TKey,
+          typename TValue,
+          typename THash = tbb::tbb_hash_compare<TKey>,
+          typename TAllocator = tbb::cache_aligned_allocator<TValue>>
+class FlatLRUCache final {
+  static_assert(IsFlatCacheable<TKey, TValue>,
+                "FlatLRUCache requires trivially copyable keys and values of at most FlatEntryMaxSize bytes");
+
+ private:
+  // type defs
+  using Word = uint64_t;
+
+ private:
+  // static data members
+  // a slot packs the key, then the value, into words read and written with relaxed atomics.
+  static constexpr size_t SlotWords = (sizeof(TKey) + sizeof(TValue) + sizeof(Word) - 1) / sizeof(Word);
+
+  // set size budget, a line per word of a slot. At least 64 bytes whatever LRUC_CACHELINE_SIZE.
+  static constexpr size_t SetSize = std::max<size_t>(CacheLineSize, 64) * SlotWords;
+
+  // size of the set header holding ways slots: sequence, occupancy, tick, stamps, padded to a word.
+  static constexpr size_t headerSize(size_t ways) {
+    return (sizeof(uint32_t) + sizeof(uint16_t) + 1 + ways + sizeof(Word) - 1) / sizeof(Word) * sizeof(Word);
+  }
+
+  static constexpr size_t waysPerSet() {
+    size_t ways = 16;
+    while (ways > 1 && headerSize(ways) + ways * SlotWords * sizeof(Word) > SetSize) {
+      --ways;
+    }
+
+    return ways;
+  }
+
+ public:
+  /**
+   * Ways is the number of slots per set.
+   *
+   */
+  static constexpr size_t Ways = waysPerSet();
+
+ private:
+  /**
+   * Set is the unit of associativity and of locking.
+   *
+   * sequence_ is the seqlock: odd while a writer modifies occupied_ or words_. tick_ and stamps_ are
+   * outside of it, recency is written by readers and a stale stamp only costs accuracy.
+   *
+   */
+  struct alignas(CacheLineSize) Set final {
+    std::atomic<uint32_t> sequence_{0};
+    std::atomic<uint16_t> occupied_{0};  // bit per way holding a key
+    std::atomic<uint8_t> tick_{0};       // incremented by every insert into the set
+    std::atomic<uint8_t> stamps_[Ways]{};
+    std::atomic<Word> words_[Ways][SlotWords]{};
+  };
+
+  static_assert(sizeof(Set) <= SetSize, "FlatLRUCache set exceeds its size budget");
+
+  using AllocatorTraits = std::allocator_traits<TAllocator>;
+  using SetAllocator = typename AllocatorTraits::template rebind_alloc<Set>;
+  using SetTraits = std::allocator_traits<SetAllocator>;
+
+ private:
+  // data members
+  THash hasher_;
+  SetAllocator allocator_;
+  const size_t setCount_;
+  const unsigned setShift_;  // 32 - log2(setCount_), at most 2^32 sets
+  Set* const sets_;
+
+  alignas(CacheLineSize) std::atomic<int> current_size_{0};
+
+ private:
+  /**
+   * Set of hash, Fibonacci hashing: the top bits of the product, so that poor low-order bits still spread.
+   *
+   */
+  Set& setOf(size_t hash) const {
+    return sets_[((static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull) >> 32) >> setShift_];
+  }
+
+  /**
+   * Wait for a writer of the set, yielding past a few spins, which also lets a preempted writer run.
+   *
+   */
+  static void backoff(int spins) {
+    if (spins >= 16) {
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * Lock set for writing, making its sequence odd.
+   *
+   */
+  static void lock(Set& set);
+
+  static void unlock(Set& set) {
+    set.sequence_.store(set.sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  /**
+   * Way of set holding key, -1 if none. words receives the slot found.
+   * Either set is locked, or the result is only used once the reader's sequence is checked: keys are
+   * then compared while possibly torn, which is harmless for trivially copyable types.
+   *
+   */
+  int findWay(const Set& set, const TKey& key, Word (&words)[SlotWords]) const;
+
+  /**
+   * Way of set to insert a new key in, an empty one or else the least recently used. Set is locked.
+   *
+   */
+  static size_t victimWay(const Set& set);
+
+  // ages kept exact, older ones brought back to it every MaxAge + 1 inserts into a set: never above 255.
+  static constexpr uint8_t MaxAge = 127;
+
+  /**
+   * Bring the stamps of set older than MaxAge back to it, tick being a multiple of MaxAge + 1.
+   * Called under the set lock, a racing touch() only costs accuracy.
+   *
+   */
+  static void clampAges(Set& set, uint8_t tick);
+
+  // record a hit on way of set, written only if it changes the stamp so that hits keep the line shared.
+  static void touch(Set& set, size_t way) {
+    const uint8_t tick = set.tick_.load(std::memory_order_relaxed);
+    if (set.stamps_[way].load(std::memory_order_relaxed) != tick) {
+      set.stamps_[way].store(tick, std::memory_order_relaxed);
+    }
+  }
+
+  static TKey keyOf(const Word (&words)[SlotWords]) {
+    TKey key;
+    std::memcpy(static_cast<void*>(&key), words, sizeof(TKey));
+    return key;
+  }
+
+  static TValue valueOf(const Word (&words)[SlotWords]) {
+    TValue value;
+    std::memcpy(static_cast<void*>(&value), reinterpret_cast<const char*>(words) + sizeof(TKey), sizeof(TValue));
+    return value;
+  }
+
+  /**
+   * Insert key/value, or assign value if key exists and Assign. Return true if key was inserted.
+   *
+   */
+  template <bool Assign>
+  bool put(const TKey& key, const TValue& value);
+
+ public:
+  /**
+   * ConstAccessor stores a copy of the value found, the same role as LRUCache::ConstAccessor.
+   *
+   */
+  struct ConstAccessor final {
+    constexpr ConstAccessor() = default;
+    constexpr ConstAccessor(const ConstAccessor&) = delete;
+
+    constexpr const TValue& operator*() const {
+      return *get();
+    }
+
+    constexpr const TValue* operator->() const {
+      return get();
+    }
+
+    // true if the accessor holds no value, e.g. the last find() missed.
+    constexpr bool empty() const {
+      return !hasValue_;
+    }
+
+    constexpr const TValue* get() const {
+      return &value_;
+    }
+
+    constexpr void release() {
+      hasValue_ = false;
+    }
+
+   private:
+    friend class FlatLRUCache;  // for FlatLRUCache member function to set the value
+    TValue value_{};
+    bool hasValue_{false};
+  };
+
+  /**
+   * size: minimal capacity of the cache, rounded up to a power of two number of sets, see capacity().
+   *
+   * allocator: copied, rebound to the sets.
+   */
+  explicit FlatLRUCache(int size, const TAllocator& allocator = TAllocator());
+
+  ~FlatLRUCache() noexcept;
+
+  FlatLRUCache(const FlatLRUCache& other) = delete;
+  FlatLRUCache& operator=(const FlatLRUCache&) = delete;
+
+  /**
+   * erase removes key from FlatLRUCache along with its value.
+   * returns number of elements removed (0 or 1).
+   *
+   */
+  size_t erase(const TKey& key);
+
+  /**
+   * find finds data inside the set of key.
+   * ConstAccessor stores a copy of the found result.
+   * Return true if key exist, otherwise false.
+   *
+   * find updates key access frequency, takes no lock.
+   *
+   */
+  bool find(ConstAccessor& ac, const TKey& key) const;
+
+  /**
+   * insert key/value into cache. Both key and value is copied into the cache.
+   * insert updates key access frequency.
+   *
+   * If key already exists in the cache, the value will not be updated and return
+   * false. Otherwise, return true, the least recently used key of the set being evicted if it is full.
+   *
+   */
+  bool insert(const TKey& key, const TValue& value) {
+    return put<false>(key, value);
+  }
+
+  /**
+   * insert_or_assign inserts key/value into cache, or assigns value to the existing key.
+   * Return true if inserted, false if assigned.
+   *
+   */
+  bool insert_or_assign(const TKey& key, const TValue& value) {
+    return put<true>(key, value);
+  }
+
+  /**
+   * clear erases all elements from the container.
+   * Thread-safe, set by set: keys inserted meanwhile into sets already cleared are kept.
+   *
+   */
+  void clear() noexcept;
+
+  /**
+   * size returns the current cache size.
+   *
+   */
+  int size() const {
+    return current_size_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * capacity returns the cache capacity, Ways per set.
+   *
+   */
+  int capacity() const {
+    return static_cast<int>(setCount_ * Ways);
+  }
+};
+
+// ---- private member functions ----
+template <class TKey, class TValue, class THash, class TAllocator>
+void FlatLRUCache<TKey, TValue, THash, TAllocator>::lock(Set& set) {
+  for (int spins = 0;; ++spins) {
+    uint32_t sequence = set.sequence_.load(std::memory_order_relaxed);
+    if ((sequence & 1) == 0 &&
+        set.sequence_.compare_exchange_weak(sequence, sequence + 1, std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+      // orders the odd sequence before the slot writes, for readers checking it after their copy.
+      std::atomic_thread_fence(std::memory_order_release);
+      return;
+    }
+
+    backoff(spins);
+  }
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+int FlatLRUCache<TKey, TValue, THash, TAllocator>::findWay(const Set& set,
+                                                          const TKey& key,
+                                                          Word (&words)[SlotWords]) const {
+  const uint16_t occupied = set.occupied_.load(std::memory_order_relaxed);
+  for (size_t way = 0; way < Ways; ++way) {
+    if ((occupied & (1u << way)) == 0) {
+      continue;
+    }
+
+    for (size_t i = 0; i < SlotWords; ++i) {
+      words[i] = set.words_[way][i].load(std::memory_order_relaxed);
+    }
+
+    if (hasher_.equal(keyOf(words), key)) {
+      return static_cast<int>(way);
+    }
+  }
+
+  return -1;
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+size_t FlatLRUCache<TKey, TValue, THash, TAllocator>::victimWay(const Set& set) {
+  const uint16_t occupied = set.occupied_.load(std::memory_order_relaxed);
+  const uint8_t tick = set.tick_.load(std::memory_order_relaxed);
+
+  // ties go to the first way, a later one only wins by being strictly older.
+  size_t victim = 0;
+  uint8_t oldest = 0;
+  for (size_t way = 0; way < Ways; ++way) {
+    if ((occupied & (1u << way)) == 0) {
+      return way;
+    }
+
+    const uint8_t age = static_cast<uint8_t>(tick - set.stamps_[way].load(std::memory_order_relaxed));
+    if (age > oldest) {
+      victim = way;
+      oldest = age;
+    }
+  }
+
+  return victim;
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+void FlatLRUCache<TKey, TValue, THash, TAllocator>::clampAges(Set& set, uint8_t tick) {
+  const uint16_t occupied = set.occupied_.load(std::memory_order_relaxed);
+  for (size_t way = 0; way < Ways; ++way) {
+    const uint8_t stamp = set.stamps_[way].load(std::memory_order_relaxed);
+    if ((occupied & (1u << way)) != 0 && static_cast<uint8_t>(tick - stamp) > MaxAge) {
+      set.stamps_[way].store(static_cast<uint8_t>(tick - MaxAge), std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+template <bool Assign>
+bool FlatLRUCache<TKey, TValue, THash, TAllocator>::put(const TKey& key, const TValue& value) {
+  Set& set = setOf(hasher_.hash(key));
+  Word words[SlotWords];
+
+  lock(set);
+  const int found = findWay(set, key, words);
+  if (found >= 0 && !Assign) {
+    touch(set, static_cast<size_t>(found));
+    unlock(set);
+    return false;
+  }
+
+  const size_t way = found >= 0 ? static_cast<size_t>(found) : victimWay(set);
+  const uint16_t occupied = set.occupied_.load(std::memory_order_relaxed);
+  if ((occupied & (1u << way)) == 0) {
+    set.occupied_.store(static_cast<uint16_t>(occupied | (1u << way)), std::memory_order_relaxed);
+    current_size_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::memset(words, 0, sizeof(words));
+  std::memcpy(words, static_cast<const void*>(&key), sizeof(TKey));
+  std::memcpy(reinterpret_cast<char*>(words) + sizeof(TKey), static_cast<const void*>(&value), sizeof(TValue));
+  for (size_t i = 0; i < SlotWords; ++i) {
+    set.words_[way][i].store(words[i], std::memory_order_relaxed);
+  }
+
+  const uint8_t tick = static_cast<uint8_t>(set.tick_.load(std::memory_order_relaxed) + 1);
+  set.tick_.store(tick, std::memory_order_relaxed);
+  set.stamps_[way].store(tick, std::memory_order_relaxed);
+  if ((tick & MaxAge) == 0) {
+    clampAges(set, tick);
+  }
+  unlock(set);
+
+  return found < 0;
+}
+
+// ---- public member functions ----
+template <class TKey, class TValue, class THash, class TAllocator>
+FlatLRUCache<TKey, TValue, THash, TAllocator>::FlatLRUCache(int size, const TAllocator& allocator)
+  : allocator_(allocator),
+    setCount_([size] {
+      const size_t sets = (static_cast<size_t>(std::max(size, 1)) + Ways - 1) / Ways;
+      size_t count = 1;
+      while (count < sets) {
+        count <<= 1;
+      }
+      return count;
+    }()),
+    setShift_([this] {
+      unsigned shift = 32;
+      for (size_t count = setCount_; count > 1; count >>= 1) {
+        --shift;
+      }
+      return shift;
+    }()),
+    sets_(SetTraits::allocate(allocator_, setCount_)) {
+  for (size_t i = 0; i < setCount_; ++i) {
+    SetTraits::construct(allocator_, sets_ + i);
+  }
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+FlatLRUCache<TKey, TValue, THash, TAllocator>::~FlatLRUCache() noexcept {
+  for (size_t i = 0; i < setCount_; ++i) {
+    SetTraits::destroy(allocator_, sets_ + i);
+  }
+  SetTraits::deallocate(allocator_, sets_, setCount_);
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+size_t FlatLRUCache<TKey, TValue, THash, TAllocator>::erase(const TKey& key) {
+  Set& set = setOf(hasher_.hash(key));
+  Word words[SlotWords];
+
+  lock(set);
+  const int found = findWay(set, key, words);
+  if (found >= 0) {
+    const uint16_t occupied = set.occupied_.load(std::memory_order_relaxed);
+    set.occupied_.store(static_cast<uint16_t>(occupied & ~(1u << found)), std::memory_order_relaxed);
+    current_size_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  unlock(set);
+
+  return found >= 0 ? 1 : 0;
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+bool FlatLRUCache<TKey, TValue, THash, TAllocator>::find(ConstAccessor& ac, const TKey& key) const {
+  Set& set = setOf(hasher_.hash(key));
+  Word words[SlotWords];
+  int found = -1;
+
+  for (int spins = 0;; ++spins) {
+    const uint32_t sequence = set.sequence_.load(std::memory_order_acquire);
+    if ((sequence & 1) != 0) {
+      backoff(spins);
+      continue;
+    }
+
+    found = findWay(set, key, words);
+
+    // orders the slot copy before the sequence check, see lock().
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (set.sequence_.load(std::memory_order_relaxed) == sequence) {
+      break;
+    }
+  }
+
+  if (found < 0) {
+    ac.release();
+    return false;
+  }
+
+  ac.value_ = valueOf(words);
+  ac.hasValue_ = true;
+  touch(set, static_cast<size_t>(found));
+  return true;
+}
+
+template <class TKey, class TValue, class THash, class TAllocator>
+void FlatLRUCache<TKey, TValue, THash, TAllocator>::clear() noexcept {
+  for (size_t i = 0; i < setCount_; ++i) {
+    Set& set = sets_[i];
+    lock(set);
+    const uint16_t occupied = set.occupied_.load(std::memory_order_relaxed);
+    set.occupied_.store(0, std::memory_order_relaxed);
+    unlock(set);
+
+    int count = 0;
+    for (uint16_t bits = occupied; bits != 0; bits &= static_cast<uint16_t>(bits - 1)) {
+      ++count;
+    }
+    current_size_.fetch_sub(count, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * LRUCacheFor selects FlatLRUCache for keys and values it can store, see IsFlatCacheable, and LRUCache
+ * otherwise. Both share find(ConstAccessor&, key), insert(), insert_or_assign(), erase(), size() and
+ * capacity(), code restricted to them works with either.
+ *
+ */
+template <typename TKey, typename TValue, typename THash = tbb::tbb_hash_compare<TKey>>
+using LRUCacheFor = std::conditional_t<IsFlatCacheable<TKey, TValue>,
+                                       FlatLRUCache<TKey, TValue, THash>,
+                                       LRUCache<TKey, TValue, THash>>;
+
+}  // namespace LRUC
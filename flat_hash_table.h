@@ -0,0 +1,646 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing companion of IntrusiveHashTable, for read-heavy indexes.
+//
+// Items are the same HashTableNode-derived objects, with the same semantics
+// but for iteration order: the table does not manage their memory or
+// lifetime, an item is linked to a single table at a time, and removing it
+// only unlinks it.
+//
+// Instead of chaining items through `htNext`, the table stores pointers to
+// them in slots grouped by 16, each slot having a 1-byte control tag: empty,
+// deleted, or 7 bits of the key hash. A lookup compares the tags of a whole
+// group at once (SSE2, or a portable loop elsewhere) and only dereferences
+// the items of matching tags, so a miss usually reads a single group instead
+// of a chain of scattered nodes.
+//
+// Groups are probed quadratically. The table grows to twice its size once
+// items and deleted slots fill 7/8 of the slots, rehashing at once.
+template <class K,                    // The key type
+          class V,                    // The mapped type (value)
+          class HASH = std::hash<K>,  // Hashes a key instance
+          class EQUAL = HashOnlyEqual // Compares an item with a key
+          >
+class FlatHashTable {
+public:
+  // Nested typedefs:
+  using ValueType = V;
+  using KeyHasher = HASH;
+  using KeyEqual = EQUAL;
+  using KeyType = typename std::remove_cv<K>::type;
+
+  // No copy or assignment:
+  FlatHashTable(const FlatHashTable &) = delete;
+  FlatHashTable &operator=(const FlatHashTable &) = delete;
+
+  // Construct empty (no allocation). Allocates on first insertion.
+  explicit FlatHashTable(bool allowDuplicateKeys);
+
+  // Construct and allocate storage for `sizeHint` items.
+  FlatHashTable(bool allowDuplicateKeys, std::size_t sizeHint);
+
+  // Destructor clears the table and unlinks all items.
+  ~FlatHashTable();
+
+  // Explicitly allocate storage. No-op if already allocated.
+  void allocate();
+  void allocate(std::size_t sizeHint);
+
+  // Make room for `itemCount` items without growing, e.g. before a bulk load.
+  void reserve(std::size_t itemCount);
+
+  // Test if table slots are already allocated.
+  bool isAllocated() const;
+
+  // Sets to empty without deallocating.
+  void clear();
+
+  // Clears and frees all memory.
+  void deallocate();
+
+  // Test if empty.
+  bool isEmpty() const;
+
+  // Get size in items.
+  std::size_t getSize() const;
+
+  // Number of slots allocated.
+  std::size_t getBucketCount() const;
+
+  // Estimate memory usage of internal control structures.
+  std::size_t getMemoryBytes() const;
+
+  // Set/get the "allow duplicate keys" flag.
+  void setAllowDuplicateKeys(bool allow);
+  bool isAllowingDuplicateKeys() const;
+
+  // Access item by key. Returns null if key is not present.
+  ValueType *find(const KeyType &key) const;
+
+  // Find all entries matching `key` in the table, see
+  // IntrusiveHashTable::findAllMatching().
+  std::size_t findAllMatching(const KeyType &key, ValueType **items,
+                              std::size_t maxItems) const;
+
+  // Count number of items with the given key.
+  // Will never be greater than one if duplicate keys are not allowed.
+  std::size_t countAllMatching(const KeyType &key) const;
+
+  // Operator[] to access items by key (same as `find()`).
+  ValueType *operator[](const KeyType &key) const;
+
+  // Insertion. Fails in case of duplicate keys only when duplicate keys are
+  // being disallowed.
+  bool insert(const KeyType &key, ValueType *value);
+
+  // Remove (unlink) single key/value pair. Returns a reference to the removed
+  // item. Null if no key found.
+  ValueType *remove(const KeyType &key);
+
+  // Remove (unlink) all items matching the key. Returns number of items
+  // removed.
+  std::size_t removeAllMatching(const KeyType &key);
+
+private:
+  // Slots per group, compared at once.
+  static constexpr std::size_t GroupSize = 16;
+
+  // Control tags of the slots without an item. Full slots hold a tag in
+  // [0, 127], thus the sign bit tells free slots apart.
+  static constexpr std::int8_t Empty = -128;
+  static constexpr std::int8_t Deleted = -2;
+
+  // Group of slots, tags first: a lookup reads the tags' cache line, then
+  // only the slots of matching tags.
+  struct Group {
+    alignas(16) std::int8_t ctrl[GroupSize];
+    ValueType *slots[GroupSize];
+
+    // Bit mask of the slots tagged `tag`.
+    std::uint32_t match(std::int8_t tag) const;
+
+    // Bit masks of the empty slots, and of the empty or deleted ones.
+    std::uint32_t matchEmpty() const;
+    std::uint32_t matchFree() const;
+  };
+
+  // Internal helpers:
+  std::size_t hashOf(const KeyType &key) const;
+  static bool isMatch(const ValueType *item, std::size_t keyHash,
+                      const KeyType &key);
+
+  // Mix the key hash so that both the group index (low bits) and the tag
+  // (top 7 bits) depend on all of its bits.
+  static std::size_t mix(std::size_t keyHash);
+  static std::int8_t tagOf(std::size_t mixed);
+
+  // Call `fn(group, slot)` on the slots of the items matching `key`, in probe
+  // order, while it returns true.
+  template <class FN>
+  void forEachMatch(std::size_t keyHash, const KeyType &key, FN &&fn) const;
+
+  // Link `value` into the first free slot of its probe sequence.
+  void place(std::size_t keyHash, ValueType *value);
+
+  // Free a full slot, unlinking its item.
+  void erase(Group &group, std::size_t slot, bool groupHasEmpty);
+
+  void growIfNeeded();
+  void rehash(std::size_t newGroupCount);
+
+  // Number of groups holding `itemCount` items below the maximum load.
+  static std::size_t groupCountFor(std::size_t itemCount);
+
+  // Whether items are matched by key hash alone, see HashOnlyEqual.
+  static constexpr bool IsHashOnly = std::is_same<EQUAL, HashOnlyEqual>::value;
+
+  // Items per slot that trigger growing, deleted slots included: 7/8.
+  static constexpr std::size_t MaxLoadNumerator = 7;
+  static constexpr std::size_t MaxLoadDenominator = 8;
+
+  // Items held before growing, without a size hint.
+  static constexpr std::size_t DefaultCapacity = 2048;
+
+  // Array of groups, a power of two of them.
+  Group *groups;
+  std::size_t groupCount;
+
+  // Items stored, and slots freed but still delimiting probe sequences.
+  std::size_t usedSlots;
+  std::size_t deletedSlots;
+
+  // If allowing duplicate keys or not.
+  bool allowDupKeys;
+};
+
+//
+// Inline implementation of FlatHashTable:
+//
+
+template <class K, class V, class HASH, class EQUAL>
+std::uint32_t
+FlatHashTable<K, V, HASH, EQUAL>::Group::match(const std::int8_t tag) const {
+#if defined(__SSE2__)
+  const __m128i tags = _mm_load_si128(reinterpret_cast<const __m128i *>(ctrl));
+  return static_cast<std::uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(tags, _mm_set1_epi8(tag))));
+#else
+  std::uint32_t mask = 0;
+  for (std::size_t slot = 0; slot < GroupSize; ++slot) {
+    mask |= static_cast<std::uint32_t>(ctrl[slot] == tag) << slot;
+  }
+  return mask;
+#endif
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::uint32_t FlatHashTable<K, V, HASH, EQUAL>::Group::matchEmpty() const {
+  return match(Empty);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::uint32_t FlatHashTable<K, V, HASH, EQUAL>::Group::matchFree() const {
+#if defined(__SSE2__)
+  // The sign bits of the tags:
+  const __m128i tags = _mm_load_si128(reinterpret_cast<const __m128i *>(ctrl));
+  return static_cast<std::uint32_t>(_mm_movemask_epi8(tags));
+#else
+  std::uint32_t mask = 0;
+  for (std::size_t slot = 0; slot < GroupSize; ++slot) {
+    mask |= static_cast<std::uint32_t>(ctrl[slot] < 0) << slot;
+  }
+  return mask;
+#endif
+}
+
+template <class K, class V, class HASH, class EQUAL>
+FlatHashTable<K, V, HASH, EQUAL>::FlatHashTable(const bool allowDuplicateKeys)
+    : groups(nullptr), groupCount(0), usedSlots(0), deletedSlots(0),
+      allowDupKeys(allowDuplicateKeys) {
+  // Empty table. Allocates the slots on first insertion.
+}
+
+template <class K, class V, class HASH, class EQUAL>
+FlatHashTable<K, V, HASH, EQUAL>::FlatHashTable(const bool allowDuplicateKeys,
+                                                const std::size_t sizeHint)
+    : groups(nullptr), groupCount(0), usedSlots(0), deletedSlots(0),
+      allowDupKeys(allowDuplicateKeys) {
+  allocate(sizeHint);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+FlatHashTable<K, V, HASH, EQUAL>::~FlatHashTable() {
+  deallocate();
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::allocate() {
+  allocate(DefaultCapacity);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::allocate(const std::size_t sizeHint) {
+  if (isAllocated()) {
+    return;
+  }
+
+  groupCount = groupCountFor(sizeHint);
+  groups = new Group[groupCount];
+  for (std::size_t group = 0; group < groupCount; ++group) {
+    for (std::size_t slot = 0; slot < GroupSize; ++slot) {
+      groups[group].ctrl[slot] = Empty;
+      groups[group].slots[slot] = nullptr;
+    }
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::reserve(const std::size_t itemCount) {
+  if (!isAllocated()) {
+    allocate(itemCount);
+    return;
+  }
+
+  const std::size_t neededGroups = groupCountFor(itemCount);
+  if (neededGroups > groupCount) {
+    rehash(neededGroups);
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL>
+bool FlatHashTable<K, V, HASH, EQUAL>::isAllocated() const {
+  return groups != nullptr && groupCount != 0;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::clear() {
+  if (!isAllocated()) {
+    return;
+  }
+
+  // Unlink the item of each full slot, then free every slot:
+  for (std::size_t group = 0; group < groupCount; ++group) {
+    for (std::size_t slot = 0; slot < GroupSize; ++slot) {
+      if (groups[group].ctrl[slot] >= 0) {
+        groups[group].slots[slot]->htKeyHash = 0;
+        groups[group].slots[slot] = nullptr;
+      }
+      groups[group].ctrl[slot] = Empty;
+    }
+  }
+
+  usedSlots = 0;
+  deletedSlots = 0;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::deallocate() {
+  if (!isAllocated()) {
+    return;
+  }
+
+  // Unlink all items:
+  clear();
+
+  // Free the table:
+  delete[] groups;
+  groups = nullptr;
+  groupCount = 0;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+bool FlatHashTable<K, V, HASH, EQUAL>::isEmpty() const {
+  return usedSlots == 0;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t FlatHashTable<K, V, HASH, EQUAL>::getSize() const {
+  return usedSlots;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t FlatHashTable<K, V, HASH, EQUAL>::getBucketCount() const {
+  return groupCount * GroupSize;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t FlatHashTable<K, V, HASH, EQUAL>::getMemoryBytes() const {
+  return groupCount * sizeof(Group);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::setAllowDuplicateKeys(const bool allow) {
+  allowDupKeys = allow;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+bool FlatHashTable<K, V, HASH, EQUAL>::isAllowingDuplicateKeys() const {
+  return allowDupKeys;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+typename FlatHashTable<K, V, HASH, EQUAL>::ValueType *
+FlatHashTable<K, V, HASH, EQUAL>::find(const KeyType &key) const {
+  if (isEmpty()) {
+    return nullptr;
+  }
+
+  ValueType *found = nullptr;
+  forEachMatch(hashOf(key), key, [&found](Group &group, std::size_t slot) {
+    found = group.slots[slot];
+    return false;
+  });
+
+  return found;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t FlatHashTable<K, V, HASH, EQUAL>::findAllMatching(
+    const KeyType &key, ValueType **items, const std::size_t maxItems) const {
+  assert(items != nullptr);
+  assert(maxItems != 0);
+
+  if (isEmpty()) {
+    return 0;
+  }
+
+  std::size_t foundCount = 0;
+  forEachMatch(hashOf(key), key, [&](Group &group, std::size_t slot) {
+    items[foundCount++] = group.slots[slot];
+    return foundCount != maxItems;
+  });
+
+  return foundCount;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t
+FlatHashTable<K, V, HASH, EQUAL>::countAllMatching(const KeyType &key) const {
+  if (isEmpty()) {
+    return 0;
+  }
+
+  std::size_t foundCount = 0;
+  forEachMatch(hashOf(key), key, [&foundCount](Group &, std::size_t) {
+    ++foundCount;
+    return true;
+  });
+
+  return foundCount;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+typename FlatHashTable<K, V, HASH, EQUAL>::ValueType *
+FlatHashTable<K, V, HASH, EQUAL>::operator[](const KeyType &key) const {
+  return find(key);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+bool FlatHashTable<K, V, HASH, EQUAL>::insert(const KeyType &key,
+                                              ValueType *value) {
+  assert(value != nullptr);
+  assert(!value->isLinkedToHashTable());
+
+  // Ensure allocated, with room for one more item:
+  allocate();
+  growIfNeeded();
+
+  const std::size_t keyHash = hashOf(key);
+
+  // If disallowing duplicate keys we must make sure no key with the same
+  // name already exists.
+  if (!isAllowingDuplicateKeys() && !isEmpty()) {
+    bool found = false;
+    forEachMatch(keyHash, key, [&found](Group &, std::size_t) {
+      found = true;
+      return false;
+    });
+
+    if (found) {
+      return false; // This specific key is already in use, fail.
+    }
+  }
+
+  place(keyHash, value);
+  ++usedSlots;
+  return true;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+typename FlatHashTable<K, V, HASH, EQUAL>::ValueType *
+FlatHashTable<K, V, HASH, EQUAL>::remove(const KeyType &key) {
+  if (isEmpty()) {
+    return nullptr;
+  }
+
+  ValueType *removed = nullptr;
+  forEachMatch(hashOf(key), key, [&](Group &group, std::size_t slot) {
+    removed = group.slots[slot];
+    erase(group, slot, group.matchEmpty() != 0);
+    return false;
+  });
+
+  return removed;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t
+FlatHashTable<K, V, HASH, EQUAL>::removeAllMatching(const KeyType &key) {
+  if (isEmpty()) {
+    return 0;
+  }
+
+  std::size_t removedCount = 0;
+  Group *lastGroup = nullptr;
+  bool groupHasEmpty = false;
+
+  forEachMatch(hashOf(key), key, [&](Group &group, std::size_t slot) {
+    // Whether the group ends the probe sequence, before freeing any of its
+    // slots:
+    if (&group != lastGroup) {
+      lastGroup = &group;
+      groupHasEmpty = group.matchEmpty() != 0;
+    }
+
+    erase(group, slot, groupHasEmpty);
+    ++removedCount;
+    return true;
+  });
+
+  return removedCount;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t FlatHashTable<K, V, HASH, EQUAL>::hashOf(const KeyType &key) const {
+  const std::size_t keyHash = KeyHasher()(key);
+  if (keyHash != 0) {
+    return keyHash;
+  }
+
+  // Zero marks unlinked items, see IntrusiveHashTable::hashOf():
+  assert(!IsHashOnly && "Null hash indexes not allowed!");
+  return 1;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+bool FlatHashTable<K, V, HASH, EQUAL>::isMatch(const ValueType *item,
+                                               const std::size_t keyHash,
+                                               const KeyType &key) {
+  // Hashes first, a cheap filter ahead of key comparisons:
+  return keyHash == item->htKeyHash && KeyEqual()(*item, key);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t FlatHashTable<K, V, HASH, EQUAL>::mix(const std::size_t keyHash) {
+  // Fibonacci multiplication, then the high half folded onto the low one:
+  const std::uint64_t mixed =
+      static_cast<std::uint64_t>(keyHash) * 0x9E3779B97F4A7C15ull;
+  return static_cast<std::size_t>(mixed ^ (mixed >> 32));
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::int8_t FlatHashTable<K, V, HASH, EQUAL>::tagOf(const std::size_t mixed) {
+  return static_cast<std::int8_t>(static_cast<std::uint64_t>(mixed) >> 57);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+template <class FN>
+void FlatHashTable<K, V, HASH, EQUAL>::forEachMatch(const std::size_t keyHash,
+                                                    const KeyType &key,
+                                                    FN &&fn) const {
+  const std::size_t mixed = mix(keyHash);
+  const std::int8_t tag = tagOf(mixed);
+  const std::size_t groupMask = groupCount - 1;
+
+  // Triangular probing visits every group of a power-of-two count once.
+  std::size_t index = mixed & groupMask;
+  for (std::size_t probe = 1; probe <= groupCount; ++probe) {
+    Group &group = groups[index];
+    const bool groupHasEmpty = group.matchEmpty() != 0;
+
+    for (std::uint32_t mask = group.match(tag); mask != 0; mask &= mask - 1) {
+      const std::size_t slot = static_cast<std::size_t>(__builtin_ctz(mask));
+      if (isMatch(group.slots[slot], keyHash, key) && !fn(group, slot)) {
+        return;
+      }
+    }
+
+    // Insertions fill the first free slot of the sequence, the key can't be
+    // past an empty one:
+    if (groupHasEmpty) {
+      return;
+    }
+
+    index = (index + probe) & groupMask;
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::place(const std::size_t keyHash,
+                                             ValueType *value) {
+  const std::size_t mixed = mix(keyHash);
+  const std::size_t groupMask = groupCount - 1;
+
+  // The load limit guarantees a free slot.
+  std::size_t index = mixed & groupMask;
+  for (std::size_t probe = 1;; ++probe) {
+    Group &group = groups[index];
+    const std::uint32_t mask = group.matchFree();
+    if (mask != 0) {
+      const std::size_t slot = static_cast<std::size_t>(__builtin_ctz(mask));
+      if (group.ctrl[slot] == Deleted) {
+        --deletedSlots;
+      }
+
+      group.ctrl[slot] = tagOf(mixed);
+      group.slots[slot] = value;
+      value->htKeyHash = keyHash;
+      value->htNext = nullptr;
+      return;
+    }
+
+    index = (index + probe) & groupMask;
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::erase(Group &group,
+                                             const std::size_t slot,
+                                             const bool groupHasEmpty) {
+  group.slots[slot]->htKeyHash = 0;
+  group.slots[slot] = nullptr;
+  --usedSlots;
+
+  // A group that had an empty slot ends every probe sequence reaching it, its
+  // slots may become empty again. Otherwise sequences may go on past it.
+  if (groupHasEmpty) {
+    group.ctrl[slot] = Empty;
+  } else {
+    group.ctrl[slot] = Deleted;
+    ++deletedSlots;
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::growIfNeeded() {
+  const std::size_t slotCount = groupCount * GroupSize;
+  if ((usedSlots + deletedSlots + 1) * MaxLoadDenominator <=
+      slotCount * MaxLoadNumerator) {
+    return;
+  }
+
+  // Mostly deleted slots: purge them at the same size rather than growing.
+  const bool purgeOnly = (usedSlots + 1) * 2 * MaxLoadDenominator <=
+                         slotCount * MaxLoadNumerator;
+  rehash(purgeOnly ? groupCount : groupCount * 2);
+}
+
+template <class K, class V, class HASH, class EQUAL>
+void FlatHashTable<K, V, HASH, EQUAL>::rehash(
+    const std::size_t newGroupCount) {
+  Group *const oldGroups = groups;
+  const std::size_t oldGroupCount = groupCount;
+
+  groups = nullptr;
+  groupCount = 0;
+  allocate(newGroupCount * GroupSize * MaxLoadNumerator / MaxLoadDenominator);
+  deletedSlots = 0;
+
+  // Hashes are kept in the items, keys need not be hashed again:
+  for (std::size_t group = 0; group < oldGroupCount; ++group) {
+    for (std::size_t slot = 0; slot < GroupSize; ++slot) {
+      if (oldGroups[group].ctrl[slot] >= 0) {
+        ValueType *item = oldGroups[group].slots[slot];
+        place(item->htKeyHash, item);
+      }
+    }
+  }
+
+  delete[] oldGroups;
+}
+
+template <class K, class V, class HASH, class EQUAL>
+std::size_t
+FlatHashTable<K, V, HASH, EQUAL>::groupCountFor(const std::size_t itemCount) {
+  const std::size_t slotCount =
+      (itemCount * MaxLoadDenominator + MaxLoadNumerator - 1) /
+      MaxLoadNumerator;
+
+  std::size_t count = 1;
+  while (count * GroupSize < slotCount) {
+    count <<= 1;
+  }
+  return count;
+}
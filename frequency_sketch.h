@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace LRUC {
+
+/**
+ * FrequencySketch is a count-min sketch estimating how often a hash code was seen recently,
+ * the TinyLFU admission filter of EvictionPolicy::WTinyLFU.
+ *
+ * Counters are 4 bits wide, 16 per table word, each hash code mapping to 4 counters in distinct words.
+ * frequency() returns the smallest of them, which over-estimates only on collisions.
+ *
+ * Once the number of increments reaches the sample size(10 times the capacity), all counters are
+ * halved so that the sketch forgets old popularity and adapts to workload changes. ensureCapacity()
+ * follows a capacity change.
+ *
+ * Not thread-safe.
+ *
+ */
+class FrequencySketch final {
+ public:
+  /**
+   * capacity: number of distinct hash codes expected to be tracked, usually the cache capacity.
+   *
+   */
+  explicit FrequencySketch(size_t capacity) {
+    resize(capacity);
+  }
+
+  /**
+   * ensureCapacity sizes the sketch for capacity hash codes once the tracked capacity changed, e.g. the
+   * cache was resized: the sample size follows capacity, the table grows once capacity exceeds its width,
+   * forgetting its counts, but never shrinks. Does nothing if capacity is unchanged.
+   *
+   */
+  void ensureCapacity(size_t capacity) {
+    if (capacity == capacity_) {
+      return;
+    }
+
+    if (capacity > table_.size()) {
+      resize(capacity);
+      return;
+    }
+
+    capacity_ = capacity;
+    sampleSize_ = std::max<size_t>(capacity, 1) * 10;
+    if (additions_ >= sampleSize_) {
+      reset();
+      additions_ = std::min(additions_, sampleSize_ / 2);
+    }
+  }
+
+  /**
+   * frequency returns the estimated number of occurrences of hash, at most 15.
+   *
+   */
+  uint32_t frequency(uint64_t hash) const {
+    uint32_t frequency = MaxCount;
+    for (uint64_t seed : Seeds) {
+      const uint64_t h = mix(hash + seed);
+      frequency = std::min(frequency, static_cast<uint32_t>((table_[h & mask_] >> offsetOf(h)) & MaxCount));
+    }
+
+    return frequency;
+  }
+
+  /**
+   * increment records an occurrence of hash, ages the sketch once the sample size is reached.
+   *
+   */
+  void increment(uint64_t hash) {
+    bool added = false;
+    for (uint64_t seed : Seeds) {
+      const uint64_t h = mix(hash + seed);
+      uint64_t& word = table_[h & mask_];
+      const int offset = offsetOf(h);
+
+      if (((word >> offset) & MaxCount) != MaxCount) {
+        word += uint64_t{1} << offset;
+        added = true;
+      }
+    }
+
+    if (added && ++additions_ == sampleSize_) {
+      reset();
+    }
+  }
+
+ private:
+  static constexpr uint32_t MaxCount = 15;
+  static constexpr uint64_t Seeds[4] = {
+    0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0xD6E8FEB86659FD93ull};
+
+  // splitmix64 finalizer, every bit of h depends on every bit of x.
+  static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+  }
+
+  // bit offset of the counter inside its word, taken from the high-order bits the word index does not use.
+  static int offsetOf(uint64_t h) {
+    return static_cast<int>(h >> 60) << 2;
+  }
+
+  // a new table of at least capacity counters, all zero.
+  void resize(size_t capacity) {
+    size_t size = 8;
+    while (size < capacity) {
+      size <<= 1;
+    }
+
+    table_.assign(size, 0);
+    mask_ = size - 1;
+    capacity_ = capacity;
+    sampleSize_ = std::max<size_t>(capacity, 1) * 10;
+    additions_ = 0;
+  }
+
+  // halve every counter.
+  void reset() {
+    for (uint64_t& word : table_) {
+      word = (word >> 1) & 0x7777777777777777ull;
+    }
+
+    additions_ /= 2;
+  }
+
+ private:
+  std::vector<uint64_t> table_;
+  uint64_t mask_{0};
+  size_t capacity_{0};
+  size_t sampleSize_{0};
+  size_t additions_{0};
+};
+}  // namespace LRUC
@@ -1,6 +1,11 @@
+#pragma once
+
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <type_traits>
 
 // Types that will be inserted into the IntrusiveHashTable
@@ -8,7 +13,11 @@
 template <class T> class HashTableNode {
 public:
   // Hash-table needs access to internal data of its nodes.
-  template <class K, class V, class HASH> friend class IntrusiveHashTable;
+  template <class K, class V, class HASH, class EQUAL, class BUCKETS,
+            class ALLOC>
+  friend class IntrusiveHashTable;
+  template <class K, class V, class HASH, class EQUAL>
+  friend class FlatHashTable;
 
   // IntrusiveHashTable interface:
   std::size_t getHashTableKeyHash() const { return htKeyHash; }
@@ -29,17 +38,113 @@ private:
   std::size_t htKeyHash;
 };
 
+// Key equality of IntrusiveHashTable items, only called once the key hash
+// matched the item's.
+//
+// HashOnlyEqual takes equal hashes for equal keys, thus items need not store
+// their key, but distinct keys of colliding hashes are confused and no key
+// may hash to 0. Only use it with a perfect hash (e.g. the identity
+// `std::hash<int>`).
+struct HashOnlyEqual {
+  template <class V, class K> bool operator()(const V &, const K &) const {
+    return true;
+  }
+};
+
+// MemberKeyEqual compares the key with a data member of the item, e.g.
+// `MemberKeyEqual<&Item::name>`.
+template <auto KeyMember> struct MemberKeyEqual {
+  template <class V, class K>
+  bool operator()(const V &item, const K &key) const {
+    return item.*KeyMember == key;
+  }
+};
+
+// Bucket count policies of IntrusiveHashTable, selected at compile time.
+//
+// PrimeBuckets takes the index of a key hash modulo a prime bucket count,
+// which spreads even poorly mixed hashes (e.g. `std::hash<int>` is the
+// identity) but costs an integer division per lookup.
+struct PrimeBuckets {
+  static std::size_t roundUp(std::size_t count) {
+    while (!isPrime(count)) {
+      ++count;
+    }
+    return count;
+  }
+
+  static std::size_t indexOf(const std::size_t keyHash,
+                             const std::size_t bucketCount) {
+    return keyHash % bucketCount;
+  }
+
+  static bool isPrime(const std::size_t x) {
+    if (((!(x & 1)) && x != 2) || (x < 2) || (x % 3 == 0 && x != 3)) {
+      return false;
+    }
+    for (std::size_t k = 1; (36 * k * k - 12 * k) < x; ++k) {
+      if ((x % (6 * k + 1) == 0) || (x % (6 * k - 1) == 0)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// PowerOfTwoBuckets rounds bucket counts up to a power of two, which turns
+// the division into a multiplication and a shift: Fibonacci hashing multiplies
+// the key hash by 2^64 / phi and keeps the top log2(bucketCount) bits, the
+// ones depending on all of the hash bits. Consecutive hashes land far apart
+// and evenly spread, and strided ones (e.g. aligned addresses) do not pile up
+// in a few buckets as a plain mask would.
+// A dense range of identity-hashed keys (1..N) never collides modulo a prime
+// count though, PrimeBuckets remains faster for those.
+struct PowerOfTwoBuckets {
+  static std::size_t roundUp(const std::size_t count) {
+    // At least 2 buckets, the shift below is at most 63.
+    std::size_t powerOfTwo = 2;
+    while (powerOfTwo < count) {
+      powerOfTwo <<= 1;
+    }
+    return powerOfTwo;
+  }
+
+  static std::size_t indexOf(const std::size_t keyHash,
+                             const std::size_t bucketCount) {
+    const std::uint64_t mixed =
+        static_cast<std::uint64_t>(keyHash) * 0x9E3779B97F4A7C15ull;
+    // 64 - log2(bucketCount):
+    const int shift = __builtin_clzll(bucketCount) + 1;
+    return static_cast<std::size_t>(mixed >> shift);
+  }
+};
+
 // This hash-table does not manage memory or lifetime of the objects inserted.
 // Removing an item from the table WILL NOT destroy the object, just unlink it.
-template <class K,                  // The key type
-          class V,                  // The mapped type (value)
-          class HASH = std::hash<K> // Hashes a key instance
+//
+// The table grows once it holds more than MaxLoadFactor items per bucket.
+// Growing allocates a bucket array twice as large, then migrates the chains
+// of the previous one a few buckets at a time on each subsequent insertion
+// or removal, so that no single operation pays for the whole rehash. Lookups
+// meanwhile probe whichever of both arrays holds the key's bucket.
+//
+// Bucket arrays come from ALLOC, rebound to item pointers, e.g. to back a
+// large table with huge pages. The items themselves are the caller's.
+template <class K,                          // The key type
+          class V,                          // The mapped type (value)
+          class HASH = std::hash<K>,        // Hashes a key instance
+          class EQUAL = HashOnlyEqual,      // Compares an item with a key
+          class BUCKETS = PrimeBuckets,     // Bucket count policy
+          class ALLOC = std::allocator<V *> // Allocates the bucket arrays
           >
 class IntrusiveHashTable {
 public:
   // Nested typedefs:
   using ValueType = V;
   using KeyHasher = HASH;
+  using KeyEqual = EQUAL;
+  using BucketPolicy = BUCKETS;
+  using AllocatorType = ALLOC;
   using KeyType = typename std::remove_cv<K>::type;
 
   // No copy or assignment:
@@ -47,10 +152,12 @@ public:
   IntrusiveHashTable &operator=(const IntrusiveHashTable &) = delete;
 
   // Construct empty (no allocation). Allocates on first insertion.
-  explicit IntrusiveHashTable(bool allowDuplicateKeys);
+  explicit IntrusiveHashTable(bool allowDuplicateKeys,
+                              const AllocatorType &allocator = AllocatorType());
 
   // Construct and allocate storage with num buckets hint.
-  IntrusiveHashTable(bool allowDuplicateKeys, std::size_t sizeHint);
+  IntrusiveHashTable(bool allowDuplicateKeys, std::size_t sizeHint,
+                     const AllocatorType &allocator = AllocatorType());
 
   // Destructor clears the table and unlinks all items.
   ~IntrusiveHashTable();
@@ -59,6 +166,13 @@ public:
   void allocate();
   void allocate(std::size_t sizeHint);
 
+  // Make room for `itemCount` items without growing, e.g. before a bulk load.
+  // Unlike growing on insertion, the rehash happens at once.
+  void reserve(std::size_t itemCount);
+
+  // Test if buckets of a previous, smaller array remain to be migrated.
+  bool isRehashing() const;
+
   // Test if table buckets are already allocated.
   bool isAllocated() const;
 
@@ -74,7 +188,7 @@ public:
   // Get size in items.
   std::size_t getSize() const;
 
-  // Number of buckets allocated.
+  // Number of buckets allocated, not counting an array being migrated.
   std::size_t getBucketCount() const;
 
   // Estimate memory usage of internal control structures.
@@ -114,97 +228,234 @@ public:
   // removed.
   std::size_t removeAllMatching(const KeyType &key);
 
+  // Forward iterator over the items, in no particular order. Insertions and
+  // removals invalidate iterators, since they may migrate buckets.
+  class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = ValueType;
+    using difference_type = std::ptrdiff_t;
+    using pointer = ValueType *;
+    using reference = ValueType &;
+
+    Iterator() : owner(nullptr), bucket(0), inOldTable(false), item(nullptr) {}
+
+    reference operator*() const { return *item; }
+    pointer operator->() const { return item; }
+
+    Iterator &operator++();
+    Iterator operator++(int) {
+      Iterator previous = *this;
+      ++*this;
+      return previous;
+    }
+
+    // Each item is linked once, so it identifies the position:
+    bool operator==(const Iterator &other) const { return item == other.item; }
+    bool operator!=(const Iterator &other) const { return item != other.item; }
+
+  private:
+    friend class IntrusiveHashTable;
+
+    explicit Iterator(const IntrusiveHashTable *owner)
+        : owner(owner), bucket(0), inOldTable(false), item(nullptr) {}
+
+    // Move to the first item of the first non-empty bucket from `first`,
+    // `table` then the buckets of `oldTable` not yet migrated.
+    void seek(std::size_t first);
+
+    const IntrusiveHashTable *owner;
+    std::size_t bucket;
+    bool inOldTable;
+    ValueType *item;
+  };
+
+  Iterator begin() const;
+  Iterator end() const;
+
+  // Call `fn(item)` on every item, like iterating, but reading the head items
+  // of the buckets PrefetchDistance ahead in advance: passes over large tables
+  // then overlap their cache misses instead of waiting on each in turn.
+  // `fn` must not insert or remove items.
+  template <class FN> void forEach(FN &&fn) const;
+
+  // Look up `count` keys at once: `items[i]` is set to `find(keys[i])`.
+  // Returns the number of keys found.
+  // Bucket heads and their first items are prefetched PrefetchDistance keys
+  // ahead of the key being resolved, so that lookups in a large table overlap
+  // their cache misses.
+  std::size_t findBatch(const KeyType *keys, std::size_t count,
+                        ValueType **items) const;
+
 private:
   // Internal helpers:
   std::size_t hashOf(const KeyType &key) const;
-  std::size_t bucketOf(std::size_t keyHash) const;
-  static bool isPrime(const std::size_t x);
+  static bool isMatch(const ValueType *item, std::size_t keyHash,
+                      const KeyType &key);
+  static std::size_t bucketOf(std::size_t keyHash, std::size_t buckets);
+
+  // Head of the chain holding `keyHash`, in `table` or in `oldTable`.
+  ValueType **chainOf(std::size_t keyHash) const;
 
-  // A prime number close to 2048.
+  // Bucket arrays, zero-initialized:
+  ValueType **allocateBuckets(std::size_t count);
+  void freeBuckets(ValueType **buckets, std::size_t count);
+
+  // Incremental rehash:
+  void growIfNeeded();
+  void startRehash(std::size_t newBucketCount);
+  void migrateBuckets(std::size_t maxBuckets);
+  void finishRehash();
+
+  // Whether items are matched by key hash alone, see HashOnlyEqual.
+  static constexpr bool IsHashOnly = std::is_same<EQUAL, HashOnlyEqual>::value;
+
+  // A prime number close to 2048, rounded up by the bucket policy.
   static constexpr std::size_t DefaultCapacity = 2053;
 
+  // Average chain length that triggers growing.
+  static constexpr std::size_t MaxLoadFactor = 1;
+
+  // Buckets of `oldTable` migrated per insertion or removal. Larger than 1
+  // so that migration completes before the new array fills up in turn.
+  static constexpr std::size_t MigrationStep = 4;
+
+  // Buckets, or keys of findBatch(), read ahead of the one being visited.
+  // Far enough for their cache misses to complete before they are visited.
+  static constexpr std::size_t PrefetchDistance = 16;
+
   // Array of pointers to items (the buckets).
   ValueType **table;
 
-  // Total size of `table` and buckets used so far.
+  // Total size of `table` and items stored so far (in both arrays).
   std::size_t bucketCount;
   std::size_t usedBuckets;
 
+  // Previous array while rehashing, null otherwise. Its buckets below
+  // `migratedBuckets` are empty, their items moved to `table`.
+  ValueType **oldTable;
+  std::size_t oldBucketCount;
+  std::size_t migratedBuckets;
+
   // If allowing duplicate keys or not.
   bool allowDupKeys;
+
+  using BucketAllocator = typename std::allocator_traits<
+      AllocatorType>::template rebind_alloc<ValueType *>;
+  using BucketTraits = std::allocator_traits<BucketAllocator>;
+
+  BucketAllocator bucketAllocator;
 };
 
 //
 // Inline implementation of IntrusiveHashTable:
 //
 
-template <class K, class V, class HASH>
-IntrusiveHashTable<K, V, HASH>::IntrusiveHashTable(
-    const bool allowDuplicateKeys)
-    : table(nullptr), bucketCount(0), usedBuckets(0),
-      allowDupKeys(allowDuplicateKeys) {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::IntrusiveHashTable(
+    const bool allowDuplicateKeys, const AllocatorType &allocator)
+    : table(nullptr), bucketCount(0), usedBuckets(0), oldTable(nullptr),
+      oldBucketCount(0), migratedBuckets(0), allowDupKeys(allowDuplicateKeys),
+      bucketAllocator(allocator) {
   // Empty table. Allocates the buckets on first insertion.
 }
 
-template <class K, class V, class HASH>
-IntrusiveHashTable<K, V, HASH>::IntrusiveHashTable(
-    const bool allowDuplicateKeys, const std::size_t sizeHint)
-    : table(nullptr), bucketCount(0), usedBuckets(0),
-      allowDupKeys(allowDuplicateKeys) {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::IntrusiveHashTable(
+    const bool allowDuplicateKeys, const std::size_t sizeHint,
+    const AllocatorType &allocator)
+    : table(nullptr), bucketCount(0), usedBuckets(0), oldTable(nullptr),
+      oldBucketCount(0), migratedBuckets(0), allowDupKeys(allowDuplicateKeys),
+      bucketAllocator(allocator) {
   allocate(sizeHint);
 }
 
-template <class K, class V, class HASH>
-IntrusiveHashTable<K, V, HASH>::~IntrusiveHashTable() {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::~IntrusiveHashTable() {
   deallocate();
 }
 
-template <class K, class V, class HASH>
-void IntrusiveHashTable<K, V, HASH>::allocate() {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::allocate() {
   allocate(DefaultCapacity);
 }
 
-template <class K, class V, class HASH>
-void IntrusiveHashTable<K, V, HASH>::allocate(const std::size_t sizeHint) {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::allocate(
+    const std::size_t sizeHint) {
   if (isAllocated()) {
     return;
   }
 
-  bucketCount = sizeHint;
-  while (!isPrime(bucketCount)) {
-    ++bucketCount;
+  bucketCount = BucketPolicy::roundUp(sizeHint);
+  table = allocateBuckets(bucketCount);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::reserve(
+    const std::size_t itemCount) {
+  const std::size_t neededBuckets = itemCount / MaxLoadFactor + 1;
+  if (!isAllocated()) {
+    allocate(neededBuckets);
+    return;
+  }
+
+  if (neededBuckets <= bucketCount) {
+    return;
   }
 
-  table = new ValueType *[bucketCount]();
+  finishRehash();
+  startRehash(neededBuckets);
+  finishRehash();
 }
 
-template <class K, class V, class HASH>
-bool IntrusiveHashTable<K, V, HASH>::isAllocated() const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+bool IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::isAllocated()
+    const {
   return table != nullptr && bucketCount != 0;
 }
 
-template <class K, class V, class HASH>
-void IntrusiveHashTable<K, V, HASH>::clear() {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+bool IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::isRehashing()
+    const {
+  return oldTable != nullptr;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::clear() {
   if (isEmpty()) {
     return;
   }
 
-  // Check each bucket. Non-null ones are occupied:
-  for (std::size_t bucket = 0; bucket < bucketCount; ++bucket) {
-    // Reset each item in this bucket's chain:
-    for (ValueType *item = table[bucket]; item != nullptr;) {
-      ValueType *nextItem = item->htNext;
-      item->htNext = nullptr;
-      item->htKeyHash = 0;
-      item = nextItem;
+  // Reset each item of a chain and empty its bucket:
+  auto clearBuckets = [](ValueType **buckets, const std::size_t count) {
+    for (std::size_t bucket = 0; bucket < count; ++bucket) {
+      for (ValueType *item = buckets[bucket]; item != nullptr;) {
+        ValueType *nextItem = item->htNext;
+        item->htNext = nullptr;
+        item->htKeyHash = 0;
+        item = nextItem;
+      }
+      buckets[bucket] = nullptr;
     }
+  };
+
+  clearBuckets(table, bucketCount);
+
+  // Nothing left to migrate:
+  if (isRehashing()) {
+    clearBuckets(oldTable, oldBucketCount);
+    freeBuckets(oldTable, oldBucketCount);
+    oldTable = nullptr;
+    oldBucketCount = 0;
+    migratedBuckets = 0;
   }
 
   usedBuckets = 0;
 }
 
-template <class K, class V, class HASH>
-void IntrusiveHashTable<K, V, HASH>::deallocate() {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::deallocate() {
   if (!isAllocated()) {
     return;
   }
@@ -212,53 +463,66 @@ void IntrusiveHashTable<K, V, HASH>::deallocate() {
   // Unlink all items:
   clear();
 
-  // Free the table:
-  delete[] table;
+  // Free the table, and the previous one if emptied while rehashing:
+  freeBuckets(table, bucketCount);
   table = nullptr;
   bucketCount = 0;
+
+  if (oldTable != nullptr) {
+    freeBuckets(oldTable, oldBucketCount);
+  }
+  oldTable = nullptr;
+  oldBucketCount = 0;
+  migratedBuckets = 0;
 }
 
-template <class K, class V, class HASH>
-bool IntrusiveHashTable<K, V, HASH>::isEmpty() const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+bool IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::isEmpty() const {
   return usedBuckets == 0;
 }
 
-template <class K, class V, class HASH>
-std::size_t IntrusiveHashTable<K, V, HASH>::getSize() const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+std::size_t
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::getSize() const {
   return usedBuckets;
 }
 
-template <class K, class V, class HASH>
-std::size_t IntrusiveHashTable<K, V, HASH>::getBucketCount() const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+std::size_t
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::getBucketCount() const {
   return bucketCount;
 }
 
-template <class K, class V, class HASH>
-std::size_t IntrusiveHashTable<K, V, HASH>::getMemoryBytes() const {
-  return bucketCount * sizeof(ValueType *);
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+std::size_t
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::getMemoryBytes() const {
+  return (bucketCount + oldBucketCount) * sizeof(ValueType *);
 }
 
-template <class K, class V, class HASH>
-void IntrusiveHashTable<K, V, HASH>::setAllowDuplicateKeys(const bool allow) {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::
+    setAllowDuplicateKeys(const bool allow) {
   allowDupKeys = allow;
 }
 
-template <class K, class V, class HASH>
-bool IntrusiveHashTable<K, V, HASH>::isAllowingDuplicateKeys() const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+bool IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::
+    isAllowingDuplicateKeys() const {
   return allowDupKeys;
 }
 
-template <class K, class V, class HASH>
-typename IntrusiveHashTable<K, V, HASH>::ValueType *
-IntrusiveHashTable<K, V, HASH>::find(const KeyType &key) const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::ValueType *
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::find(
+    const KeyType &key) const {
   if (isEmpty()) {
     return nullptr;
   }
 
   const std::size_t keyHash = hashOf(key);
-  for (ValueType *item = table[bucketOf(keyHash)]; item != nullptr;
+  for (ValueType *item = *chainOf(keyHash); item != nullptr;
        item = item->htNext) {
-    if (keyHash == item->htKeyHash) {
+    if (isMatch(item, keyHash, key)) {
       return item;
     }
   }
@@ -266,8 +530,9 @@ IntrusiveHashTable<K, V, HASH>::find(const KeyType &key) const {
   return nullptr;
 }
 
-template <class K, class V, class HASH>
-std::size_t IntrusiveHashTable<K, V, HASH>::findAllMatching(
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+std::size_t
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::findAllMatching(
     const KeyType &key, ValueType **items, const std::size_t maxItems) const {
   assert(items != nullptr);
   assert(maxItems != 0);
@@ -280,9 +545,9 @@ std::size_t IntrusiveHashTable<K, V, HASH>::findAllMatching(
   std::size_t foundCount = 0;
 
   // Duplicate keys will share the same bucket/chain.
-  for (ValueType *item = table[bucketOf(keyHash)]; item != nullptr;
+  for (ValueType *item = *chainOf(keyHash); item != nullptr;
        item = item->htNext) {
-    if (keyHash == item->htKeyHash) {
+    if (isMatch(item, keyHash, key)) {
       items[foundCount++] = item;
     }
     if (foundCount == maxItems) {
@@ -293,9 +558,10 @@ std::size_t IntrusiveHashTable<K, V, HASH>::findAllMatching(
   return foundCount;
 }
 
-template <class K, class V, class HASH>
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
 std::size_t
-IntrusiveHashTable<K, V, HASH>::countAllMatching(const KeyType &key) const {
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::countAllMatching(
+    const KeyType &key) const {
   if (isEmpty()) {
     return 0;
   }
@@ -304,9 +570,9 @@ IntrusiveHashTable<K, V, HASH>::countAllMatching(const KeyType &key) const {
   std::size_t foundCount = 0;
 
   // Duplicate keys will share the same bucket/chain.
-  for (ValueType *item = table[bucketOf(keyHash)]; item != nullptr;
+  for (ValueType *item = *chainOf(keyHash); item != nullptr;
        item = item->htNext) {
-    if (keyHash == item->htKeyHash) {
+    if (isMatch(item, keyHash, key)) {
       ++foundCount;
     }
   }
@@ -314,32 +580,33 @@ IntrusiveHashTable<K, V, HASH>::countAllMatching(const KeyType &key) const {
   return foundCount;
 }
 
-template <class K, class V, class HASH>
-typename IntrusiveHashTable<K, V, HASH>::ValueType *
-IntrusiveHashTable<K, V, HASH>::operator[](const KeyType &key) const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::ValueType *
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::operator[](
+    const KeyType &key) const {
   return find(key);
 }
 
-template <class K, class V, class HASH>
-bool IntrusiveHashTable<K, V, HASH>::insert(const KeyType &key,
-                                            ValueType *value) {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+bool IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::insert(
+    const KeyType &key, ValueType *value) {
   assert(value != nullptr);
   assert(!value->isLinkedToHashTable());
 
-  // Ensure allocated:
+  // Ensure allocated, with room for one more item:
   allocate();
+  growIfNeeded();
 
   const std::size_t keyHash = hashOf(key);
-  const std::size_t bucket = bucketOf(keyHash);
+  ValueType **chain = chainOf(keyHash);
 
   // This bucket's chain is already in use. Append to it:
-  if (table[bucket] != nullptr) {
+  if (*chain != nullptr) {
     // If disallowing duplicate keys we must scan this chain
     // and make sure no key with the same name already exists.
     if (!isAllowingDuplicateKeys()) {
-      for (ValueType *item = table[bucket]; item != nullptr;
-           item = item->htNext) {
-        if (keyHash == item->htKeyHash) {
+      for (ValueType *item = *chain; item != nullptr; item = item->htNext) {
+        if (isMatch(item, keyHash, key)) {
           return false; // This specific key is already in use, fail.
         }
       }
@@ -347,43 +614,47 @@ bool IntrusiveHashTable<K, V, HASH>::insert(const KeyType &key,
 
     // Make the new value head of the chain:
     value->htKeyHash = keyHash;
-    value->htNext = table[bucket];
-    table[bucket] = value;
+    value->htNext = *chain;
+    *chain = value;
   } else // Empty chain:
   {
     value->htKeyHash = keyHash;
     value->htNext = nullptr;
-    table[bucket] = value;
+    *chain = value;
   }
 
   ++usedBuckets;
   return true;
 }
 
-template <class K, class V, class HASH>
-typename IntrusiveHashTable<K, V, HASH>::ValueType *
-IntrusiveHashTable<K, V, HASH>::remove(const KeyType &key) {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::ValueType *
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::remove(
+    const KeyType &key) {
   if (isEmpty()) {
     return nullptr;
   }
 
+  // Removals carry on a pending rehash too:
+  migrateBuckets(MigrationStep);
+
   const std::size_t keyHash = hashOf(key);
-  const std::size_t bucket = bucketOf(keyHash);
+  ValueType **chain = chainOf(keyHash);
 
   ValueType *previous = nullptr;
-  for (ValueType *item = table[bucket]; item != nullptr;) {
-    if (keyHash == item->htKeyHash) {
+  for (ValueType *item = *chain; item != nullptr;) {
+    if (isMatch(item, keyHash, key)) {
       --usedBuckets;
 
       if (previous != nullptr) {
         // Not the head of the chain, remove from middle:
         previous->htNext = item->htNext;
-      } else if (item == table[bucket] && item->htNext == nullptr) {
+      } else if (item == *chain && item->htNext == nullptr) {
         // Single item bucket, clear the entry:
-        table[bucket] = nullptr;
-      } else if (item == table[bucket] && item->htNext != nullptr) {
+        *chain = nullptr;
+      } else if (item == *chain && item->htNext != nullptr) {
         // Head of chain with other item(s) following:
-        table[bucket] = item->htNext;
+        *chain = item->htNext;
       } else {
         assert(false && "IntrusiveHashTable bucket chain is corrupted!");
       }
@@ -400,37 +671,41 @@ IntrusiveHashTable<K, V, HASH>::remove(const KeyType &key) {
   return nullptr;
 }
 
-template <class K, class V, class HASH>
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
 std::size_t
-IntrusiveHashTable<K, V, HASH>::removeAllMatching(const KeyType &key) {
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::removeAllMatching(
+    const KeyType &key) {
   if (isEmpty()) {
     return 0;
   }
 
+  // Removals carry on a pending rehash too:
+  migrateBuckets(MigrationStep);
+
   const std::size_t keyHash = hashOf(key);
-  const std::size_t bucket = bucketOf(keyHash);
+  ValueType **chain = chainOf(keyHash);
 
   ValueType *previous = nullptr;
   std::size_t removedCount = 0;
 
-  for (ValueType *item = table[bucket]; item != nullptr;) {
-    if (keyHash == item->htKeyHash) {
+  for (ValueType *item = *chain; item != nullptr;) {
+    if (isMatch(item, keyHash, key)) {
       --usedBuckets;
 
       if (previous != nullptr) {
         // Not the head of the chain, remove from middle:
         previous->htNext = item->htNext;
-      } else if (item == table[bucket] && item->htNext == nullptr) {
+      } else if (item == *chain && item->htNext == nullptr) {
         // Stop when the bucket's chain has been cleared:
-        table[bucket] = nullptr;
+        *chain = nullptr;
         item->htNext = nullptr;
         item->htKeyHash = 0;
 
         ++removedCount;
         break;
-      } else if (item == table[bucket] && item->htNext != nullptr) {
+      } else if (item == *chain && item->htNext != nullptr) {
         // Head of chain with other item(s) following:
-        table[bucket] = item->htNext;
+        *chain = item->htNext;
       } else {
         assert(false && "IntrusiveHashTable bucket chain is corrupted!");
       }
@@ -450,30 +725,273 @@ IntrusiveHashTable<K, V, HASH>::removeAllMatching(const KeyType &key) {
   return removedCount;
 }
 
-template <class K, class V, class HASH>
-std::size_t IntrusiveHashTable<K, V, HASH>::hashOf(const KeyType &key) const {
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::Iterator &
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::Iterator::operator++() {
+  assert(item != nullptr && "Incrementing the end iterator!");
+
+  item = item->htNext;
+  if (item == nullptr) {
+    seek(bucket + 1);
+  }
+  return *this;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::Iterator::seek(
+    std::size_t first) {
+  for (;;) {
+    ValueType *const *buckets = inOldTable ? owner->oldTable : owner->table;
+    const std::size_t count =
+        inOldTable ? owner->oldBucketCount : owner->bucketCount;
+
+    for (bucket = first; bucket < count; ++bucket) {
+      if (buckets[bucket] != nullptr) {
+        item = buckets[bucket];
+        return;
+      }
+    }
+
+    if (inOldTable || !owner->isRehashing()) {
+      item = nullptr; // End.
+      return;
+    }
+
+    // Migrated buckets of the old array are empty, skip them:
+    inOldTable = true;
+    first = owner->migratedBuckets;
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::Iterator
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::begin() const {
+  Iterator it(this);
+  if (!isEmpty()) {
+    it.seek(0);
+  }
+  return it;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::Iterator
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::end() const {
+  return Iterator(this);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+template <class FN>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::forEach(
+    FN &&fn) const {
+  if (isEmpty()) {
+    return;
+  }
+
+  auto visitBuckets = [&fn](ValueType *const *buckets, std::size_t first,
+                            const std::size_t count) {
+    for (std::size_t bucket = first; bucket < count; ++bucket) {
+      // The bucket array is read in order, hardware prefetches it. Items are
+      // scattered, prefetch the ones ahead (null is never dereferenced):
+      if (bucket + PrefetchDistance < count) {
+        __builtin_prefetch(buckets[bucket + PrefetchDistance]);
+      }
+
+      for (ValueType *item = buckets[bucket]; item != nullptr;
+           item = item->htNext) {
+        fn(item);
+      }
+    }
+  };
+
+  visitBuckets(table, 0, bucketCount);
+  if (isRehashing()) {
+    visitBuckets(oldTable, migratedBuckets, oldBucketCount);
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+std::size_t IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::findBatch(
+    const KeyType *keys, const std::size_t count, ValueType **items) const {
+  assert(count == 0 || (keys != nullptr && items != nullptr));
+
+  if (isEmpty()) {
+    for (std::size_t i = 0; i < count; ++i) {
+      items[i] = nullptr;
+    }
+    return 0;
+  }
+
+  // Three stages, PrefetchDistance keys apart: hash a key and prefetch its
+  // bucket, then prefetch the bucket's head item, then walk the chain. The
+  // hashes and chains of the keys ahead are kept in a ring:
+  constexpr std::size_t Window = 2 * PrefetchDistance;
+  std::size_t hashes[Window];
+  ValueType *const *chains[Window];
+
+  auto prefetchBucket = [&](const std::size_t i) {
+    const std::size_t keyHash = hashOf(keys[i]);
+    hashes[i % Window] = keyHash;
+    chains[i % Window] = chainOf(keyHash);
+    __builtin_prefetch(chains[i % Window]);
+  };
+  auto prefetchHead = [&](const std::size_t i) {
+    __builtin_prefetch(*chains[i % Window]);
+  };
+
+  for (std::size_t i = 0; i < count && i < Window; ++i) {
+    prefetchBucket(i);
+  }
+  for (std::size_t i = 0; i < count && i < PrefetchDistance; ++i) {
+    prefetchHead(i);
+  }
+
+  std::size_t foundCount = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    const std::size_t keyHash = hashes[i % Window];
+    items[i] = nullptr;
+    for (ValueType *item = *chains[i % Window]; item != nullptr;
+         item = item->htNext) {
+      if (isMatch(item, keyHash, keys[i])) {
+        items[i] = item;
+        ++foundCount;
+        break;
+      }
+    }
+
+    // The slot of key i is free for key i + Window:
+    if (i + Window < count) {
+      prefetchBucket(i + Window);
+    }
+    if (i + PrefetchDistance < count) {
+      prefetchHead(i + PrefetchDistance);
+    }
+  }
+
+  return foundCount;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+std::size_t IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::hashOf(
+    const KeyType &key) const {
   const std::size_t keyHash = KeyHasher()(key);
-  assert(keyHash != 0 && "Null hash indexes not allowed!");
-  return keyHash;
+  if (keyHash != 0) {
+    return keyHash;
+  }
+
+  // Zero marks unlinked items. Keys are compared, so any other hash will do:
+  assert(!IsHashOnly && "Null hash indexes not allowed!");
+  return 1;
 }
 
-template <class K, class V, class HASH>
-std::size_t
-IntrusiveHashTable<K, V, HASH>::bucketOf(const std::size_t keyHash) const {
-  const std::size_t bucket = keyHash % bucketCount;
-  assert(bucket < bucketCount && "Bucket index out-of-bounds!");
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+bool IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::isMatch(
+    const ValueType *item, const std::size_t keyHash, const KeyType &key) {
+  // Hashes first, a cheap filter ahead of key comparisons:
+  return keyHash == item->htKeyHash && KeyEqual()(*item, key);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+std::size_t IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::bucketOf(
+    const std::size_t keyHash, const std::size_t buckets) {
+  const std::size_t bucket = BucketPolicy::indexOf(keyHash, buckets);
+  assert(bucket < buckets && "Bucket index out-of-bounds!");
   return bucket;
 }
 
-template <class K, class V, class HASH>
-bool IntrusiveHashTable<K, V, HASH>::isPrime(const std::size_t x) {
-  if (((!(x & 1)) && x != 2) || (x < 2) || (x % 3 == 0 && x != 3)) {
-    return false;
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::ValueType **
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::chainOf(
+    const std::size_t keyHash) const {
+  // Buckets are migrated in index order, those not yet reached still hold
+  // their items in the old array:
+  if (isRehashing()) {
+    const std::size_t oldBucket = bucketOf(keyHash, oldBucketCount);
+    if (oldBucket >= migratedBuckets) {
+      return &oldTable[oldBucket];
+    }
   }
-  for (std::size_t k = 1; (36 * k * k - 12 * k) < x; ++k) {
-    if ((x % (6 * k + 1) == 0) || (x % (6 * k - 1) == 0)) {
-      return false;
+
+  return &table[bucketOf(keyHash, bucketCount)];
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+typename IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::ValueType **
+IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::allocateBuckets(
+    const std::size_t count) {
+  ValueType **buckets = BucketTraits::allocate(bucketAllocator, count);
+  for (std::size_t bucket = 0; bucket < count; ++bucket) {
+    buckets[bucket] = nullptr;
+  }
+  return buckets;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::freeBuckets(
+    ValueType **buckets, const std::size_t count) {
+  BucketTraits::deallocate(bucketAllocator, buckets, count);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::growIfNeeded() {
+  migrateBuckets(MigrationStep);
+
+  if (usedBuckets < bucketCount * MaxLoadFactor) {
+    return;
+  }
+
+  // Only when inserting faster than migrating, e.g. after a reserve():
+  finishRehash();
+  startRehash(bucketCount * 2);
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::startRehash(
+    const std::size_t newBucketCount) {
+  assert(!isRehashing() && "Previous rehash not finished!");
+
+  const std::size_t newCount = BucketPolicy::roundUp(newBucketCount);
+
+  oldTable = table;
+  oldBucketCount = bucketCount;
+  migratedBuckets = 0;
+
+  table = allocateBuckets(newCount);
+  bucketCount = newCount;
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::migrateBuckets(
+    const std::size_t maxBuckets) {
+  if (!isRehashing()) {
+    return;
+  }
+
+  const std::size_t lastBucket = oldBucketCount - migratedBuckets > maxBuckets
+                                    ? migratedBuckets + maxBuckets
+                                    : oldBucketCount;
+
+  // Move each item of the chain to the head of its new chain. Items of
+  // duplicate keys end up in the same new chain again:
+  for (; migratedBuckets < lastBucket; ++migratedBuckets) {
+    for (ValueType *item = oldTable[migratedBuckets]; item != nullptr;) {
+      ValueType *nextItem = item->htNext;
+      ValueType *&head = table[bucketOf(item->htKeyHash, bucketCount)];
+      item->htNext = head;
+      head = item;
+      item = nextItem;
     }
+    oldTable[migratedBuckets] = nullptr;
   }
-  return true;
+
+  if (migratedBuckets == oldBucketCount) {
+    freeBuckets(oldTable, oldBucketCount);
+    oldTable = nullptr;
+    oldBucketCount = 0;
+    migratedBuckets = 0;
+  }
+}
+
+template <class K, class V, class HASH, class EQUAL, class BUCKETS, class ALLOC>
+void IntrusiveHashTable<K, V, HASH, EQUAL, BUCKETS, ALLOC>::finishRehash() {
+  migrateBuckets(oldBucketCount);
 }
@@ -5,6 +5,6 @@ using namespace std;
 extern "C" {
     void add() {
         cout << "liba add" << endl << flush;
-        getCache().insert(42, 42);
+        boundCache(42).insert(42, 42);
     }
 }
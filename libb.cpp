@@ -6,7 +6,10 @@ extern "C" {
     int get() {
         cout << "libb get" << endl << flush;
         Cache::ConstAccessor accessor;
-        getCache().find(accessor, 42);
+        boundCache(42).find(accessor, 42);
+        if (accessor.empty()) {
+            return 0;
+        }
 
         return *accessor;
     }
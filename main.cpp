@@ -1,4 +1,6 @@
-#include <dlfcn.h>
+#include "plugin_loader.hpp"
+
+#include <cstdlib>
 #include <iostream>
 
 using namespace std;
@@ -8,26 +10,50 @@ using NOOP_FUNC = ADD_FUNC;
 
 int main() {
   cout << "start" << endl;
-  auto handle_a = dlopen("./liba.so", RTLD_LAZY);
-  auto handle_b = dlopen("./libb.so", RTLD_LAZY);
-  auto handle_no = dlopen("./libno.so", RTLD_LAZY);
 
-  if (!handle_a || !handle_b || !handle_no) {
-    cout << "dlopen failed" << endl << flush;
-    cout << dlerror() << endl;
-    return 42;
+  // nothing is opened yet, each plugin is dlopen()ed by its first lookup.
+  PluginLoader loader;
+  loader.add("a", "./liba.so");
+  loader.add("b", "./libb.so");
+  loader.add("no", "./libno.so");
+
+  // LRUC_PLUGIN_PRELINK=1 opens them all with RTLD_NOW on a background thread instead.
+  const char* prelink = getenv("LRUC_PLUGIN_PRELINK");
+  if (prelink != nullptr && *prelink == '1') {
+    loader.prelink();
   }
 
-  ADD_FUNC add = reinterpret_cast<ADD_FUNC>(dlsym(handle_a, "add"));
-  GET_FUNC get = reinterpret_cast<GET_FUNC>(dlsym(handle_b, "get"));
-  NOOP_FUNC noop = reinterpret_cast<NOOP_FUNC>(dlsym(handle_no, "noop"));
+  // call-time stubs: a plugin is only opened right before its first function is called, libno.so not
+  // before noop() is.
+  auto add = loader.lazyFunction<ADD_FUNC>("a", "add");
+  auto get = loader.lazyFunction<GET_FUNC>("b", "get");
+  auto noop = loader.lazyFunction<NOOP_FUNC>("no", "noop");
 
-  // cout << "dlsymed" << endl;
+  auto failed = [&loader] {
+    cout << "dlopen failed" << endl << flush;
+    loader.forEach([](const Plugin& plugin) {
+      if (!plugin.error().empty()) {
+        cout << plugin.error() << endl;
+      }
+    });
+    return 42;
+  };
 
+  if (!add) {
+    return failed();
+  }
   add();
   // cout << "add" << endl;
+
+  if (!get) {
+    return failed();
+  }
   cout << get() << endl << flush;
   // cout << "get" << endl;
+
+  if (!noop) {
+    return failed();
+  }
   noop();
   // cout << "noop" << endl;
 }
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <dlfcn.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Plugin is a shared object opened on first use: the first symbol() lookup dlopen()s it, so that a
+ * plugin never called costs nothing at startup, neither its own relocations nor loading its
+ * dependencies(libsingleton.so, libtbb).
+ *
+ * dlsym() results are cached by name, a repeated lookup is a hash-table hit instead of a walk of the
+ * plugin's dependency tree under the dynamic linker's lock.
+ *
+ * Thread-safe: a single mutex per plugin guards opening and the symbol table, so that a lookup racing
+ * PluginLoader::prelink() waits for the open in progress instead of opening twice.
+ *
+ */
+class Plugin final {
+ public:
+    Plugin(std::string name, std::string path) : name_(std::move(name)), path_(std::move(path)) {}
+
+    Plugin(const Plugin&) = delete;
+    Plugin& operator=(const Plugin&) = delete;
+
+    /**
+     * Not closed by default: function pointers handed out may outlive the loader, and plugins using
+     * libsingleton.so may have registered state with it.
+     *
+     */
+    ~Plugin() = default;
+
+    const std::string& name() const {
+        return name_;
+    }
+
+    const std::string& path() const {
+        return path_;
+    }
+
+    /**
+     * Address of symbol, opening the plugin with RTLD_LAZY first if needed.
+     * nullptr if the plugin cannot be opened or has no such symbol, error() tells why.
+     *
+     */
+    void* symbol(const std::string& symbol) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = symbols_.find(symbol);
+        if (it != symbols_.end()) {
+            return it->second;
+        }
+
+        if (!openLocked(RTLD_LAZY)) {
+            return nullptr;
+        }
+
+        // dlerror() must be cleared first, a symbol may legitimately be null.
+        dlerror();
+        void* address = dlsym(handle_, symbol.c_str());
+        if (const char* error = dlerror()) {
+            error_ = error;
+            return nullptr;
+        }
+
+        symbols_.emplace(symbol, address);
+        return address;
+    }
+
+    template <typename FN>
+    FN function(const std::string& symbol) {
+        return reinterpret_cast<FN>(this->symbol(symbol));
+    }
+
+    /**
+     * Opens the plugin now with flags, RTLD_NOW binding every function of it and of its dependencies
+     * at once. Does nothing if already open, whatever flags it was opened with.
+     *
+     */
+    bool open(int flags = RTLD_LAZY) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return openLocked(flags);
+    }
+
+    bool isOpen() const {
+        return open_.load(std::memory_order_acquire);
+    }
+
+    // time spent in dlopen(), loading, relocating and running the initializers of the plugin and its new dependencies.
+    std::chrono::nanoseconds openTime() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return openTime_;
+    }
+
+    // flags the plugin was opened with, 0 if not open.
+    int openFlags() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return openFlags_;
+    }
+
+    std::string error() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_;
+    }
+
+ private:
+    bool openLocked(int flags) {
+        if (handle_ != nullptr) {
+            return true;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        handle_ = dlopen(path_.c_str(), flags);
+        openTime_ = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        if (handle_ == nullptr) {
+            const char* error = dlerror();
+            error_ = error != nullptr ? error : "dlopen failed";
+            return false;
+        }
+
+        openFlags_ = flags;
+        open_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    const std::string name_;
+    const std::string path_;
+
+    mutable std::mutex mutex_;
+    void* handle_ = nullptr;
+    std::unordered_map<std::string, void*> symbols_;
+    std::chrono::nanoseconds openTime_{0};
+    int openFlags_ = 0;
+    std::string error_;
+    std::atomic<bool> open_{false};
+};
+
+template <typename FN>
+class LazyFunction;
+
+/**
+ * LazyFunction is a call-time stub of a plugin function: nothing is looked up when it is created, its first
+ * call or resolve() opens the plugin and looks the symbol up, later calls go straight to the cached address.
+ * A process thus only opens the plugins of the functions it actually calls, when it first calls them.
+ *
+ * Calling it requires the function to resolve: test resolve() or operator bool first where a plugin may be
+ * missing, the Plugin's error() tells why it is not.
+ *
+ * Thread-safe, racing first calls resolve the same address. The Plugin must outlive the stub.
+ *
+ */
+template <typename R, typename... Args>
+class LazyFunction<R (*)(Args...)> final {
+ public:
+    using Function = R (*)(Args...);
+
+    // plugin may be nullptr, the stub never resolves then.
+    LazyFunction(Plugin* plugin, std::string symbol) : plugin_(plugin), symbol_(std::move(symbol)) {}
+
+    LazyFunction(const LazyFunction&) = delete;
+    LazyFunction& operator=(const LazyFunction&) = delete;
+
+    // address of the function, looked up on first call, nullptr if the plugin or the symbol is missing.
+    Function resolve() {
+        Function function = function_.load(std::memory_order_acquire);
+        if (function == nullptr && plugin_ != nullptr) {
+            function = plugin_->function<Function>(symbol_);
+            function_.store(function, std::memory_order_release);
+        }
+
+        return function;
+    }
+
+    explicit operator bool() {
+        return resolve() != nullptr;
+    }
+
+    R operator()(Args... args) {
+        return resolve()(std::forward<Args>(args)...);
+    }
+
+ private:
+    Plugin* const plugin_;
+    const std::string symbol_;
+    std::atomic<Function> function_{nullptr};
+};
+
+/**
+ * PluginLoader keeps the plugins of a process by name, each opened on first use, see Plugin.
+ *
+ * prelink() opens the plugins not yet used with RTLD_NOW on a background thread: startup goes on
+ * while relocations are done off the critical path, and a later first call no longer pays for lazy
+ * binding. The dynamic linker serializes dlopen() calls, a lookup of an unopened plugin meanwhile
+ * may wait behind the background thread.
+ *
+ * add() and get() are not thread-safe with each other, plugins are expected to be registered at startup.
+ *
+ */
+class PluginLoader final {
+ public:
+    PluginLoader() = default;
+
+    PluginLoader(const PluginLoader&) = delete;
+    PluginLoader& operator=(const PluginLoader&) = delete;
+
+    ~PluginLoader() {
+        wait();
+    }
+
+    // registers the plugin at path under name without opening it, or returns the one already registered.
+    Plugin& add(const std::string& name, const std::string& path) {
+        auto it = plugins_.find(name);
+        if (it == plugins_.end()) {
+            it = plugins_.emplace(name, std::make_unique<Plugin>(name, path)).first;
+        }
+
+        return *it->second;
+    }
+
+    // plugin registered under name, nullptr if none.
+    Plugin* get(const std::string& name) const {
+        auto it = plugins_.find(name);
+        return it != plugins_.end() ? it->second.get() : nullptr;
+    }
+
+    // address of symbol in plugin name, nullptr if unknown.
+    void* symbol(const std::string& name, const std::string& symbol) {
+        Plugin* plugin = get(name);
+        return plugin != nullptr ? plugin->symbol(symbol) : nullptr;
+    }
+
+    template <typename FN>
+    FN function(const std::string& name, const std::string& symbol) {
+        return reinterpret_cast<FN>(this->symbol(name, symbol));
+    }
+
+    // call-time stub of symbol in plugin name, which is neither opened nor looked up until first called.
+    template <typename FN>
+    LazyFunction<FN> lazyFunction(const std::string& name, const std::string& symbol) const {
+        return LazyFunction<FN>(get(name), symbol);
+    }
+
+    /**
+     * Starts opening the plugins registered so far with flags on a background thread, in name order.
+     * Plugins already open are left alone. Waits for a previous prelink() first.
+     *
+     */
+    void prelink(int flags = RTLD_NOW) {
+        wait();
+
+        std::vector<Plugin*> plugins;
+        plugins.reserve(plugins_.size());
+        for (const auto& plugin : plugins_) {
+            plugins.push_back(plugin.second.get());
+        }
+
+        prelinker_ = std::thread([plugins = std::move(plugins), flags] {
+            for (Plugin* plugin : plugins) {
+                plugin->open(flags);
+            }
+        });
+    }
+
+    // waits for prelink() to be done.
+    void wait() {
+        if (prelinker_.joinable()) {
+            prelinker_.join();
+        }
+    }
+
+    template <typename FN>
+    void forEach(FN&& fn) const {
+        for (const auto& plugin : plugins_) {
+            fn(static_cast<const Plugin&>(*plugin.second));
+        }
+    }
+
+ private:
+    std::map<std::string, std::unique_ptr<Plugin>> plugins_;
+    std::thread prelinker_;
+};
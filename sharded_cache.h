@@ -0,0 +1,522 @@
+#pragma once
+
+#include "cache.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace LRUC {
+
+/**
+ * ShardedLRUCache is a thread-safe LRU cache made of NShards independent LRUCache shards.
+ *
+ * Each key is routed by its hash to exactly one shard. Every shard owns its own hash-table,
+ * double-linked list, list mutex and a slice of the total capacity, thus threads working on
+ * different shards never contend on the same listMutex_.
+ *
+ * The interface mirrors LRUCache(ConstAccessor, PinnedAccessor, find(), insert(), erase(), clear(),
+ * size(), capacity(), setCapacity()), so switching a plugin from LRUCache is a typedef change.
+ *
+ * Eviction is per shard: when a shard is full, insert() evicts the least recently used key of
+ * that shard, which is not necessarily the least recently used key of the whole cache.
+ *
+ * Policy selects the recency tracking of every shard, see EvictionPolicy.
+ *
+ * TWeigher measures entries against the max weight, split among shards like the capacity, see UnitWeigher.
+ *
+ * WithStats enables stats(), counters are summed over all shards, see CacheStats.
+ *
+ * TAllocator backs the per-entry memory of every shard, see LRUCache.
+ *
+ * Type concepts:
+ * Same as LRUCache.
+ * NShards must be greater than zero.
+ *
+ * ShardedLRUCache is C++17 compatible
+ *
+ */
+
+template <typename TKey,
+          typename TValue,
+          typename THash = tbb::tbb_hash_compare<TKey>,
+          size_t NShards = 16,
+          EvictionPolicy Policy = EvictionPolicy::LRU,
+          typename TWeigher = UnitWeigher,
+          bool WithStats = false,
+          typename TAllocator = tbb::tbb_allocator<TValue>>
+class ShardedLRUCache final {
+  static_assert(NShards > 0, "ShardedLRUCache requires at least one shard");
+
+ private:
+  // type defs
+  using Shard = LRUCache<TKey, TValue, THash, Policy, TWeigher, WithStats, TAllocator>;
+
+ private:
+  // data members
+  THash hasher_;
+  std::array<std::unique_ptr<Shard>, NShards> shards_;
+
+  /**
+   * cache capacity, sum of all shard capacities.
+   *
+   */
+  std::atomic<int> capacity_;
+
+  /**
+   * cache weight budget, sum of all shard weight budgets.
+   *
+   */
+  const size_t maxWeight_;
+
+ private:
+  /**
+   * Route key to its shard.
+   *
+   * The shard hash-table buckets are indexed by the low-order bits of the hash code, so the
+   * shard index is taken from the high-order bits of the mixed hash code to keep both
+   * distributions independent.
+   *
+   */
+  size_t shardIndex(const TKey& key) const;
+
+  Shard& shardOf(const TKey& key) const {
+    return *shards_[shardIndex(key)];
+  }
+
+  /**
+   * Total capacity for size: at least one entry per shard, a shard of capacity 0 would miss every key
+   * routed to it.
+   *
+   */
+  static int totalCapacity(int size) {
+    return std::max(size, static_cast<int>(NShards));
+  }
+
+  /**
+   * Capacity of the shard at index out of the total size, the remainder goes to the first shards.
+   *
+   */
+  static int shardCapacity(int size, size_t index) {
+    const int total = totalCapacity(size);
+    return total / static_cast<int>(NShards) + (static_cast<int>(index) < total % static_cast<int>(NShards) ? 1 : 0);
+  }
+
+ public:
+  using ConstAccessor = typename Shard::ConstAccessor;
+  using PinnedAccessor = typename Shard::PinnedAccessor;
+  using Duration = typename Shard::Duration;
+  using allocator_type = TAllocator;
+
+  /**
+   * size: total capacity of the cache, split evenly among shards. Raised to NShards if lower, so that
+   * every shard caches at least one entry.
+   *
+   * bucketCount: total initial bucket count, split evenly among shards.
+   *
+   * maxWeight: total weight budget, split evenly among shards. Unbounded by default.
+   *
+   * allocator: copied into every shard, see LRUCache::allocator_type.
+   */
+  explicit ShardedLRUCache(int size,
+                           size_t bucketCount = std::thread::hardware_concurrency() * 8,
+                           size_t maxWeight = std::numeric_limits<size_t>::max(),
+                           const TAllocator& allocator = TAllocator());
+
+  ShardedLRUCache(const ShardedLRUCache& other) = delete;
+  ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+
+  /**
+   * erase removes key from its shard along with its value.
+   * returns number of elements removed (0 or 1).
+   *
+   */
+  size_t erase(const TKey& key) {
+    return shardOf(key).erase(key);
+  }
+
+  /**
+   * find finds data inside the key's shard.
+   * See LRUCache::find.
+   *
+   */
+  bool find(ConstAccessor& ac, const TKey& key) {
+    return shardOf(key).find(ac, key);
+  }
+
+  /**
+   * find finds data inside the key's shard without copying it.
+   * See LRUCache::find.
+   *
+   */
+  bool find(PinnedAccessor& ac, const TKey& key) {
+    return shardOf(key).find(ac, key);
+  }
+
+  /**
+   * insert key/value into the key's shard.
+   * See LRUCache::insert.
+   *
+   */
+  bool insert(const TKey& key, const TValue& value) {
+    return shardOf(key).insert(key, value);
+  }
+
+  bool insert(TKey&& key, TValue&& value) {
+    Shard& shard = shardOf(key);
+    return shard.insert(std::move(key), std::move(value));
+  }
+
+  bool insert(const TKey& key, const TValue& value, Duration ttl) {
+    return shardOf(key).insert(key, value, ttl);
+  }
+
+  bool insert(TKey&& key, TValue&& value, Duration ttl) {
+    Shard& shard = shardOf(key);
+    return shard.insert(std::move(key), std::move(value), ttl);
+  }
+
+  /**
+   * emplace inserts key with the value constructed in place inside the key's shard.
+   * See LRUCache::emplace.
+   *
+   */
+  template <typename... Args>
+  bool emplace(const TKey& key, Args&&... args) {
+    return shardOf(key).emplace(key, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  bool emplace(TKey&& key, Args&&... args) {
+    Shard& shard = shardOf(key);
+    return shard.emplace(std::move(key), std::forward<Args>(args)...);
+  }
+
+  /**
+   * insert_or_assign inserts key/value into the key's shard, or assigns value to the existing key.
+   * See LRUCache::insert_or_assign.
+   *
+   */
+  template <typename M>
+  bool insert_or_assign(const TKey& key, M&& value) {
+    return shardOf(key).insert_or_assign(key, std::forward<M>(value));
+  }
+
+  template <typename M>
+  bool insert_or_assign(TKey&& key, M&& value) {
+    Shard& shard = shardOf(key);
+    return shard.insert_or_assign(std::move(key), std::forward<M>(value));
+  }
+
+  template <typename M>
+  bool insert_or_assign(const TKey& key, M&& value, Duration ttl) {
+    return shardOf(key).insert_or_assign(key, std::forward<M>(value), ttl);
+  }
+
+  template <typename M>
+  bool insert_or_assign(TKey&& key, M&& value, Duration ttl) {
+    Shard& shard = shardOf(key);
+    return shard.insert_or_assign(std::move(key), std::forward<M>(value), ttl);
+  }
+
+  /**
+   * get_or_load finds key inside its shard, or inserts it with the value returned by loader(key).
+   * See LRUCache::get_or_load.
+   *
+   */
+  template <typename F>
+  bool get_or_load(ConstAccessor& ac, const TKey& key, F&& loader) {
+    return shardOf(key).get_or_load(ac, key, std::forward<F>(loader));
+  }
+
+  template <typename F>
+  bool get_or_load(ConstAccessor& ac, const TKey& key, F&& loader, Duration ttl) {
+    return shardOf(key).get_or_load(ac, key, std::forward<F>(loader), ttl);
+  }
+
+  /**
+   * setRefreshAhead enables refresh-ahead in every shard, each shard reloads on its own pool of
+   * maxConcurrency threads.
+   * See LRUCache::setRefreshAhead.
+   *
+   */
+  void setRefreshAhead(Duration window,
+                       Duration ttl,
+                       const std::function<TValue(const TKey&)>& loader,
+                       int maxConcurrency = 1) {
+    for (auto& shard : shards_) {
+      shard->setRefreshAhead(window, ttl, loader, maxConcurrency);
+    }
+  }
+
+  /**
+   * clearRefreshAhead disables refresh-ahead in every shard.
+   * See LRUCache::clearRefreshAhead.
+   *
+   */
+  void clearRefreshAhead() {
+    for (auto& shard : shards_) {
+      shard->clearRefreshAhead();
+    }
+  }
+
+  /**
+   * expire evicts up to maxCount expired entries from every shard.
+   * Return number of entries evicted.
+   * See LRUCache::expire.
+   *
+   */
+  size_t expire(size_t maxCount = Shard::EvictionBatch);
+
+  /**
+   * clear erases all elements from all shards.
+   * Not thread-safe.
+   *
+   */
+  void clear() noexcept;
+
+  /**
+   * size returns the current cache size, sum of all shard sizes.
+   * The sum is not a snapshot under concurrent modification.
+   *
+   */
+  int size() const;
+
+  /**
+   * weight returns the total weight of the cached entries, sum of all shard weights.
+   * The sum is not a snapshot under concurrent modification.
+   *
+   */
+  size_t weight() const;
+
+  /**
+   * capacity returns the cache capacity.
+   *
+   */
+  int capacity() const {
+    return capacity_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * setCapacity changes the cache capacity, split evenly among shards, at least NShards.
+   * See LRUCache::setCapacity.
+   *
+   */
+  void setCapacity(int size);
+
+  /**
+   * trim evicts up to maxCount values in excess of the capacity from every shard.
+   * Return number of values evicted.
+   * See LRUCache::trim.
+   *
+   */
+  int trim(int maxCount = Shard::EvictionBatch);
+
+  /**
+   * maxWeight returns the cache weight budget.
+   *
+   */
+  constexpr size_t maxWeight() const {
+    return maxWeight_;
+  }
+
+  /**
+   * stats returns a snapshot of the counters summed over all shards.
+   * See LRUCache::stats.
+   *
+   */
+  CacheStats stats() const {
+    CacheStats stats;
+    for (const auto& shard : shards_) {
+      stats += shard->stats();
+    }
+
+    return stats;
+  }
+
+  /**
+   * save writes the entries of every shard to a single snapshot file at path, the shards' recency orders
+   * interleaved: the hottest entry of every shard, then the second hottest of every shard, and so on.
+   * Thus any leading part of the file holds about the same hottest share of every shard, which is what
+   * load() into a smaller cache keeps.
+   * See LRUCache::save.
+   *
+   */
+  template <typename TSerializer = TrivialSerializer>
+  bool save(const std::string& path, const TSerializer& serializer = TSerializer());
+
+  /**
+   * load inserts the entries of the snapshot file at path into their shards, up to capacity of them,
+   * hottest first in the file. Each shard gets its records through a single insert_many().
+   * The snapshot may have been saved by a cache of another shard count, or by an LRUCache.
+   * See LRUCache::load.
+   *
+   */
+  template <typename TSerializer = TrivialSerializer>
+  size_t load(const std::string& path, const TSerializer& serializer = TSerializer());
+
+  /**
+   * shardCount returns the number of shards.
+   *
+   */
+  static constexpr size_t shardCount() {
+    return NShards;
+  }
+};
+
+// ---- private member functions ----
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::shardIndex(
+  const TKey& key) const {
+  // Fibonacci hashing, spreads identity hashes(e.g. tbb_hash_compare<int>) over the high-order bits.
+  const uint64_t mixed = static_cast<uint64_t>(hasher_.hash(key)) * 0x9E3779B97F4A7C15ull;
+  return static_cast<size_t>((mixed >> 32) % NShards);
+}
+
+// ---- private member functions end ----
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::ShardedLRUCache(
+    int size, size_t bucketCount, size_t maxWeight, const TAllocator& allocator)
+  : capacity_(totalCapacity(size)), maxWeight_(maxWeight) {
+  const size_t shardBucketCount = bucketCount / NShards > 0 ? bucketCount / NShards : 1;
+
+  // an unbounded budget stays unbounded in every shard.
+  const bool unbounded = maxWeight == std::numeric_limits<size_t>::max();
+  const size_t shardMaxWeight = unbounded ? maxWeight : maxWeight / NShards;
+  const size_t weightRemainder = unbounded ? 0 : maxWeight % NShards;
+
+  for (size_t i = 0; i < NShards; ++i) {
+    shards_[i] = std::make_unique<Shard>(shardCapacity(size, i),
+                                         shardBucketCount,
+                                         shardMaxWeight + (i < weightRemainder ? 1 : 0),
+                                         allocator);
+  }
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::setCapacity(int size) {
+  capacity_.store(totalCapacity(size), std::memory_order_relaxed);
+  for (size_t i = 0; i < NShards; ++i) {
+    shards_[i]->setCapacity(shardCapacity(size, i));
+  }
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+int ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::trim(int maxCount) {
+  int count = 0;
+  for (auto& shard : shards_) {
+    count += shard->trim(maxCount);
+  }
+
+  return count;
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::expire(size_t maxCount) {
+  size_t count = 0;
+  for (auto& shard : shards_) {
+    count += shard->expire(maxCount);
+  }
+
+  return count;
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+void ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::clear() noexcept {
+  for (auto& shard : shards_) {
+    shard->clear();
+  }
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+int ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::size() const {
+  int size = 0;
+  for (const auto& shard : shards_) {
+    size += shard->size();
+  }
+
+  return size;
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+size_t ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::weight() const {
+  size_t weight = 0;
+  for (const auto& shard : shards_) {
+    weight += shard->weight();
+  }
+
+  return weight;
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename TSerializer>
+bool ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::save(
+  const std::string& path, const TSerializer& serializer) {
+  std::array<std::vector<TKey>, NShards> keys;
+  size_t maxSize = 0;
+  for (size_t i = 0; i < NShards; ++i) {
+    keys[i] = shards_[i]->hotKeys();
+    maxSize = std::max(maxSize, keys[i].size());
+  }
+
+  SnapshotWriter writer(path);
+  for (size_t rank = 0; rank < maxSize; ++rank) {
+    for (size_t i = 0; i < NShards; ++i) {
+      if (rank < keys[i].size()) {
+        shards_[i]->saveEntry(writer, keys[i][rank], serializer);
+      }
+    }
+  }
+
+  return writer.commit();
+}
+
+template <class TKey, class TValue, class THash, size_t NShards, EvictionPolicy Policy, class TWeigher, bool WithStats,
+          class TAllocator>
+template <typename TSerializer>
+size_t ShardedLRUCache<TKey, TValue, THash, NShards, Policy, TWeigher, WithStats, TAllocator>::load(
+  const std::string& path, const TSerializer& serializer) {
+  struct Records final {
+    std::vector<TKey> keys_;
+    std::vector<TValue> values_;
+    std::vector<Duration> ttls_;
+  };
+
+  const SnapshotReader reader(path);
+  const size_t maxCount = static_cast<size_t>(std::max(capacity(), 0));
+
+  std::array<Records, NShards> records;
+  reader.forEachColdestFirst<TKey, TValue>(maxCount, serializer, [&](TKey&& key, TValue&& value, int64_t ttl) {
+    Records& shard = records[shardIndex(key)];
+    shard.keys_.push_back(std::move(key));
+    shard.values_.push_back(std::move(value));
+    shard.ttls_.push_back(std::chrono::nanoseconds(ttl));
+  });
+
+  size_t count = 0;
+  for (size_t i = 0; i < NShards; ++i) {
+    const Records& shard = records[i];
+    count += shards_[i]->insert_many(shard.keys_.data(), shard.values_.data(), shard.keys_.size(), shard.ttls_.data());
+  }
+
+  return count;
+}
+}  // namespace LRUC
@@ -1,7 +1,163 @@
 #include "singleton.hpp"
 
+#include <sched.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace {
+
+// total capacity, of every replica or split among partitions. Cache being a FlatLRUCache, each one rounds
+// its share up to a power of two number of sets of Cache::Ways entries: 4242 is 1024 sets of 6, 6144
+// entries, on a single node. Eviction is per set, it may start well before a Cache holds that many.
+constexpr int Capacity = 4242;
+
+// number of NUMA nodes, 1 if unknown. LRUC_NUMA_NODES overrides it, e.g. to run several Caches on a single node.
+size_t numaNodeCount() {
+    if (const char* forced = std::getenv("LRUC_NUMA_NODES")) {
+        const unsigned long count = std::strtoul(forced, nullptr, 10);
+        if (count > 0) {
+            return count;
+        }
+    }
+
+    // e.g. "0-1", or "0" on a single-node machine.
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodes;
+    if (!std::getline(online, nodes) || nodes.empty()) {
+        return 1;
+    }
+
+    const size_t last = nodes.find_last_of("-,");
+    return std::strtoul(nodes.c_str() + (last == std::string::npos ? 0 : last + 1), nullptr, 10) + 1;
+}
+
+CachePlacement placementFromEnvironment() {
+    const char* placement = std::getenv("LRUC_NUMA_PLACEMENT");
+    if (placement != nullptr && std::strcmp(placement, "replicated") == 0) {
+        return CachePlacement::Replicated;
+    }
+
+    return CachePlacement::Partitioned;
+}
+
+class NumaCaches final {
+ public:
+    NumaCaches() : placement_(placementFromEnvironment()), count_(numaNodeCount()), nodes_(new Node[count_]) {}
+
+    CachePlacement placement() const {
+        return placement_;
+    }
+
+    size_t count() const {
+        return count_;
+    }
+
+    Cache& at(size_t node) {
+        Node& n = nodes_[node];
+        if (Cache* cache = n.ready_.load(std::memory_order_acquire)) {
+            return *cache;
+        }
+
+        std::call_once(n.once_, [this, &n] {
+            const int capacity = placement_ == CachePlacement::Partitioned
+                                   ? static_cast<int>((Capacity + count_ - 1) / count_)
+                                   : Capacity;
+            n.cache_ = std::make_unique<Cache>(capacity);
+            n.ready_.store(n.cache_.get(), std::memory_order_release);
+        });
+
+        return *n.cache_;
+    }
+
+    // node of the calling thread, it may have moved by the time the Cache is used, which only costs locality.
+    size_t localNode() const {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (count_ == 1 || ::getcpu(&cpu, &node) != 0 || node >= count_) {
+            return 0;
+        }
+
+        return node;
+    }
+
+    // home node of key when Partitioned, Fibonacci hashing like ShardedLRUCache.
+    size_t homeNode(int key) const {
+        const uint64_t mixed = static_cast<uint64_t>(static_cast<uint32_t>(key)) * 0x9E3779B97F4A7C15ull;
+        return (mixed >> 32) % count_;
+    }
+
+ private:
+    // once_ guards construction by the first thread on the node, nodes never share a cache line.
+    // ready_ spares later calls std::call_once(), which sets thread-locals before even checking the flag.
+    struct alignas(64) Node {
+        std::atomic<Cache*> ready_{nullptr};
+        std::once_flag once_;
+        std::unique_ptr<Cache> cache_;
+    };
+
+    const CachePlacement placement_;
+    const size_t count_;
+    const std::unique_ptr<Node[]> nodes_;
+};
+
+NumaCaches& numaCaches() {
+    static NumaCaches caches;
+
+    return caches;
+}
+
+}  // namespace
+
 Cache& getCache() noexcept {
-    static Cache c{4242};
+    NumaCaches& caches = numaCaches();
+    // the same Cache whichever node calls, so that callers at least share it.
+    if (caches.placement() == CachePlacement::Partitioned) {
+        return caches.at(0);
+    }
+
+    return caches.at(caches.localNode());
+}
+
+Cache& getCache(int key) noexcept {
+    NumaCaches& caches = numaCaches();
+    if (caches.placement() == CachePlacement::Partitioned) {
+        return caches.at(caches.homeNode(key));
+    }
+
+    return caches.at(caches.localNode());
+}
+
+Cache& getCacheAt(size_t node) noexcept {
+    return numaCaches().at(node);
+}
+
+size_t getCacheCount() noexcept {
+    return numaCaches().count();
+}
+
+CachePlacement getCachePlacement() noexcept {
+    return numaCaches().placement();
+}
+
+Cache& bindCache(int key, std::atomic<Cache*>& binding) noexcept {
+    NumaCaches& caches = numaCaches();
+    // the Cache of a key depends on the calling thread's node or on the key itself, a single binding per DSO
+    // would pin every thread to the node of the first caller.
+    if (caches.count() > 1) {
+        return getCache(key);
+    }
 
-    return c;
+    // release: another thread of the DSO may load the binding without ever calling getCache() itself, the
+    // construction of the Cache by caches.at() must happen before its use there. Racing first calls store
+    // the same Cache.
+    Cache& cache = caches.at(0);
+    binding.store(&cache, std::memory_order_release);
+    return cache;
 }
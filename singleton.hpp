@@ -1,9 +1,74 @@
 #pragma once
-#include "cache.h"
+#include "flat_cache.h"
+
+#include <atomic>
+#include <cstddef>
 
 using namespace LRUC;
 
-using Cache = LRUCache<int, int>;
+using Cache = LRUCacheFor<int, int>;
+
+/**
+ * CachePlacement spreads the process-wide cache over the NUMA nodes, one Cache per node, created by the
+ * first thread asking for it on that node so that its memory is node-local(first touch).
+ *
+ * Partitioned: every key has a home node, the capacity is split among nodes. A key is cached once,
+ *  so that the Caches behave as the single shared cache of the process, hits by threads of other nodes
+ *  are remote.
+ * Replicated: every node caches any key, hits are always served from local memory. Replicas are
+ *  independent caches of the full capacity: an insert is only seen by threads of the same node, and
+ *  stale values must be erased from every replica, see getCacheAt(). Only for read-mostly data whose
+ *  values never change once inserted.
+ *
+ * Selected at first use by the LRUC_NUMA_PLACEMENT environment variable, "partitioned"(default) or
+ * "replicated" to opt in. A single-node machine has a single Cache either way, LRUC_NUMA_NODES=n forces
+ * n Caches, e.g. to test the multi-node paths on one node.
+ *
+ */
+enum class CachePlacement { Replicated, Partitioned };
+
+/**
+ * The Cache of the calling thread's node if Replicated, a single fixed one(node 0's) if Partitioned.
+ * Unsafe for keyed data: Partitioned on more than one node, a key inserted through it is missed by
+ * getCache(key) and boundCache(key), which use the key's home node. Deprecated, use getCache(key).
+ *
+ */
+[[deprecated("not the Cache holding a key when Partitioned, use getCache(key)")]] Cache& getCache() noexcept;
+
+// Cache holding key: the local replica if Replicated, the home node's Cache if Partitioned.
+Cache& getCache(int key) noexcept;
+
+// Cache of NUMA node node, node < getCacheCount().
+Cache& getCacheAt(size_t node) noexcept;
+
+// Number of Caches, one per NUMA node.
+size_t getCacheCount() noexcept;
+
+CachePlacement getCachePlacement() noexcept;
+
+/**
+ * getCache(key), also storing into binding the Cache that serves every key from every node, if any: only
+ * when there is a single Cache. See boundCache().
+ *
+ */
+Cache& bindCache(int key, std::atomic<Cache*>& binding) noexcept;
 
-Cache& getCache() noexcept;
+namespace detail {
+// hidden: every DSO including this header has a copy of its own, read with a plain PC-relative load,
+// neither PLT call nor static guard check. Constant-initialized, bound by the DSO's first boundCache().
+__attribute__((visibility("hidden"))) inline std::atomic<Cache*> boundCache{nullptr};
+}  // namespace detail
 
+/**
+ * getCache(key) for hot paths of plugins: its first call resolves the Cache through libsingleton.so,
+ * later ones load it from the DSO's own binding. Only bound when getCacheCount() == 1: with more than one
+ * node, the Cache depends on the calling thread's node(Replicated) or on the key(Partitioned), and every
+ * call is getCache(key), so that every DSO reaches the same Cache for a given thread and key.
+ * Hidden like its binding, so that a call is never routed through the PLT to another DSO's copy.
+ *
+ */
+__attribute__((visibility("hidden"))) inline Cache& boundCache(int key) noexcept {
+    // acquire: pairs with bindCache()'s release, see there.
+    Cache* cache = detail::boundCache.load(std::memory_order_acquire);
+    return cache != nullptr ? *cache : bindCache(key, detail::boundCache);
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace LRUC {
+
+/**
+ * TrivialSerializer is the default serializer of cache snapshots, see LRUCache::save().
+ *
+ * A serializer converts keys and values to bytes and back:
+ *  serialize(const T& value, std::vector<char>& out) appends the bytes of value to out.
+ *  deserialize(const char* data, size_t size, T& value) reads value back from exactly size bytes,
+ *   returns false if they are malformed, the record is then skipped.
+ *
+ * TrivialSerializer copies the object representation of trivially copyable types and the characters of
+ * std::string. Provide another serializer for other types, or for snapshots read by other builds.
+ *
+ */
+struct TrivialSerializer final {
+  template <typename T>
+  void serialize(const T& value, std::vector<char>& out) const {
+    static_assert(std::is_trivially_copyable_v<T>, "TrivialSerializer requires a trivially copyable type");
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+  }
+
+  void serialize(const std::string& value, std::vector<char>& out) const {
+    out.insert(out.end(), value.begin(), value.end());
+  }
+
+  template <typename T>
+  bool deserialize(const char* data, size_t size, T& value) const {
+    static_assert(std::is_trivially_copyable_v<T>, "TrivialSerializer requires a trivially copyable type");
+    if (size != sizeof(T)) {
+      return false;
+    }
+
+    std::memcpy(static_cast<void*>(&value), data, sizeof(T));
+    return true;
+  }
+
+  bool deserialize(const char* data, size_t size, std::string& value) const {
+    value.assign(data, size);
+    return true;
+  }
+};
+
+/**
+ * Snapshot file layout, native byte order:
+ *  SnapshotHeader, then SnapshotHeader::count_ records, hottest first.
+ *  A record is a SnapshotRecordHeader followed by the key bytes and the value bytes.
+ *
+ */
+struct SnapshotHeader final {
+  static constexpr uint32_t Magic = 0x4355524C;  // "LRUC"
+  static constexpr uint32_t Version = 1;
+
+  uint32_t magic_;
+  uint32_t version_;
+  uint64_t count_;
+
+  // system clock time of the save in nanoseconds, remaining times to live are counted from it.
+  int64_t savedAt_;
+};
+
+struct SnapshotRecordHeader final {
+  uint32_t keySize_;
+  uint32_t valueSize_;
+
+  // remaining time to live in nanoseconds at save time, 0 if the entry never expires.
+  int64_t ttl_;
+};
+
+// system clock time in nanoseconds, survives restarts unlike the steady clock.
+inline int64_t snapshotClockNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+    .count();
+}
+
+/**
+ * SnapshotWriter writes a snapshot file record by record.
+ *
+ * Records are buffered and written to a temporary file next to path, which only replaces path once
+ * commit() succeeded: readers never observe a partial snapshot, and a failed save keeps the previous one.
+ *
+ * Not thread-safe.
+ *
+ */
+class SnapshotWriter final {
+ public:
+  explicit SnapshotWriter(std::string path) : path_(std::move(path)), tmpPath_(path_ + ".tmp") {
+    fd_ = ::open(tmpPath_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    // room for the header, written by commit() once the count is known.
+    buffer_.resize(sizeof(SnapshotHeader));
+  }
+
+  ~SnapshotWriter() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      ::unlink(tmpPath_.c_str());
+    }
+  }
+
+  SnapshotWriter(const SnapshotWriter&) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+  /**
+   * append a record of key and value, expiring ttl nanoseconds after the save(0 if never).
+   * Return false if the record is too large and was skipped.
+   *
+   */
+  template <typename TKey, typename TValue, typename TSerializer>
+  bool append(const TKey& key, const TValue& value, int64_t ttl, const TSerializer& serializer) {
+    const size_t start = buffer_.size();
+    buffer_.resize(start + sizeof(SnapshotRecordHeader));
+    serializer.serialize(key, buffer_);
+    const size_t keyEnd = buffer_.size();
+    serializer.serialize(value, buffer_);
+
+    const size_t keySize = keyEnd - start - sizeof(SnapshotRecordHeader);
+    const size_t valueSize = buffer_.size() - keyEnd;
+    if (keySize > std::numeric_limits<uint32_t>::max() || valueSize > std::numeric_limits<uint32_t>::max()) {
+      buffer_.resize(start);
+      return false;
+    }
+
+    const SnapshotRecordHeader header{static_cast<uint32_t>(keySize), static_cast<uint32_t>(valueSize), ttl};
+    std::memcpy(buffer_.data() + start, &header, sizeof(header));
+    ++count_;
+
+    if (buffer_.size() >= FlushSize) {
+      flush();
+    }
+
+    return true;
+  }
+
+  /**
+   * commit writes the pending records and the header, then replaces path with the snapshot.
+   * Return false on any I/O failure, path is then left untouched.
+   *
+   */
+  bool commit() {
+    if (fd_ < 0) {
+      return false;
+    }
+
+    const SnapshotHeader header{SnapshotHeader::Magic, SnapshotHeader::Version, count_, snapshotClockNow()};
+
+    bool ok = flush() && ::pwrite(fd_, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+              ::fsync(fd_) == 0;
+    ok = ::close(fd_) == 0 && ok;
+    fd_ = -1;
+
+    if (!ok || ::rename(tmpPath_.c_str(), path_.c_str()) != 0) {
+      ::unlink(tmpPath_.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  // number of records appended.
+  uint64_t count() const {
+    return count_;
+  }
+
+ private:
+  static constexpr size_t FlushSize = 1 << 20;
+
+  // write the buffered bytes, false once a write failed.
+  bool flush() {
+    if (failed_ || fd_ < 0) {
+      return false;
+    }
+
+    for (size_t written = 0; written < buffer_.size();) {
+      const ssize_t n = ::write(fd_, buffer_.data() + written, buffer_.size() - written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (n <= 0) {
+        failed_ = true;
+        return false;
+      }
+
+      written += static_cast<size_t>(n);
+    }
+
+    buffer_.clear();
+    return true;
+  }
+
+ private:
+  const std::string path_;
+  const std::string tmpPath_;
+  int fd_{-1};
+  bool failed_{false};
+  uint64_t count_{0};
+  std::vector<char> buffer_;
+};
+
+/**
+ * SnapshotReader maps a snapshot file read-only.
+ *
+ * A missing, truncated or foreign file is not an error: ok() is false, or the records are read up to the
+ * first malformed one.
+ *
+ */
+class SnapshotReader final {
+ public:
+  explicit SnapshotReader(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+
+    struct stat st {};
+    if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(SnapshotHeader)) {
+      void* data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const char*>(data);
+        size_ = static_cast<size_t>(st.st_size);
+        ::madvise(data, size_, MADV_WILLNEED);
+      }
+    }
+
+    ::close(fd);
+
+    if (data_ != nullptr) {
+      std::memcpy(&header_, data_, sizeof(header_));
+    }
+  }
+
+  ~SnapshotReader() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  SnapshotReader(const SnapshotReader&) = delete;
+  SnapshotReader& operator=(const SnapshotReader&) = delete;
+
+  // true if the file is a snapshot of this format.
+  bool ok() const {
+    return data_ != nullptr && header_.magic_ == SnapshotHeader::Magic && header_.version_ == SnapshotHeader::Version;
+  }
+
+  // number of records the snapshot holds.
+  uint64_t count() const {
+    return ok() ? header_.count_ : 0;
+  }
+
+  /**
+   * forEachColdestFirst deserializes the maxCount hottest records and calls fn(TKey&&, TValue&&, ttl) on
+   * each, coldest first, so that inserting them in turn leaves the hottest one most recently used.
+   * ttl is the remaining time to live in nanoseconds, 0 if never expiring, records expired since the save
+   * and records the serializer rejects are skipped.
+   *
+   */
+  template <typename TKey, typename TValue, typename TSerializer, typename F>
+  void forEachColdestFirst(size_t maxCount, const TSerializer& serializer, F&& fn) const {
+    const size_t count = static_cast<size_t>(std::min<uint64_t>(this->count(), maxCount));
+
+    // records are variable-length, locate them front to back first.
+    std::vector<const char*> records;
+    records.reserve(count);
+
+    size_t offset = sizeof(SnapshotHeader);
+    while (records.size() < count && size_ - offset >= sizeof(SnapshotRecordHeader)) {
+      SnapshotRecordHeader header;
+      std::memcpy(&header, data_ + offset, sizeof(header));
+
+      const size_t recordSize = sizeof(header) + size_t{header.keySize_} + header.valueSize_;
+      if (size_ - offset < recordSize) {
+        break;
+      }
+
+      records.push_back(data_ + offset);
+      offset += recordSize;
+    }
+
+    const int64_t elapsed = snapshotClockNow() - header_.savedAt_;
+
+    for (auto it = records.rbegin(); it != records.rend(); ++it) {
+      SnapshotRecordHeader header;
+      std::memcpy(&header, *it, sizeof(header));
+
+      int64_t ttl = 0;
+      if (header.ttl_ != 0) {
+        ttl = header.ttl_ - std::max<int64_t>(elapsed, 0);
+        if (ttl <= 0) {
+          continue;
+        }
+      }
+
+      const char* key = *it + sizeof(header);
+      const char* value = key + header.keySize_;
+
+      TKey k{};
+      TValue v{};
+      if (serializer.deserialize(key, header.keySize_, k) && serializer.deserialize(value, header.valueSize_, v)) {
+        fn(std::move(k), std::move(v), ttl);
+      }
+    }
+  }
+
+ private:
+  const char* data_{nullptr};
+  size_t size_{0};
+  SnapshotHeader header_{};
+};
+}  // namespace LRUC
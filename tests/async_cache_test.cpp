@@ -0,0 +1,308 @@
+/**
+ * AsyncCache test, C++20: coroutine lookups over an LRUCache, resumed inline, loads held open by a Gate
+ * until the test lets them complete.
+ *
+ *  coalescing: concurrent misses of a key run a single load, every caller gets its value.
+ *  find_async: waits for a load in flight, misses right away otherwise.
+ *  exception: a throwing loader fails every waiting caller, nothing is stored.
+ *  loaders: plain functions and awaitables(Task, awaiting a Gate) both load.
+ *  recheck: a waiter resumed inline by a load found on its re-check may write the key, the loading
+ *   caller's accessor is released by then, even one holding a lock of the cache.
+ *
+ * Exits with a non zero status on failure.
+ *
+ */
+
+#include "../async_cache.h"
+
+#include <coroutine>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Cache = LRUC::LRUCache<int, int>;
+using Async = LRUC::AsyncCache<int, int>;
+
+/**
+ * Gate suspends the coroutines awaiting it until open() resumes them, on the calling thread.
+ *
+ */
+struct Gate final {
+  bool open_{false};
+  std::vector<std::coroutine_handle<>> waiters_;
+
+  bool await_ready() const noexcept {
+    return open_;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    waiters_.push_back(handle);
+  }
+
+  void await_resume() const noexcept {}
+
+  void open() {
+    open_ = true;
+    std::vector<std::coroutine_handle<>> waiters;
+    waiters.swap(waiters_);
+    for (std::coroutine_handle<> waiter : waiters) {
+      waiter.resume();
+    }
+  }
+};
+
+/**
+ * Detached is a coroutine started right away and never awaited, the test's entry into coroutine code.
+ *
+ */
+struct Detached final {
+  struct promise_type final {
+    Detached get_return_object() noexcept {
+      return {};
+    }
+
+    std::suspend_never initial_suspend() const noexcept {
+      return {};
+    }
+
+    std::suspend_never final_suspend() const noexcept {
+      return {};
+    }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+// outcome of a caller.
+struct Result final {
+  bool done_{false};
+  bool failed_{false};
+  std::optional<int> value_;
+};
+
+// key * 10, once gate opened.
+LRUC::Task<int> gatedLoad(Gate& gate, int key, bool fail) {
+  co_await gate;
+  if (fail) {
+    throw std::runtime_error("load failed");
+  }
+
+  co_return key * 10;
+}
+
+// awaitable loader counting its calls.
+struct GatedLoader final {
+  Gate& gate_;
+  int& calls_;
+  bool fail_{false};
+
+  LRUC::Task<int> operator()(const int& key) const {
+    ++calls_;
+    return gatedLoad(gate_, key, fail_);
+  }
+};
+
+template <typename TAsync, typename F>
+Detached getOrLoad(TAsync& async, int key, F loader, Result& result) {
+  try {
+    result.value_ = co_await async.get_or_load_async(key, std::move(loader));
+  } catch (const std::runtime_error&) {
+    result.failed_ = true;
+  }
+  result.done_ = true;
+}
+
+Detached findAsync(Async& async, int key, Result& result) {
+  result.value_ = co_await async.find_async(key);
+  result.done_ = true;
+}
+
+bool check(const char* name, bool ok) {
+  std::printf("%s: %s\n", name, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+bool coalescing() {
+  Cache cache(64);
+  Async async(cache);
+  Gate gate;
+  int calls = 0;
+
+  Result results[4];
+  for (Result& result : results) {
+    getOrLoad(async, 1, GatedLoader{gate, calls}, result);
+  }
+  bool ok = calls == 1 && !results[0].done_;
+
+  gate.open();
+  for (const Result& result : results) {
+    ok = ok && result.done_ && result.value_ == 10;
+  }
+
+  Cache::ConstAccessor ac;
+  return check("coalescing", ok && cache.find(ac, 1) && *ac == 10);
+}
+
+bool findWaitsForLoad() {
+  Cache cache(64);
+  Async async(cache);
+  Gate gate;
+  int calls = 0;
+
+  Result missed;
+  findAsync(async, 2, missed);
+  bool ok = missed.done_ && !missed.value_;
+
+  Result loading;
+  Result waiting;
+  getOrLoad(async, 2, GatedLoader{gate, calls}, loading);
+  findAsync(async, 2, waiting);
+  ok = ok && !waiting.done_;
+
+  gate.open();
+  ok = ok && loading.value_ == 20 && waiting.done_ && waiting.value_ == 20;
+
+  Result hit;
+  findAsync(async, 2, hit);
+  return check("find_async", ok && hit.done_ && hit.value_ == 20);
+}
+
+bool exceptionPropagates() {
+  Cache cache(64);
+  Async async(cache);
+  Gate gate;
+  int calls = 0;
+
+  Result results[3];
+  for (Result& result : results) {
+    getOrLoad(async, 3, GatedLoader{gate, calls, true}, result);
+  }
+  Result found;
+  findAsync(async, 3, found);
+
+  gate.open();
+  bool ok = calls == 1 && found.done_ && !found.value_;
+  for (const Result& result : results) {
+    ok = ok && result.done_ && result.failed_ && !result.value_;
+  }
+
+  // nothing stored, the next miss loads again.
+  Cache::ConstAccessor ac;
+  ok = ok && !cache.find(ac, 3);
+  Result retried;
+  getOrLoad(async, 3, [](const int& key) { return key + 1; }, retried);
+  return check("exception", ok && retried.value_ == 4);
+}
+
+bool loaders() {
+  Cache cache(64);
+  Async async(cache);
+  Gate gate;
+  gate.open();
+  int calls = 0;
+
+  Result plain;
+  getOrLoad(async, 4, [](const int& key) { return key + 1; }, plain);
+  Result awaitable;
+  getOrLoad(async, 5, GatedLoader{gate, calls}, awaitable);
+  Result hit;
+  getOrLoad(async, 4, [](const int&) { return -1; }, hit);
+
+  return check("loaders", plain.value_ == 5 && awaitable.value_ == 50 && calls == 1 && hit.value_ == 5);
+}
+
+/**
+ * RacingCache is a tbb::concurrent_hash_map whose ConstAccessor keeps its entry read-locked until released,
+ * unlike LRUCache's. Its hook runs once on the given find() call, before the lookup: it lets the test act
+ * right between the loading caller's miss and its re-check.
+ *
+ */
+struct RacingCache final {
+  using HashMap = tbb::concurrent_hash_map<int, int>;
+
+  struct ConstAccessor final {
+    const int& operator*() const {
+      return accessor_->second;
+    }
+
+    void release() {
+      accessor_.release();
+    }
+
+    HashMap::const_accessor accessor_;
+  };
+
+  HashMap map_;
+  int finds_{0};
+  int hookedFind_{0};
+  std::function<void()> hook_;
+
+  bool find(ConstAccessor& ac, const int& key) {
+    if (++finds_ == hookedFind_ && hook_) {
+      std::exchange(hook_, nullptr)();
+    }
+    return map_.find(ac.accessor_, key);
+  }
+
+  bool insert_or_assign(const int& key, int value) {
+    HashMap::accessor accessor;
+    const bool inserted = map_.insert(accessor, key);
+    accessor->second = value;
+    return inserted;
+  }
+
+  std::optional<int> get(int key) const {
+    HashMap::const_accessor accessor;
+    return map_.find(accessor, key) ? std::optional<int>(accessor->second) : std::nullopt;
+  }
+};
+
+using RacingAsync = LRUC::AsyncCache<int, int, RacingCache>;
+
+// waits for key, then writes it from the thread resuming it.
+Detached waitThenWrite(RacingAsync& async, RacingCache& cache, int key, Result& result) {
+  result.value_ = co_await async.get_or_load_async(key, [](const int&) { return -1; });
+  cache.insert_or_assign(key, *result.value_ + 1);
+  result.done_ = true;
+}
+
+bool recheckReleasesAccessor() {
+  constexpr int Key = 6;
+  RacingCache cache;
+  RacingAsync async(cache);
+  Result waiter;
+
+  // find() #2 is the loader's re-check: a waiter queues on its flight, then the key gets stored, so that
+  // the re-check hits and completes the flight, resuming the waiter inline.
+  cache.hookedFind_ = 2;
+  cache.hook_ = [&] {
+    waitThenWrite(async, cache, Key, waiter);
+    cache.insert_or_assign(Key, 60);
+  };
+
+  Result loader;
+  getOrLoad(async, Key, [](const int&) { return -1; }, loader);
+
+  return check("recheck", loader.value_ == 60 && waiter.done_ && waiter.value_ == 60 && cache.get(Key) == 61);
+}
+
+}  // namespace
+
+int main() {
+  bool ok = coalescing();
+  ok = findWaitsForLoad() && ok;
+  ok = exceptionPropagates() && ok;
+  ok = loaders() && ok;
+  ok = recheckReleasesAccessor() && ok;
+  return ok ? 0 : 1;
+}
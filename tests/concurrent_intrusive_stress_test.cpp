@@ -0,0 +1,272 @@
+/**
+ * ConcurrentIntrusiveHashTable stress test: readers looking keys up while writers insert and remove into
+ * a table growing from a tiny size hint, so that lookups keep crossing bucket migrations.
+ *
+ * Stable keys are inserted Duplicates times up front(once with unique keys) and never removed: every
+ * lookup of one must find exactly that many items, all with that key. Writers churn keys of their own,
+ * each removed item is marked free once a synchronize() returned, then given a new key and inserted again:
+ * a lookup comparing a free item traversed an item it should no longer see. Another thread keeps calling
+ * synchronize(), which also frees the bucket arrays retired by growths.
+ *
+ * Once they joined, every churned item must be found if linked and missed otherwise, and getSize() must
+ * count the linked items. Exits with a non zero status on failure.
+ *
+ */
+
+#include "../concurrent_intrusive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int StableKeys = 512;
+
+constexpr int Duplicates = 4;
+
+constexpr int ItemsPerWriter = 1 << 15;
+
+constexpr int OperationsPerWriter = 1 << 16;
+
+// fresh tables per key mode, each growing from the size hint again.
+constexpr int Rounds = 8;
+
+// operations between two synchronize() calls of a writer, recycling the items it removed meanwhile.
+constexpr int RecycleInterval = 256;
+
+// churned keys of writer w start at (w + 1) * KeyStride, above the stable ones.
+constexpr int KeyStride = 1 << 24;
+
+// comparisons of free items by lookups, none unless synchronize() returned before a lookup was done.
+std::atomic<int64_t> freeItemsCompared{0};
+
+// key and free are only read by lookups if the table is broken, atomic so that this is a failed check
+// rather than a data race of the test itself.
+struct Item : ConcurrentHashTableNode<Item> {
+  explicit Item(int key) : key(key) {}
+
+  std::atomic<int> key;
+  // removed and no longer traversed, about to get a new key.
+  std::atomic<bool> free{false};
+};
+
+struct ItemEqual {
+  bool operator()(const Item& item, int key) const {
+    if (item.free.load(std::memory_order_relaxed)) {
+      freeItemsCompared.fetch_add(1, std::memory_order_relaxed);
+    }
+    return item.key.load(std::memory_order_relaxed) == key;
+  }
+};
+
+// multiplicative, std::hash<int> is the identity: consecutive keys would never share a bucket.
+struct ItemHash {
+  size_t operator()(int key) const {
+    return static_cast<size_t>(static_cast<uint32_t>(key)) * 0x9E3779B97F4A7C15ull;
+  }
+};
+
+using Table = ConcurrentIntrusiveHashTable<int, Item, ItemHash, ItemEqual>;
+
+int readerCount() {
+  return static_cast<int>(std::max(std::thread::hardware_concurrency(), 4u));
+}
+
+int writerCount() {
+  return static_cast<int>(std::max(std::thread::hardware_concurrency() / 2, 2u));
+}
+
+struct Writer {
+  std::deque<Item> items;
+  // next key to give an item, read by lookups to pick keys that may be linked.
+  std::atomic<int> nextKey{0};
+};
+
+void read(const Table& table, const std::vector<Writer>& writers, int duplicates, uint32_t seed,
+          const std::atomic<bool>& running, std::atomic<int64_t>& failures) {
+  std::mt19937 rng(seed);
+  Item* found[Duplicates * 2];
+  int64_t bad = 0;
+
+  while (running.load(std::memory_order_relaxed)) {
+    const int key = static_cast<int>(rng() % StableKeys) + 1;
+    const Item* item = table.find(key);
+    bad += item == nullptr || item->key.load(std::memory_order_relaxed) != key;
+    bad += table.countAllMatching(key) != static_cast<size_t>(duplicates);
+
+    const size_t count = table.findAllMatching(key, found, Duplicates * 2);
+    bad += count != static_cast<size_t>(duplicates);
+    for (size_t i = 0; i < std::min<size_t>(count, Duplicates * 2); ++i) {
+      bad += found[i]->key.load(std::memory_order_relaxed) != key;
+    }
+
+    // a churned item may be removed and recycled as soon as find() returned, it is not dereferenced.
+    const Writer& writer = writers[rng() % writers.size()];
+    const int churned = writer.nextKey.load(std::memory_order_relaxed);
+    if (churned > 0) {
+      const int churnedKey = static_cast<int>(&writer - writers.data() + 1) * KeyStride +
+                             static_cast<int>(rng() % static_cast<uint32_t>(churned));
+      table.find(churnedKey);
+    }
+  }
+
+  failures.fetch_add(bad, std::memory_order_relaxed);
+}
+
+void write(Table& table, Writer& writer, int threadIndex, uint32_t seed, std::atomic<int64_t>& failures) {
+  std::mt19937 rng(seed);
+  const int keyBase = (threadIndex + 1) * KeyStride;
+
+  // free: unlinked and no longer traversed, linked: in the table, removed: waiting for synchronize().
+  std::vector<Item*> free;
+  std::vector<Item*> linked;
+  std::vector<Item*> removed;
+  for (Item& item : writer.items) {
+    free.push_back(&item);
+  }
+
+  int64_t bad = 0;
+  for (int i = 0; i < OperationsPerWriter; ++i) {
+    // 3 insertions for 1 removal, so that the table keeps growing.
+    if (!free.empty() && (linked.empty() || rng() % 4 != 0)) {
+      Item* item = free.back();
+      free.pop_back();
+      const int key = keyBase + writer.nextKey.load(std::memory_order_relaxed);
+      item->key.store(key, std::memory_order_relaxed);
+      item->free.store(false, std::memory_order_relaxed);
+      bad += !table.insert(key, item);
+      writer.nextKey.store(key - keyBase + 1, std::memory_order_relaxed);
+      linked.push_back(item);
+    } else if (!linked.empty()) {
+      const size_t index = rng() % linked.size();
+      Item* item = linked[index];
+      linked[index] = linked.back();
+      linked.pop_back();
+      bad += table.remove(item->key.load(std::memory_order_relaxed)) != item;
+      removed.push_back(item);
+    }
+
+    if (i % RecycleInterval == 0) {
+      table.synchronize();
+      for (Item* item : removed) {
+        item->free.store(true, std::memory_order_relaxed);
+        free.push_back(item);
+      }
+      removed.clear();
+    }
+  }
+
+  failures.fetch_add(bad, std::memory_order_relaxed);
+}
+
+bool stress(bool allowDuplicateKeys, int round) {
+  const char* name = allowDuplicateKeys ? "duplicate keys" : "unique keys";
+  std::vector<Writer> writers(static_cast<size_t>(writerCount()));
+  std::deque<Item> stable;
+  // unique keys: a single item per stable key.
+  const int duplicates = allowDuplicateKeys ? Duplicates : 1;
+  Table table(allowDuplicateKeys, 3);
+
+  for (int key = 1; key <= StableKeys; ++key) {
+    for (int i = 0; i < duplicates; ++i) {
+      stable.emplace_back(key);
+      table.insert(key, &stable.back());
+    }
+  }
+  for (Writer& writer : writers) {
+    for (int i = 0; i < ItemsPerWriter; ++i) {
+      writer.items.emplace_back(0);
+    }
+  }
+
+  std::atomic<bool> running{true};
+  std::atomic<int64_t> failures{0};
+  freeItemsCompared = 0;
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < readerCount(); ++i) {
+    readers.emplace_back([&, i] {
+      read(table, writers, duplicates, static_cast<uint32_t>(round * 100 + i), running, failures);
+    });
+  }
+  std::thread synchronizer([&] {
+    while (running.load(std::memory_order_relaxed)) {
+      table.synchronize();
+      std::this_thread::yield();
+    }
+  });
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < writers.size(); ++i) {
+    threads.emplace_back([&, i] {
+      write(table, writers[i], static_cast<int>(i), static_cast<uint32_t>(round * 100 + 50 + i), failures);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  running = false;
+  for (std::thread& thread : readers) {
+    thread.join();
+  }
+  synchronizer.join();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  bool ok = true;
+  if (freeItemsCompared.load() != 0) {
+    std::fprintf(stderr, "%s: free items compared %lld times by lookups\n", name,
+                 static_cast<long long>(freeItemsCompared.load()));
+    ok = false;
+  }
+  if (failures.load() != 0) {
+    std::fprintf(stderr, "%s: %lld failed checks under concurrency\n", name, static_cast<long long>(failures.load()));
+    ok = false;
+  }
+
+  size_t linked = static_cast<size_t>(StableKeys) * duplicates;
+  int64_t mismatches = 0;
+  for (Writer& writer : writers) {
+    for (Item& item : writer.items) {
+      const Item* found = table.find(item.key.load(std::memory_order_relaxed));
+      if (item.isLinkedToHashTable()) {
+        ++linked;
+        mismatches += found != &item;
+      } else {
+        mismatches += found == &item;
+      }
+    }
+  }
+  if (mismatches != 0) {
+    std::fprintf(stderr, "%s: %lld items linked but missed or unlinked but found\n", name,
+                 static_cast<long long>(mismatches));
+    ok = false;
+  }
+  if (linked != table.getSize()) {
+    std::fprintf(stderr, "%s: %zu items linked, getSize() is %zu\n", name, linked, table.getSize());
+    ok = false;
+  }
+
+  const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+  std::printf("%s, round %d: %s, %d readers, %zu writers, %lld ms, %zu buckets\n", name, round, ok ? "ok" : "FAILED",
+              readerCount(), writers.size(), static_cast<long long>(millis), table.getBucketCount());
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = true;
+  for (int round = 0; round < Rounds; ++round) {
+    ok = stress(true, round) && ok;
+    ok = stress(false, round) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+/**
+ * LRUCache stress test: many threads hammering insert/insert_or_assign/erase/find on a small shared cache,
+ * from a key space several times its capacity so that most inserts evict.
+ *
+ * While they run, a monitor thread asserts that size() never exceeds capacity() and weight() never
+ * exceeds maxWeight(). Once they joined, checkConsistency() asserts that the list(s) and the hash-table
+ * agree, then that find() hits exactly size() keys.
+ *
+ * Run for every EvictionPolicy, unit and variable weights. Then for FlatLRUCache, whose lookups copy
+ * values out of a seqlock-guarded set while writers assign them: every value found must be a whole
+ * single assignment of its key, never torn between two, and size() must never exceed capacity().
+ * Exits with a non zero status on failure.
+ *
+ */
+
+#include "../cache.h"
+#include "../flat_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using LRUC::EvictionPolicy;
+
+constexpr int Capacity = 1 << 10;
+
+constexpr int KeySpace = Capacity * 4;
+
+constexpr int OperationsPerThread = 200000;
+
+// weights 1..4, so that the weight bound is reached before the size bound.
+struct VariableWeigher final {
+  size_t operator()(const int& key, const int&) const noexcept {
+    return static_cast<size_t>(key % 4) + 1;
+  }
+};
+
+constexpr size_t MaxWeight = Capacity * 2;
+
+int threadCount() {
+  return static_cast<int>(std::max(std::thread::hardware_concurrency() * 2, 8u));
+}
+
+template <typename TCache>
+void hammer(TCache& cache, int threadIndex) {
+  std::mt19937 rng(static_cast<uint32_t>(threadIndex));
+  std::uniform_int_distribution<int> keys(1, KeySpace);
+  std::uniform_int_distribution<int> operations(0, 9);
+
+  typename TCache::ConstAccessor ac;
+  for (int i = 0; i < OperationsPerThread; ++i) {
+    const int key = keys(rng);
+    switch (operations(rng)) {
+      case 0:
+      case 1:
+        cache.erase(key);
+        break;
+      case 2:
+      case 3:
+        cache.insert(key, key);
+        break;
+      case 4:
+        cache.insert_or_assign(key, key);
+        break;
+      default:
+        if (cache.find(ac, key) && *ac != key) {
+          std::fprintf(stderr, "key %d found with value %d\n", key, *ac);
+          std::abort();
+        }
+        break;
+    }
+  }
+}
+
+template <typename TCache>
+bool stress(const char* name, TCache& cache) {
+  std::atomic<bool> running{true};
+  std::atomic<int64_t> overflows{0};
+  int maxSize = 0;
+  size_t maxWeight = 0;
+
+  std::thread monitor([&] {
+    while (running.load(std::memory_order_relaxed)) {
+      const int size = cache.size();
+      const size_t weight = cache.weight();
+      maxSize = std::max(maxSize, size);
+      maxWeight = std::max(maxWeight, weight);
+      if (size > cache.capacity() || weight > cache.maxWeight()) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  });
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threadCount(); ++i) {
+    threads.emplace_back([&cache, i] { hammer(cache, i); });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  running = false;
+  monitor.join();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  bool ok = true;
+  if (overflows.load() != 0) {
+    std::fprintf(stderr, "%s: size() or weight() observed over its bound %lld times\n", name,
+                 static_cast<long long>(overflows.load()));
+    ok = false;
+  }
+  if (!cache.checkConsistency()) {
+    std::fprintf(stderr, "%s: list and hash-table disagree\n", name);
+    ok = false;
+  }
+
+  int hits = 0;
+  typename TCache::ConstAccessor ac;
+  for (int key = 1; key <= KeySpace; ++key) {
+    hits += cache.find(ac, key);
+  }
+  if (hits != cache.size()) {
+    std::fprintf(stderr, "%s: %d keys found, size() is %d\n", name, hits, cache.size());
+    ok = false;
+  }
+
+  const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+  std::printf("%s: %s, %d threads, %lld ms, max size %d/%d, max weight %zu\n", name, ok ? "ok" : "FAILED",
+              threadCount(), static_cast<long long>(millis), maxSize, cache.capacity(), maxWeight);
+  return ok;
+}
+
+// FlatLRUCache value spanning two words: a ^ b is the key only if both come from the same assignment.
+struct Salted final {
+  uint64_t a;
+  uint64_t b;
+};
+
+using FlatCache = LRUC::FlatLRUCache<uint64_t, Salted>;
+
+// one assignment of key, salted so that two assignments of the same key differ.
+Salted saltedValue(uint64_t key, uint64_t salt) {
+  return Salted{key ^ salt, salt};
+}
+
+bool isValueOf(const Salted& value, uint64_t key) {
+  return (value.a ^ value.b) == key;
+}
+
+void hammerFlat(FlatCache& cache, int threadIndex, std::atomic<int64_t>& mismatches) {
+  std::mt19937_64 rng(static_cast<uint64_t>(threadIndex));
+  std::uniform_int_distribution<uint64_t> keys(1, KeySpace);
+  std::uniform_int_distribution<int> operations(0, 9);
+
+  FlatCache::ConstAccessor ac;
+  int64_t mismatched = 0;
+  for (int i = 0; i < OperationsPerThread; ++i) {
+    const uint64_t key = keys(rng);
+    switch (operations(rng)) {
+      case 0:
+      case 1:
+        cache.erase(key);
+        break;
+      case 2:
+      case 3:
+        cache.insert(key, saltedValue(key, rng()));
+        break;
+      case 4:
+        cache.insert_or_assign(key, saltedValue(key, rng()));
+        break;
+      default:
+        mismatched += cache.find(ac, key) && !isValueOf(*ac, key);
+        break;
+    }
+  }
+
+  mismatches.fetch_add(mismatched, std::memory_order_relaxed);
+}
+
+bool stressFlat(const char* name) {
+  FlatCache cache(Capacity);
+  std::atomic<bool> running{true};
+  std::atomic<int64_t> overflows{0};
+  std::atomic<int64_t> mismatches{0};
+  int maxSize = 0;
+
+  std::thread monitor([&] {
+    while (running.load(std::memory_order_relaxed)) {
+      const int size = cache.size();
+      maxSize = std::max(maxSize, size);
+      if (size > cache.capacity()) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  });
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threadCount(); ++i) {
+    threads.emplace_back([&cache, &mismatches, i] { hammerFlat(cache, i, mismatches); });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  running = false;
+  monitor.join();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  bool ok = true;
+  if (overflows.load() != 0) {
+    std::fprintf(stderr, "%s: size() observed over capacity() %lld times\n", name,
+                 static_cast<long long>(overflows.load()));
+    ok = false;
+  }
+  if (mismatches.load() != 0) {
+    std::fprintf(stderr, "%s: %lld values found torn or of another key\n", name,
+                 static_cast<long long>(mismatches.load()));
+    ok = false;
+  }
+
+  int hits = 0;
+  FlatCache::ConstAccessor ac;
+  for (uint64_t key = 1; key <= KeySpace; ++key) {
+    if (cache.find(ac, key)) {
+      ++hits;
+      if (!isValueOf(*ac, key)) {
+        std::fprintf(stderr, "%s: key %llu holds a value of another key\n", name, static_cast<unsigned long long>(key));
+        ok = false;
+      }
+    }
+  }
+  if (hits != cache.size()) {
+    std::fprintf(stderr, "%s: %d keys found, size() is %d\n", name, hits, cache.size());
+    ok = false;
+  }
+
+  const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+  std::printf("%s: %s, %d threads, %lld ms, max size %d/%d\n", name, ok ? "ok" : "FAILED", threadCount(),
+              static_cast<long long>(millis), maxSize, cache.capacity());
+  return ok;
+}
+
+template <EvictionPolicy Policy>
+bool stressPolicy(const char* unitName, const char* weightedName) {
+  LRUC::LRUCache<int, int, tbb::tbb_hash_compare<int>, Policy> unit(Capacity);
+  LRUC::LRUCache<int, int, tbb::tbb_hash_compare<int>, Policy, VariableWeigher> weighted(Capacity, 64, MaxWeight);
+
+  const bool unitOk = stress(unitName, unit);
+  const bool weightedOk = stress(weightedName, weighted);
+  return unitOk && weightedOk;
+}
+
+}  // namespace
+
+int main() {
+  bool ok = stressPolicy<EvictionPolicy::LRU>("LRU", "LRU, weighted");
+  ok = stressPolicy<EvictionPolicy::Clock>("Clock", "Clock, weighted") && ok;
+  ok = stressPolicy<EvictionPolicy::WTinyLFU>("WTinyLFU", "WTinyLFU, weighted") && ok;
+  ok = stressFlat("FlatLRUCache") && ok;
+  return ok ? 0 : 1;
+}